@@ -0,0 +1,131 @@
+/*
+ *  A4N.h
+ *  A4N
+ *
+ *  C interface to NodeAttributeMap for foreign runtimes, e.g. Python via
+ *  ctypes or Rust via bindgen. Only fixed-width types cross it, and its
+ *  structs only ever grow at the end; A4N_ABI_VERSION changes otherwise.
+ *
+ *  Values are read without copying through a view (a4n_borrow()), a
+ *  copy-on-write snapshot of one attribute: its buffers stay unchanged
+ *  and alive until a4n_release(), even while the map is written or the
+ *  attribute detached. Values are stored in chunks; chunk c holds the
+ *  values of nodes [first, first + length) contiguously, and a node is
+ *  valid if its bit (node - first) is set in the chunk's validity words.
+ *  Slots that are not valid hold unspecified values.
+ *
+ *  Plain attributes of the scalar types below are visible; C++ hosts make
+ *  attributes of their own trivially copyable types visible with
+ *  Attributes::exportType() and pass their maps with exportMap() (see
+ *  CApi.hpp). No function may run concurrently with a write to the same
+ *  map, but views may be read and released on any thread: the map copies
+ *  a chunk that a view still holds before writing to it. Releasing the
+ *  last holder of a chunk frees it into the resource of its attribute,
+ *  which must then be thread-safe, as the default resources are.
+ *  Views of attributes in external memory, e.g. shared memory written by
+ *  other processes or a mapped file, copy the values when borrowed, in
+ *  time linear in the values.
+ */
+
+#ifndef A4N_h
+#define A4N_h
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define A4N_ABI_VERSION 1
+
+typedef struct a4n_map a4n_map;   /* a map, owned or exported by a C++ host */
+typedef struct a4n_view a4n_view; /* borrowed snapshot of one attribute */
+
+typedef enum a4n_status {
+    A4N_OK = 0,
+    A4N_NOT_FOUND,     /* no attribute or type of that name */
+    A4N_UNSUPPORTED,   /* attribute of a kind or type not exported */
+    A4N_OUT_OF_RANGE,
+    A4N_ERROR          /* see a4n_last_error() */
+} a4n_status;
+
+typedef enum a4n_kind {
+    A4N_KIND_NONE = 0, /* not readable through this interface */
+    A4N_KIND_SIGNED,   /* two's complement integer */
+    A4N_KIND_UNSIGNED,
+    A4N_KIND_FLOAT,    /* IEEE 754 */
+    A4N_KIND_BOOL,     /* one byte, 0 or 1 */
+    A4N_KIND_OPAQUE    /* trivially copyable struct, layout known by name */
+} a4n_kind;
+
+typedef struct a4n_type {
+    const char* name; /* "int8" ... "int64", "uint8" ... "uint64", "float32",
+                         "float64", "bool", or as exported; NULL if none */
+    uint32_t kind;    /* a4n_kind */
+    uint32_t size;    /* bytes per value */
+    uint32_t align;
+    uint32_t reserved;
+} a4n_type;
+
+typedef struct a4n_attribute_info {
+    const char* name; /* NUL-terminated, owned by the map or view */
+    a4n_type type;
+    uint64_t valid;   /* nodes with a value */
+    uint64_t length;  /* nodes covered by the value chunks */
+} a4n_attribute_info;
+
+typedef struct a4n_chunk {
+    const void* values;       /* length values of type.size bytes */
+    const uint64_t* validity; /* bit i of word i / 64 belongs to node first + i */
+    uint64_t first;
+    uint64_t length;
+    uint64_t validity_words;  /* words at validity; later bits are 0 */
+} a4n_chunk;
+
+/* A4N_ABI_VERSION of the library. */
+uint32_t a4n_abi_version(void);
+
+/* Message of the last A4N_ERROR on this thread. */
+const char* a4n_last_error(void);
+
+/* An empty map of its own; NULL on failure. */
+a4n_map* a4n_map_create(void);
+
+/* Frees the handle, and the map unless a C++ host exported it. */
+void a4n_map_destroy(a4n_map* map);
+
+/* See NodeAttributeMap::save() and load(). */
+a4n_status a4n_map_save(const a4n_map* map, const char* path);
+a4n_status a4n_map_load(a4n_map* map, const char* path);
+
+/* Attaches a plain attribute with values of the exported type type. */
+a4n_status a4n_attach(a4n_map* map, const char* name, const char* type);
+
+/* Sets the value of node from type.size bytes at value. */
+a4n_status a4n_set(a4n_map* map, const char* name, uint64_t node, const void* value);
+
+/* Describes up to capacity attributes in infos; returns their number.
+   Names stay valid until their attribute is detached. */
+size_t a4n_list(const a4n_map* map, a4n_attribute_info* infos, size_t capacity);
+
+/* Snapshot of the attribute name; A4N_UNSUPPORTED unless its type is
+   exported. */
+a4n_status a4n_borrow(const a4n_map* map, const char* name, a4n_view** view);
+
+/* Ends the view; its pointers become invalid. */
+void a4n_release(a4n_view* view);
+
+void a4n_view_info(const a4n_view* view, a4n_attribute_info* info);
+
+uint64_t a4n_chunk_count(const a4n_view* view);
+
+a4n_status a4n_get_chunk(const a4n_view* view, uint64_t c, a4n_chunk* chunk);
+
+/* Value of node, or NULL if it is not valid. */
+const void* a4n_value(const a4n_view* view, uint64_t node);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* A4N_h */
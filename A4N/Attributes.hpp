@@ -7,29 +7,125 @@
 
 #ifndef Attributes_h
 #define Attributes_h
+#include <algorithm>
+#include <atomic>
 #include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <limits>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
 #include <optional>
+#include <sstream>
 #include <stdexcept>
 #include <string>
 #include <typeindex>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 
+#include "Bitmap.hpp"
+#include "Column.hpp"
+#include "Hash.hpp"
+#include "IoPool.hpp"
+#include "Parallel.hpp"
+#include "Reclaimer.hpp"
+#include "Serialize.hpp"
+#include "Snapshot.hpp"
+#include "UndoLog.hpp"
+#include "Validity.hpp"
+
 namespace Attributes {
 
 using index = size_t;
 
+// Largest node id taken from files and streams unless raised, e.g. by
+// StreamIngester::Options::maxNode; larger ids are counted as rejected
+// instead of growing every attribute to them.
+constexpr index defaultMaxNode = (index{1} << 32) - 1;
+
 template <typename T>
 class NodeAttribute;
 
+// Registration shared by all attribute handles: a handle is listed in
+// the attrSet of its storage for as long as it refers to it, so that the
+// storage can invalidate it when the attribute is removed from its map.
+template<typename Storage>
+class AttributeHandle {
+public:
+    explicit AttributeHandle(std::shared_ptr<Storage> owned_storage)
+    : owned_storage{std::move(owned_storage)}, valid{true} {
+        this->owned_storage->attrSet.insert(this);
+    }
+    
+    AttributeHandle(AttributeHandle const& other)
+    : owned_storage{other.owned_storage}, valid{other.valid} {
+        owned_storage->attrSet.insert(this);
+    }
+    
+    // Moves the registration over if other refers to another storage.
+    AttributeHandle& operator=(AttributeHandle const& other) {
+        if (owned_storage != other.owned_storage) {
+            other.owned_storage->attrSet.insert(this);
+            owned_storage->attrSet.erase(this);
+            owned_storage = other.owned_storage;
+        }
+        valid = other.valid;
+        return *this;
+    }
+    
+    ~AttributeHandle() {
+        owned_storage->attrSet.erase(this);
+    }
+    
+    void checkAttribute() {
+        if (!valid) {
+            throw std::runtime_error("Invalid attribute");
+        }
+    }
+    
+protected:
+    std::shared_ptr<Storage> owned_storage;
+    
+private:
+    void invalidateAttribute() {
+        valid = false;
+    }
+    
+    bool valid;
+    friend Storage;
+}; // class AttributeHandle
+
+// Receives the writes of storages it is registered with, see
+// NodeAttributeStorageBase::addMirror().
+class RecordMirror {
+public:
+    virtual ~RecordMirror() = default;
+    // value is null if slot i became invalid.
+    virtual void update(index i, unsigned field, void const* value) = 0;
+    // All slots were replaced at once, e.g. by load().
+    virtual void reload(unsigned field) = 0;
+};
+
 // Base class for all node attributes.
 class NodeAttributeStorageBase {
 public:
-    NodeAttributeStorageBase(std::string name, std::type_index type)
-    : name{name}, type{type} { }
+    // Granularity of content hashing.
+    static constexpr index chunkBits = 16;
+    static constexpr index chunkSize = index{1} << chunkBits;
+    
+    // Metadata (name, bitmaps, logs) is allocated from the resource of name.
+    NodeAttributeStorageBase(std::pmr::string name, std::type_index type)
+    : name{std::move(name)}, type{type},
+      valid{getResource()}, touched{getResource()}, mirrors{getResource()},
+      dirtyChunks{getResource()}, chunkHashes{getResource()},
+      validated{getResource()} { }
     
     virtual ~NodeAttributeStorageBase() = default;
     
@@ -39,29 +135,181 @@ public:
         return name;
     }
     
-    std::type_index getType() {
+    std::type_index getType() const {
         return type;
     }
     
+    std::pmr::memory_resource* getResource() const {
+        return name.get_allocator().resource();
+    }
+    
+    // Approximate bytes held by this storage.
+    virtual std::size_t memoryUsage() const {
+        return valid.memoryUsage()
+            + touched.capacity() * sizeof(std::uint32_t)
+            + chunkHashes.capacity() * sizeof(hash_t);
+    }
+    
     bool isValid(index i) {
-        return i < valid.size() && valid[i];
+        return i < valid.size() && valid.test(i);
+    }
+    
+    Validity const& validity() const {
+        return valid;
+    }
+    
+    ValidityLayout getValidityLayout() const {
+        return valid.getLayout();
+    }
+    
+    // Converts the validity set, e.g. to Compressed for attributes set on
+    // few or clustered nodes. Adopted external validity stays dense.
+    void setValidityLayout(ValidityLayout layout) {
+        if (backing && layout != ValidityLayout::Dense) {
+            throw std::runtime_error("Adopted validity cannot be compressed");
+        }
+        valid.setLayout(layout);
+    }
+    
+    bool isReadOnly() const {
+        return readOnly;
+    }
+    
+    // Whether the owning map is in a transaction.
+    bool isInTransaction() const {
+        return undoLog != nullptr;
     }
     
     // Called by Graph when node is deleted.
-    void invalidate(index i) {
-        if(i < valid.size()) {
-            valid[i] = false;
+    virtual void invalidate(index i) {
+        if (!isValid(i)) {
+            return;
         }
-        --validElements;
+        touch(i);
+        clearValid(i);
+        mirror(i, nullptr);
+    }
+    
+    // Forwards every write to mirror as the given field.
+    void addMirror(RecordMirror* mirror, unsigned field) {
+        mirrors.emplace_back(mirror, field);
+    }
+    
+    bool hasMirrors() const {
+        return !mirrors.empty();
     }
     
+    void removeMirror(RecordMirror* mirror) {
+        mirrors.erase(std::remove_if(mirrors.begin(), mirrors.end(),
+                                     [&](auto& m) { return m.first == mirror; }),
+                      mirrors.end());
+    }
+    
+    // Copy of this storage named name, allocated from the resource of name.
+    // Attribute handles, mirrors and transaction state are not copied.
+    virtual std::shared_ptr<NodeAttributeStorageBase> clone(std::pmr::string name) const = 0;
+    
+    // Writes validity and values, see NodeAttributeMap::save().
+    virtual void save(std::ostream& out) const = 0;
+    
+    // Replaces validity and values by what save() wrote. Attribute
+    // handles stay valid and mirrors are reloaded; transactions are
+    // bypassed.
+    virtual void load(std::istream& in) = 0;
+    
 protected:
+    void saveValidity(std::ostream& out) const {
+        valid.save(out);
+    }
+    
+    void loadValidity(std::istream& in) {
+        if (readOnly) {
+            throw std::runtime_error("Attribute is read-only");
+        }
+        valid.load(in);
+        resetValidity();
+    }
+    
+    // Replaces the validity by loaded, writing adopted words in place;
+    // they must hold as many bits as loaded.
+    void assignValidity(Validity const& loaded) {
+        if (readOnly) {
+            throw std::runtime_error("Attribute is read-only");
+        }
+        auto n = valid.size();
+        valid.resize(0);
+        valid.resize(n);
+        loaded.forEach([&](index i) { valid.set(i); });
+        resetValidity();
+    }
+    
+    // Places the validity bits of n nodes at words, see Validity::view().
+    void adoptValidity(Bitmap::word* words, index n) {
+        valid.view(words, n);
+        resetValidity();
+    }
+    
+    
+    // Copies validity and hash state; the bitmaps are shared copy-on-write.
+    void copyState(NodeAttributeStorageBase const& other) {
+        valid.shareFrom(other.valid);
+        validElements = other.validElements;
+        dirtyChunks.shareFrom(other.dirtyChunks);
+        chunkHashes = other.chunkHashes;
+        backing = other.backing;
+    }
+    
+    
+    // Must be called before slot i is modified.
+    void touch(index i) {
+        if (readOnly) {
+            throw std::runtime_error("Attribute is read-only");
+        }
+        markDirty(i);
+        if (undoLog && firstTouch(i)) {
+            logUndo(*undoLog, i);
+        }
+    }
+    
     void markValid(index i) {
         if(i >= valid.size()) {
             valid.resize(i + 1);
         }
-        valid[i] = true;
-        ++validElements;
+        if (!valid.test(i)) {
+            valid.set(i);
+            ++validElements;
+            if (trackValid) {
+                validated.push_back(i);
+            }
+        }
+    }
+    
+    void clearValid(index i) {
+        valid.reset(i);
+        --validElements;
+    }
+    
+    void mirror(index i, void const* value) {
+        for (auto [m, field] : mirrors) {
+            m->update(i, field, value);
+        }
+    }
+    
+    void reloadMirrors() {
+        for (auto [m, field] : mirrors) {
+            m->reload(field);
+        }
+    }
+    
+    // Records the prior state of slot i in undoLog.
+    virtual void logUndo(UndoLog& log, index i) = 0;
+    
+    // Chunks not yet covered by chunkHashes are always rehashed.
+    void markDirty(index i) {
+        auto c = i >> chunkBits;
+        if (c < dirtyChunks.size()) {
+            dirtyChunks.set(c);
+        }
     }
     
     void checkIndex(index i) {
@@ -71,18 +319,49 @@ protected:
     }
     
 private:
-    std::string name;
+    // Recounts valid slots and forgets cached hashes after a bulk change.
+    void resetValidity() {
+        validElements = valid.count();
+        dirtyChunks.resize(0);
+        chunkHashes.clear();
+    }
+    
+    // Whether slot i is touched for the first time in this transaction.
+    bool firstTouch(index i) {
+        if (i >= touched.size()) {
+            touched.resize(std::max(i + 1, 2 * touched.size()));
+        }
+        if (touched[i] == undoLog->epoch()) {
+            return false;
+        }
+        touched[i] = undoLog->epoch();
+        return true;
+    }
+    
+    std::pmr::string name;
     std::type_index type;
-    std::vector<bool> valid; // For each node: whether attribute is set or not.
+    Validity valid; // For each node: whether attribute is set or not.
+    std::pmr::vector<std::uint32_t> touched; // Transaction epoch of the last logged write.
+    UndoLog* undoLog = nullptr; // Set while the owning map is in a transaction.
+    std::pmr::vector<std::pair<RecordMirror*, unsigned>> mirrors;
+    friend class NodeAttributeMap;
 protected:
     index validElements = 0;
+    Bitmap dirtyChunks; // Chunks changed since their hash was cached.
+    std::pmr::vector<hash_t> chunkHashes;
+    bool trackValid = false;          // Scratch storages log newly valid slots
+    std::pmr::vector<index> validated; // so that clear() costs O(touched).
+    std::shared_ptr<void> backing; // Owner of adopted external memory.
+    bool readOnly = false;         // touch() throws, see adopt().
 }; // class NodeAttributeStorageBase
 
 template<typename T>
 class NodeAttributeStorage : public NodeAttributeStorageBase {
 public:
-    NodeAttributeStorage(std::string name)
-    : NodeAttributeStorageBase{std::move(name), typeid(T)} { }
+    NodeAttributeStorage(std::pmr::string name,
+                         std::pmr::memory_resource* resource = columnResource())
+    : NodeAttributeStorageBase{std::move(name), typeid(T)},
+      values{resource}, zones(getResource()), attrSet{getResource()} { }
     
     ~NodeAttributeStorage() override {
         invalidateAttributes();
@@ -94,35 +373,493 @@ public:
     }
     
     void resize(index i) {
+        if (i == std::numeric_limits<index>::max()) {
+            throw std::out_of_range("Node index out of range");
+        }
         if(i >= values.size()) {
+            checkCapacity(i + 1);
             values.resize(i + 1);
         }
     }
     
+    // Makes room for n nodes up front; large columns are first touched
+    // in parallel (see Column::resize).
+    void reserve(index n) {
+        checkCapacity(n);
+        values.resize(n);
+    }
+    
+    // Places validity and values of capacity nodes in external memory,
+    // e.g. a shared memory segment, that stays alive as long as backing.
+    // The storage cannot grow beyond capacity, and every write throws if
+    // readOnly. Clones copy the values when made, so writes keep going to
+    // the external memory; the clones may grow.
+    // With extend, growing beyond capacity calls extend(n), which makes the
+    // memory at validity and data hold at least n nodes, without moving it,
+    // and returns the new capacity (see MappedFile).
+    void adopt(std::shared_ptr<void> backing, Bitmap::word* validity, T* data, index capacity,
+               bool readOnly, std::function<index(index)> extend = {}) {
+        static_assert(std::is_trivially_copyable_v<T>, "adopted values are not constructed");
+        this->backing = std::move(backing);
+        this->readOnly = readOnly;
+        adoptValidity(validity, capacity);
+        values.view(data, capacity);
+        fixedCapacity = true;
+        this->extend = std::move(extend);
+        adoptedValidity = validity;
+        adoptedData = data;
+    }
+    
+    // Values for zero-copy readers, see Column::chunk(); slots that are
+    // not valid hold default or stale values.
+    Column<T> const& column() const {
+        return values;
+    }
+    
+    std::size_t memoryUsage() const override {
+        return NodeAttributeStorageBase::memoryUsage() + values.capacityBytes()
+            + zones.capacity() * sizeof(Zone);
+    }
+    
+    // Shares all values with this storage until either side writes them,
+    // O(chunks) regardless of the size of the column.
+    std::shared_ptr<NodeAttributeStorageBase> clone(std::pmr::string name) const override {
+        auto resource = name.get_allocator().resource();
+        auto copy = std::allocate_shared<NodeAttributeStorage>(
+            std::pmr::polymorphic_allocator<NodeAttributeStorage>{resource},
+            std::move(name), values.getResource());
+        copy->copyState(*this);
+        copy->values.shareFrom(values);
+        copy->zoned = zoned;
+        copy->zones = zones;
+        return copy;
+    }
+    
+    void save(std::ostream& out) const override {
+        saveValidity(out);
+        values.save(out);
+        writeValue(out, zoned);
+        if constexpr (zoneMapped) {
+            if (zoned) {
+                writeVector(out, zones);
+            }
+        }
+    }
+    
+    // Takes the zone maps of the file; without any, rebuilds those of a
+    // storage that has them. Adopted storages keep their external memory,
+    // growing it like set() does, or throw if it cannot hold the file.
+    void load(std::istream& in) override {
+        if (fixedCapacity) {
+            loadAdopted(in);
+        } else {
+            loadValidity(in);
+            values.load(in);
+        }
+        auto saved = readValue<bool>(in);
+        if constexpr (zoneMapped) {
+            if (saved) {
+                readVector(in, zones);
+                zoned = true;
+            } else if (zoned) {
+                enableZoneMaps();
+            }
+        } else if (saved) {
+            throw std::runtime_error("Zone maps for an attribute type without them");
+        }
+        reloadMirrors();
+    }
+    
+    // Invalidates every slot made valid since the last clear() and resets
+    // its value, O(touched). Needs trackValid.
+    void clear() {
+        for (auto i : validated) {
+            if (isValid(i)) {
+                if constexpr (!std::is_trivially_destructible_v<T>) {
+                    values[i] = T{};
+                }
+                clearValid(i);
+                markDirty(i);
+                staleZone(i);
+            }
+        }
+        validated.clear();
+    }
+    
     auto size() {
         return validElements;
     }
     
     void set(index i, T v) {
         resize(i);
+        touch(i);
+        if (zoned) {
+            updateZone(i, v);
+        }
         values[i] = std::move(v);
         markValid(i);
+        mirror(i, &values[i]);
+    }
+    
+    void invalidate(index i) override {
+        auto wasValid = isValid(i);
+        NodeAttributeStorageBase::invalidate(i);
+        if (zoned && wasValid) {
+            auto& z = zoneOf(i);
+            --z.validCount;
+            if constexpr (zoneMapped) {
+                z.tight = z.tight && value(i) != z.min && value(i) != z.max;
+            }
+        }
     }
     
     std::optional<T> get(index i) {
         if(i >= values.size() || !isValid(i)) {
             return std::nullopt;
         }
-        return values[i];
+        return value(i);
+    }
+    
+    // Calls f(i, value) for every valid slot in index order; read-only,
+    // so nothing is touched or copied.
+    template<typename F>
+    void forEach(F f) const {
+        validity().forEach([&](index i) { f(i, value(i)); });
+    }
+    
+    // Summary of the values in one chunk of chunkSize nodes. min and max
+    // bound the valid values, and validCount counts them exactly, while
+    // tight; writes widen the bounds eagerly, and a zone whose bounds may
+    // be too wide or unknown is recomputed before the next query.
+    struct Zone {
+        T min{};
+        T max{};
+        index validCount = 0;
+        bool tight = true;
+    };
+    
+    static constexpr bool zoneMapped = std::is_arithmetic_v<T>;
+    
+    // Keeps zone maps from now on, so that range and top-k queries skip
+    // chunks that cannot match. Cost: one Zone per chunk, plus a compare
+    // on every write.
+    void enableZoneMaps() {
+        static_assert(zoneMapped, "zone maps need arithmetic values");
+        zones.assign((values.size() + chunkSize - 1) >> chunkBits, Zone{T{}, T{}, 0, false});
+        zoned = true;
+        refreshZones();
+    }
+    
+    bool hasZoneMaps() const {
+        return zoned;
+    }
+    
+    // Zone c, recomputed first if needed.
+    Zone zone(index c) {
+        refreshZones();
+        return c < zones.size() ? zones[c] : Zone{};
+    }
+    
+    // Calls f(i, value) for every valid value in [lo, hi] in index order.
+    template<typename F>
+    void forEachInRange(T const& lo, T const& hi, F f) {
+        static_assert(zoneMapped, "range queries need arithmetic values");
+        scanRange(lo, hi, [&](index c, bool inside) {
+            forEachInChunk(c, [&](index i, T const& v) {
+                if (inside || (lo <= v && v <= hi)) {
+                    f(i, v);
+                }
+            });
+        });
+    }
+    
+    // Valid values in [lo, hi]; chunks entirely inside are not scanned.
+    index countInRange(T const& lo, T const& hi) {
+        static_assert(zoneMapped, "range queries need arithmetic values");
+        index n = 0;
+        scanRange(lo, hi, [&](index c, bool inside) {
+            if (inside) {
+                n += zones[c].validCount;
+                return;
+            }
+            forEachInChunk(c, [&](index, T const& v) {
+                n += lo <= v && v <= hi;
+            });
+        });
+        return n;
+    }
+    
+    // Valid values in [lo, hi] as node indices, in index order.
+    std::vector<index> filter(T const& lo, T const& hi) {
+        std::vector<index> nodes;
+        forEachInRange(lo, hi, [&](index i, T const&) { nodes.push_back(i); });
+        return nodes;
+    }
+    
+    // The k largest valid values, largest first; ties go to the lower
+    // index, so the answer does not depend on zone maps. With zone maps,
+    // chunks are visited by decreasing max and the scan stops at the
+    // first chunk whose max is below the k-th value found.
+    std::vector<std::pair<index, T>> topK(std::size_t k) {
+        static_assert(zoneMapped, "top-k queries need arithmetic values");
+        auto greater = [](auto const& a, auto const& b) {
+            return a.second > b.second || (a.second == b.second && a.first < b.first);
+        };
+        std::vector<std::pair<index, T>> heap; // min-heap of the best k
+        if (!k) {
+            return heap;
+        }
+        auto offer = [&](index i, T const& v) {
+            if (heap.size() < k) {
+                heap.emplace_back(i, v);
+                std::push_heap(heap.begin(), heap.end(), greater);
+            } else if (greater(std::pair<index, T>{i, v}, heap.front())) {
+                std::pop_heap(heap.begin(), heap.end(), greater);
+                heap.back() = {i, v};
+                std::push_heap(heap.begin(), heap.end(), greater);
+            }
+        };
+        if (!zoned) {
+            forEach(offer);
+        } else {
+            refreshZones();
+            std::vector<index> order;
+            for (index c = 0; c < zones.size(); ++c) {
+                if (zones[c].validCount) {
+                    order.push_back(c);
+                }
+            }
+            std::sort(order.begin(), order.end(), [&](index a, index b) { return zones[a].max > zones[b].max; });
+            for (auto c : order) {
+                if (heap.size() == k && zones[c].max < heap.front().second) {
+                    break;
+                }
+                forEachInChunk(c, offer);
+            }
+        }
+        std::sort_heap(heap.begin(), heap.end(), greater);
+        return heap;
+    }
+    
+    // Tree hash over fixed-size chunks of values and validity bits.
+    // Only chunks written since the last call are rehashed (in parallel),
+    // so rehashing after small updates costs O(changes).
+    hash_t contentHash() {
+        auto chunks = (std::max(values.size(), validity().size()) + chunkSize - 1) >> chunkBits;
+        std::vector<index> stale;
+        for (index c = 0; c < chunks; ++c) {
+            if (c >= chunkHashes.size() || dirtyChunks.test(c)) {
+                stale.push_back(c);
+            }
+        }
+        chunkHashes.resize(chunks);
+        dirtyChunks.resize(chunks);
+        parallelFor(0, stale.size(), [&](index lo, index hi) {
+            for (index k = lo; k < hi; ++k) {
+                chunkHashes[stale[k]] = hashChunk(stale[k]);
+            }
+        }, 1);
+        for (auto c : stale) {
+            dirtyChunks.reset(c);
+        }
+        std::vector<hash_t> level(chunkHashes.begin(), chunkHashes.end());
+        while (level.size() > 1) {
+            for (index k = 0; k < level.size() / 2; ++k) {
+                level[k] = hashCombine(level[2 * k], level[2 * k + 1]);
+            }
+            if (level.size() % 2) {
+                level[level.size() / 2] = level.back();
+            }
+            level.resize((level.size() + 1) / 2);
+        }
+        return hashCombine(mix64(chunks), level.empty() ? 0 : level[0]);
     }
 private:
-    std::vector<T> values;
+    struct UndoRecord : UndoLog::Record {
+        UndoRecord(NodeAttributeStorage* storage, index i, std::optional<T> value)
+        : storage{storage}, i{i}, value{std::move(value)} {
+            restore = [](UndoLog::Record* r) {
+                auto u = static_cast<UndoRecord*>(r);
+                u->storage->restore(u->i, std::move(u->value));
+            };
+            if constexpr (!std::is_trivially_destructible_v<std::optional<T>>) {
+                destroy = [](UndoLog::Record* r) {
+                    static_cast<UndoRecord*>(r)->~UndoRecord();
+                };
+            }
+        }
+        NodeAttributeStorage* storage;
+        index i;
+        std::optional<T> value; // empty if the slot was not valid
+    };
+    
+    // Calls f(i, value) for the valid slots of chunk c.
+    template<typename F>
+    void forEachInChunk(index c, F f) const {
+        constexpr auto wordsPerChunk = chunkSize / Bitmap::wordBits;
+        auto& bits = validity();
+        for (index w = c * wordsPerChunk; w < (c + 1) * wordsPerChunk && w < bits.wordCount(); ++w) {
+            for (auto word = bits.getWord(w); word; word &= word - 1) {
+                auto i = w * Bitmap::wordBits + __builtin_ctzll(word);
+                f(i, value(i));
+            }
+        }
+    }
+    
+    // Calls scan(c, inside) for every chunk that may hold values in
+    // [lo, hi]; inside if all its values are. Scans all chunks without
+    // zone maps.
+    template<typename F>
+    void scanRange(T const& lo, T const& hi, F scan) {
+        auto chunks = (values.size() + chunkSize - 1) >> chunkBits;
+        if (!zoned) {
+            for (index c = 0; c < chunks; ++c) {
+                scan(c, false);
+            }
+            return;
+        }
+        refreshZones();
+        for (index c = 0; c < zones.size(); ++c) {
+            auto& z = zones[c];
+            if (z.validCount && !(z.max < lo) && !(hi < z.min)) {
+                scan(c, lo <= z.min && z.max <= hi);
+            }
+        }
+    }
+    
+    Zone& zoneOf(index i) {
+        auto c = i >> chunkBits;
+        if (c >= zones.size()) {
+            zones.resize(c + 1);
+        }
+        return zones[c];
+    }
+    
+    // Widens the zone of slot i for v, which is about to replace its value.
+    void updateZone(index i, T const& v) {
+        if constexpr (zoneMapped) {
+            auto& z = zoneOf(i);
+            if (isValid(i)) {
+                z.tight = z.tight && value(i) != z.min && value(i) != z.max;
+            } else if (!z.validCount++) {
+                z.min = z.max = v;
+            }
+            z.min = std::min(z.min, v);
+            z.max = std::max(z.max, v);
+        }
+    }
+    
+    // Slot i changed in a way the zone cannot follow, e.g. by a reset or
+    // a rollback.
+    void staleZone(index i) {
+        if (zoned) {
+            zoneOf(i).tight = false;
+        }
+    }
+    
+    void refreshZones() {
+        if constexpr (zoneMapped) {
+            std::vector<index> stale;
+            for (index c = 0; c < zones.size(); ++c) {
+                if (!zones[c].tight) {
+                    stale.push_back(c);
+                }
+            }
+            parallelFor(0, stale.size(), [&](index lo, index hi) {
+                for (index k = lo; k < hi; ++k) {
+                    Zone z;
+                    forEachInChunk(stale[k], [&](index, T const& v) {
+                        z.min = z.validCount ? std::min(z.min, v) : v;
+                        z.max = z.validCount ? std::max(z.max, v) : v;
+                        ++z.validCount;
+                    });
+                    zones[stale[k]] = z;
+                }
+            }, 1);
+        }
+    }
+    
+    void logUndo(UndoLog& log, index i) override {
+        log.append<UndoRecord>(this, i, isValid(i) ? std::optional<T>{value(i)} : std::nullopt);
+    }
+    
+    void restore(index i, std::optional<T> value) {
+        markDirty(i);
+        staleZone(i);
+        if (value) {
+            values[i] = std::move(*value);
+            markValid(i);
+            mirror(i, &values[i]);
+        } else if (isValid(i)) {
+            clearValid(i);
+            mirror(i, nullptr);
+        }
+    }
+    
+    hash_t hashChunk(index c) {
+        constexpr auto wordsPerChunk = chunkSize / Bitmap::wordBits;
+        auto& bits = validity();
+        auto h = mix64(c);
+        for (index w = c * wordsPerChunk; w < (c + 1) * wordsPerChunk; ++w) {
+            auto word = bits.getWord(w);
+            h = hashCombine(h, word);
+            for (; word; word &= word - 1) {
+                auto i = w * Bitmap::wordBits + __builtin_ctzll(word);
+                h = hashCombine(h, ContentHash<T>{}(value(i)));
+            }
+        }
+        return h;
+    }
+    
+    // Views the extended external memory in place of the old view; the
+    // values are never copied out of it (see Column::shareFrom()).
+    void checkCapacity(index n) {
+        if (fixedCapacity && n > values.size()) {
+            if (!extend) {
+                throw std::runtime_error("Attribute cannot grow beyond its external memory");
+            }
+            auto capacity = extend(n);
+            adoptValidity(adoptedValidity, capacity);
+            values.view(adoptedData, capacity);
+        }
+    }
+    
+    // Reads validity and values aside, then copies them into the
+    // external memory, grown by checkCapacity() to hold them.
+    void loadAdopted(std::istream& in) {
+        if (readOnly) {
+            throw std::runtime_error("Attribute is read-only");
+        }
+        Validity loaded{getResource()};
+        loaded.load(in);
+        Column<T> read{values.getResource()};
+        read.load(in);
+        checkCapacity(std::max<index>(loaded.size(), read.size()));
+        assignValidity(loaded);
+        for (index i = 0; i < read.size(); ++i) {
+            values[i] = read[i];
+        }
+    }
+    
+    // Reads without copying a chunk shared with a clone.
+    T const& value(index i) const {
+        return values[i];
+    }
+    
+    Column<T> values;
+    bool fixedCapacity = false; // values are adopted, see adopt()
+    std::function<index(index)> extend;
+    Bitmap::word* adoptedValidity = nullptr;
+    T* adoptedData = nullptr;
+    bool zoned = false;         // zones are kept, see enableZoneMaps()
+    std::pmr::vector<Zone> zones;
     friend class NodeAttribute<T>;
-    std::unordered_set<NodeAttribute<T>*> attrSet;
+    friend class AttributeHandle<NodeAttributeStorage<T>>;
+    std::pmr::unordered_set<AttributeHandle<NodeAttributeStorage<T>>*> attrSet;
 }; // class NodeAttributeStorage<T>
 
 template<typename T>
-class NodeAttribute {
+class NodeAttribute : public AttributeHandle<NodeAttributeStorage<T>> {
     
     class Iterator {
     public:
@@ -152,11 +889,25 @@ class NodeAttribute {
             return nextValid();
         }
         
-        T& operator*() {
+        // Reading never counts as a write: nothing is logged, marked or
+        // copied, also on read-only and cloned storages.
+        T const& operator*() const {
             if (!storage) {
                 throw std::runtime_error("Invalid attribute iterator");
             }
-            return storage->values[idx];
+            return storage->value(idx);
+        }
+        
+        T const* operator->() const {
+            return &**this;
+        }
+        
+        // Writes the value at the current node, as NodeAttribute::set().
+        void set(T v) {
+            if (!storage) {
+                throw std::runtime_error("Invalid attribute iterator");
+            }
+            storage->set(idx, std::move(v));
         }
         
         auto nodeValuePair() {
@@ -167,7 +918,7 @@ class NodeAttribute {
             if (storage == nullptr && iter.storage == nullptr) {
                 return true;
             }
-            return storage != nullptr && idx==iter.idx;
+            return storage == iter.storage && idx==iter.idx;
         }
         
         bool operator!=(Iterator const& iter) {
@@ -186,7 +937,7 @@ class NodeAttribute {
         // reading at idx
         operator T() {
             storage->checkIndex(idx);
-            return storage->values[idx];
+            return storage->value(idx);
         }
         
         // writing at idx
@@ -200,20 +951,9 @@ class NodeAttribute {
     }; // class IndexProxy
 public:
     explicit NodeAttribute(std::shared_ptr<NodeAttributeStorage<T>> owned_storage)
-    : owned_storage{owned_storage}, valid{true} {
-        // std::cerr<<"NodeAttribute ("<<owned_storage->getName()<<") at "<<this<<"\n";
-        owned_storage->attrSet.insert(this);
-    }
+    : AttributeHandle<NodeAttributeStorage<T>>{std::move(owned_storage)} { }
     
-    NodeAttribute(NodeAttribute const& other)
-    : owned_storage{other.owned_storage}, valid{other.valid} {
-        owned_storage->attrSet.insert(this);
-    }
-    
-    ~NodeAttribute() {
-        owned_storage->attrSet.erase(this);
-        // std::cerr<<"NodeAttribute ("<<owned_storage->getName()<<") at "<<this<<" deleted\n";
-    }
+    using AttributeHandle<NodeAttributeStorage<T>>::checkAttribute;
     
     auto begin() {
         return Iterator(owned_storage.get()).nextValid();
@@ -242,30 +982,341 @@ public:
         return IndexProxy(owned_storage.get(), i);
     }
     
-    void checkAttribute() {
-        if (!valid) {
-            throw std::runtime_error("Invalid attribute");
-        }
+    hash_t contentHash() {
+        checkAttribute();
+        return owned_storage->contentHash();
     }
-private:
-    void invalidateAttribute() {
-        valid = false;
+    
+    void reserve(index n) {
+        checkAttribute();
+        owned_storage->reserve(n);
+    }
+    
+    auto getValidityLayout() {
+        checkAttribute();
+        return owned_storage->getValidityLayout();
+    }
+    
+    void setValidityLayout(ValidityLayout layout) {
+        checkAttribute();
+        owned_storage->setValidityLayout(layout);
+    }
+    
+    void enableZoneMaps() {
+        checkAttribute();
+        owned_storage->enableZoneMaps();
+    }
+    
+    template<typename F>
+    void forEachInRange(T const& lo, T const& hi, F f) {
+        checkAttribute();
+        owned_storage->forEachInRange(lo, hi, f);
+    }
+    
+    auto countInRange(T const& lo, T const& hi) {
+        checkAttribute();
+        return owned_storage->countInRange(lo, hi);
+    }
+    
+    auto filter(T const& lo, T const& hi) {
+        checkAttribute();
+        return owned_storage->filter(lo, hi);
+    }
+    
+    auto topK(std::size_t k) {
+        checkAttribute();
+        return owned_storage->topK(k);
+    }
+    
+    // Unregistered copy that shares all values with this attribute
+    // copy-on-write; either side's writes copy only the chunks they hit.
+    NodeAttribute clone() {
+        checkAttribute();
+        auto name = std::pmr::string{owned_storage->getName(), owned_storage->getResource()};
+        return NodeAttribute{std::static_pointer_cast<NodeAttributeStorage<T>>(
+            owned_storage->clone(std::move(name)))};
     }
     
 private:
-    std::shared_ptr<NodeAttributeStorage<T>> owned_storage;
-    bool valid;
-    friend NodeAttributeStorage<T>;
+    using AttributeHandle<NodeAttributeStorage<T>>::owned_storage;
 }; // class NodeAttribute
 
 
+class NodeAttributeMap;
+
+// Lease of a pooled, unnamed attribute for algorithm temporaries
+// (visited, dist, parent, ...). Returned to the pool on destruction,
+// where only the slots it made valid are reset.
+template<typename T>
+class ScratchAttribute {
+public:
+    ScratchAttribute(NodeAttributeMap& map, std::shared_ptr<NodeAttributeStorage<T>> storage)
+    : map{&map}, attr{storage}, storage{std::move(storage)} { }
+    
+    ScratchAttribute(ScratchAttribute const&) = delete;
+    ScratchAttribute& operator=(ScratchAttribute const&) = delete;
+    
+    ScratchAttribute(ScratchAttribute&& other)
+    : map{std::exchange(other.map, nullptr)}, attr{other.attr}, storage{std::move(other.storage)} { }
+    
+    ~ScratchAttribute();
+    
+    NodeAttribute<T>& operator*() {
+        return attr;
+    }
+    
+    NodeAttribute<T>* operator->() {
+        return &attr;
+    }
+    
+private:
+    NodeAttributeMap* map;
+    NodeAttribute<T> attr;
+    std::shared_ptr<NodeAttributeStorage<T>> storage;
+}; // class ScratchAttribute
+
 class NodeAttributeMap {
-    std::unordered_map<
+    std::pmr::memory_resource* resource; // metadata
+    std::pmr::memory_resource* columns;  // attribute values
+    std::pmr::unordered_map<
     std::string_view,
     std::shared_ptr<NodeAttributeStorageBase>
     > attrMap;
+    UndoLog undoLog;
+    bool inTransaction = false;
+    Reclaimer* reclaimer = nullptr;
+    std::pmr::unordered_map<
+    std::type_index,
+    std::pmr::vector<std::shared_ptr<NodeAttributeStorageBase>>
+    > scratchPool; // idle scratch storages by value type
     
 public:
+    // Without a resource, values come from columnResource() and metadata
+    // from the default resource. With one, everything the map and its
+    // storages allocate comes from it, e.g. a per-job arena; it must
+    // outlive the map and every attribute handle obtained from it, and be
+    // thread-safe if saveAsync() or loadAsync() is used.
+    explicit NodeAttributeMap(std::pmr::memory_resource* resource = nullptr)
+    : resource{resource ? resource : std::pmr::get_default_resource()},
+      columns{resource ? resource : columnResource()},
+      attrMap{this->resource}, undoLog{this->resource}, scratchPool{this->resource} { }
+    
+    std::pmr::memory_resource* getResource() const {
+        return resource;
+    }
+    
+    // Resource of the values of attributes attached without their own.
+    std::pmr::memory_resource* getColumnResource() const {
+        return columns;
+    }
+    
+    // Copy of all attributes with the same resources and reclaimer.
+    // Plain attributes share their values copy-on-write, so this takes
+    // O(chunks) and memory grows only with the chunks written afterwards
+    // by either map. Values in external memory (see adopt()) are copied.
+    // Scratch attributes and transactions are not copied.
+    NodeAttributeMap clone() const {
+        return NodeAttributeMap{*this, Cloning{}};
+    }
+    
+    // Writes all attributes to path. The format is tied to the build:
+    // storages are identified by their typeid names and values are
+    // written in native byte order (see ValueCodec). The file is written
+    // as path.tmp and replaces path only once complete and synced, so an
+    // interrupted save leaves the previous file intact.
+    void save(std::string const& path, SaveProgress* progress = nullptr) const {
+        auto temporary = path + ".tmp";
+        std::ofstream out(temporary, std::ios::binary);
+        if (!out) {
+            throw std::runtime_error("Cannot open attribute file for writing");
+        }
+        try {
+            out.write(attributeFileMagic, sizeof(attributeFileMagic));
+            writeValue<std::uint64_t>(out, attrMap.size());
+            if (progress) {
+                progress->attributes = attrMap.size();
+            }
+            for (auto& [name, ptr] : attrMap) {
+                auto& storage = *ptr;
+                writeValue(out, std::string{name});
+                writeValue(out, std::string{typeid(storage).name()});
+                // Length of the record, so that load() can skip it.
+                auto start = out.tellp();
+                writeValue<std::uint64_t>(out, 0);
+                storage.save(out);
+                auto end = out.tellp();
+                out.seekp(start);
+                writeValue<std::uint64_t>(out, std::uint64_t(end - start) - sizeof(std::uint64_t));
+                out.seekp(end);
+                if (progress) {
+                    ++progress->savedAttributes;
+                    progress->bytesWritten = std::size_t(end);
+                }
+            }
+            out.close();
+            if (!out) {
+                throw std::runtime_error("Cannot write attribute file");
+            }
+            replaceFile(temporary, path);
+        } catch (...) {
+            out.close();
+            std::remove(temporary.c_str());
+            throw;
+        }
+    }
+    
+    // Saves like save() from a forked child process, so the caller only
+    // pauses for the fork; see BackgroundSave for progress and overhead.
+    // done(success) is called on a watcher thread when the child exits.
+    BackgroundSave backgroundSave(std::string path, std::function<void(bool)> done = {}) const {
+        return BackgroundSave{[this, path](SaveProgress& progress) {
+            save(path, &progress);
+        }, std::move(done)};
+    }
+    
+    // Restores the attached attributes saved under the same name and kind
+    // by save(); other attributes in the file are skipped.
+    void load(std::string const& path) {
+        if (inTransaction) {
+            throw std::runtime_error("Cannot load attributes during transaction");
+        }
+        std::ifstream in(path, std::ios::binary);
+        auto n = readFileHeader(in);
+        for (std::uint64_t k = 0; k < n; ++k) {
+            auto name = readValue<std::string>(in);
+            auto type = readValue<std::string>(in);
+            auto length = readValue<std::uint64_t>(in);
+            auto it = attrMap.find(name);
+            if (it != attrMap.end() && type == typeid(*it->second).name()) {
+                it->second->load(in);
+            } else {
+                in.seekg(std::streamoff(length), std::ios::cur);
+            }
+            if (!in) {
+                throw std::runtime_error("Truncated attribute file");
+            }
+        }
+    }
+    
+    // Saves like save() on the I/O pool (see IoPool). The map is cloned
+    // first, so the file holds the state at the time of the call while the
+    // caller keeps mutating. Attributes are encoded in parallel, each into
+    // memory, and written as they become ready; at most one encoded record
+    // per pool thread is held at a time. Like save(), it writes path.tmp
+    // and renames it over path once complete. Throws if the file cannot be
+    // opened, later errors are reported through the future.
+    // The clone is freed on a pool thread, so the resources of the map and
+    // of its attributes must be thread-safe, as the column resources are.
+    // It is freed before the future becomes ready.
+    std::future<void> saveAsync(std::string const& path, SaveProgress* progress = nullptr) const {
+        auto job = std::make_shared<AsyncSave>();
+        job->map.reset(new NodeAttributeMap{*this, Cloning{}});
+        job->progress = progress;
+        job->path = path;
+        job->out.open(path + ".tmp", std::ios::binary);
+        if (!job->out) {
+            throw std::runtime_error("Cannot open attribute file for writing");
+        }
+        auto n = job->map->attrMap.size();
+        job->out.write(attributeFileMagic, sizeof(attributeFileMagic));
+        writeValue<std::uint64_t>(job->out, n);
+        if (progress) {
+            progress->attributes = n;
+        }
+        auto result = job->done.get_future();
+        job->pending = n;
+        if (n == 0) {
+            job->finish();
+        }
+        // The last task frees the snapshot, so none is submitted while
+        // its attributes are still being walked.
+        std::vector<std::function<void()>> tasks;
+        tasks.reserve(n);
+        for (auto& entry : job->map->attrMap) {
+            tasks.push_back([job, name = entry.first, storage = entry.second.get()] {
+                job->encode(name, *storage);
+            });
+        }
+        for (auto& task : tasks) {
+            IoPool::shared().submit(std::move(task));
+        }
+        return result;
+    }
+    
+    // Loads path like load() into a clone of this map on the I/O pool and
+    // delivers the clone; this map is left alone, so readers keep using it
+    // meanwhile (see AtomicMap for swapping in the result). One task reads
+    // the records; each record to restore is decoded by a task of its own
+    // while the next ones are read. Once all are decoded, install(map), if
+    // given, runs on the pool before the future becomes ready.
+    // Decoding allocates on pool threads, so the resources of the map and
+    // of its attributes must be thread-safe, as the column resources are.
+    // The pool keeps no reference to the clone once the future is ready.
+    std::future<std::shared_ptr<NodeAttributeMap>> loadAsync(
+        std::string path,
+        std::function<void(std::shared_ptr<NodeAttributeMap> const&)> install = {}) const {
+        auto job = std::make_shared<AsyncLoad>();
+        job->map.reset(new NodeAttributeMap{*this, Cloning{}});
+        job->install = std::move(install);
+        auto result = job->done.get_future();
+        IoPool::shared().submit([job, path = std::move(path)] {
+            job->read(path);
+        });
+        return result;
+    }
+    
+    // Scope of a transaction; rolls back unless committed.
+    class Transaction {
+    public:
+        explicit Transaction(NodeAttributeMap& map)
+        : map{&map} { }
+        
+        Transaction(Transaction&& other)
+        : map{std::exchange(other.map, nullptr)} { }
+        
+        Transaction(Transaction const&) = delete;
+        Transaction& operator=(Transaction const&) = delete;
+        Transaction& operator=(Transaction&&) = delete;
+        
+        ~Transaction() {
+            if (map) {
+                map->endTransaction(false);
+            }
+        }
+        
+        // Keeps all changes; O(1) for trivially destructible values.
+        void commit() {
+            finish(true);
+        }
+        
+        // Restores every slot written since beginTransaction(), O(changes).
+        void rollback() {
+            finish(false);
+        }
+    private:
+        void finish(bool commit) {
+            if (!map) {
+                throw std::runtime_error("Transaction already finished");
+            }
+            std::exchange(map, nullptr)->endTransaction(commit);
+        }
+        
+        NodeAttributeMap* map;
+    }; // class Transaction
+    
+    // Logs the prior value and validity of every slot first written by
+    // set() or invalidate() on any attribute of this map.
+    Transaction beginTransaction() {
+        if (inTransaction) {
+            throw std::runtime_error("Transaction already in progress");
+        }
+        inTransaction = true;
+        for (auto& [name, ptr] : attrMap) {
+            ptr->undoLog = &undoLog;
+        }
+        return Transaction{*this};
+    }
+    
     auto find(std::string_view const& name) {
         auto it = attrMap.find(name);
         if(it == attrMap.end()) {
@@ -274,23 +1325,77 @@ public:
         return it;
     }
     
+    bool contains(std::string_view name) const {
+        return attrMap.find(name) != attrMap.end();
+    }
+    
+    // Storage of the attribute name, or null.
+    NodeAttributeStorageBase const* findStorage(std::string_view name) const {
+        auto it = attrMap.find(name);
+        return it == attrMap.end() ? nullptr : it->second.get();
+    }
+    
+    // Calls f(name, storage) for every attribute, in no particular order.
+    template<typename F>
+    void forEachStorage(F f) const {
+        for (auto& [name, ptr] : attrMap) {
+            f(name, *ptr);
+        }
+    }
+    
+    bool isInTransaction() const {
+        return inTransaction;
+    }
+    
     template<typename T>
     auto attach(std::string_view name) {
-        auto ownedPtr = std::make_shared<NodeAttributeStorage<T>>(std::string{name});
+        return NodeAttribute<T>{attachStorage<NodeAttributeStorage<T>>(name, columns)};
+    }
+    
+    // Attaches an attribute whose values come from the given resource,
+    // e.g. columnResource(NumaPolicy::Interleave).
+    template<typename T>
+    auto attach(std::string_view name, std::pmr::memory_resource* resource) {
+        return NodeAttribute<T>{attachStorage<NodeAttributeStorage<T>>(name, resource)};
+    }
+    
+    // Attaches a storage of any kind derived from NodeAttributeStorageBase.
+    template<typename Storage, typename... Args>
+    auto attachStorage(std::string_view name, Args&&... args) {
+        auto ownedPtr = std::allocate_shared<Storage>(std::pmr::polymorphic_allocator<Storage>{resource},
+                                                      std::pmr::string{name, resource},
+                                                      std::forward<Args>(args)...);
         auto [it, success] = attrMap.insert(
                                             std::make_pair(ownedPtr->getName(), ownedPtr));
         if(!success) {
             throw std::runtime_error("Attribute with same name already exists");
         }
-        return NodeAttribute<T>{ownedPtr};
+        if (inTransaction) {
+            ownedPtr->undoLog = &undoLog;
+        }
+        return ownedPtr;
     }
     
     void detach(std::string_view name) {
+        if (inTransaction) {
+            throw std::runtime_error("Cannot detach attribute during transaction");
+        }
         auto it = find(name);
-        auto storage = it->second.get();
+        auto storage = std::move(it->second);
+        attrMap.erase(it);
         storage->invalidateAttributes();
-        it->second.reset();
-        attrMap.erase(name);
+        if (reclaimer) {
+            auto bytes = storage->memoryUsage();
+            reclaimer->retire(std::move(storage), bytes);
+        }
+    }
+    
+    // Detached storages are destroyed by reclaimer instead of by detach(),
+    // which then returns in O(1). nullptr destroys them synchronously.
+    // A storage still referenced by attribute handles dies with the last
+    // of them, as before. The reclaimer must outlive the map.
+    void setReclaimer(Reclaimer* reclaimer) {
+        this->reclaimer = reclaimer;
     }
     
     template<typename T>
@@ -301,13 +1406,293 @@ public:
         return NodeAttribute<T>{std::static_pointer_cast<NodeAttributeStorage<T>>(it->second)};
     }
     
+    template<typename Storage>
+    auto getStorage(std::string_view name) {
+        auto storage = std::dynamic_pointer_cast<Storage>(find(name)->second);
+        if (!storage)
+            throw std::runtime_error("Type mismatch in nodeAttributes().getStorage()");
+        return storage;
+    }
+    
     void enumerate() {
         for (auto& [name, ptr] : attrMap) {
             std::cout<<name<<"\n";
         }
     }
+    
+    // Leases a scratch attribute with room for n nodes. It is not
+    // registered by name and takes part in no transaction.
+    template<typename T>
+    ScratchAttribute<T> scratch(index n = 0) {
+        std::shared_ptr<NodeAttributeStorage<T>> storage;
+        auto& idle = scratchPool[typeid(T)];
+        if (idle.empty()) {
+            storage = std::allocate_shared<NodeAttributeStorage<T>>(
+                std::pmr::polymorphic_allocator<NodeAttributeStorage<T>>{resource},
+                std::pmr::string{resource}, columns);
+            storage->trackValid = true;
+        } else {
+            storage = std::static_pointer_cast<NodeAttributeStorage<T>>(std::move(idle.back()));
+            idle.pop_back();
+        }
+        storage->reserve(n);
+        return ScratchAttribute<T>{*this, std::move(storage)};
+    }
+    
+private:
+    template<typename T>
+    friend class ScratchAttribute;
+    
+    struct Cloning { };
+    
+    // Checks the magic of an attribute file; returns its record count.
+    static std::uint64_t readFileHeader(std::istream& in) {
+        char magic[sizeof(attributeFileMagic)];
+        if (!in.read(magic, sizeof(magic))
+            || std::memcmp(magic, attributeFileMagic, sizeof(magic))) {
+            throw std::runtime_error("Not an attribute file");
+        }
+        return readValue<std::uint64_t>(in);
+    }
+    
+    // State of a saveAsync(), shared by its encode tasks.
+    struct AsyncSave {
+        std::unique_ptr<NodeAttributeMap> map; // snapshot being saved
+        SaveProgress* progress = nullptr;
+        std::string path;
+        std::ofstream out; // to path.tmp
+        std::mutex mutex; // guards out and error
+        std::exception_ptr error;
+        std::size_t pending = 0; // records not yet written
+        std::promise<void> done;
+        
+        void encode(std::string_view name, NodeAttributeStorageBase const& storage) {
+            std::string bytes;
+            std::exception_ptr failure;
+            try {
+                std::ostringstream buffer;
+                storage.save(buffer);
+                bytes = buffer.str();
+            } catch (...) {
+                failure = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lock{mutex};
+            if (failure && !error) {
+                error = failure;
+            }
+            if (!error) {
+                writeValue(out, std::string{name});
+                writeValue(out, std::string{typeid(storage).name()});
+                writeValue<std::uint64_t>(out, bytes.size());
+                out.write(bytes.data(), std::streamsize(bytes.size()));
+                if (progress) {
+                    ++progress->savedAttributes;
+                    progress->bytesWritten = std::size_t(out.tellp());
+                }
+            }
+            if (--pending == 0) {
+                finish();
+            }
+        }
+        
+        // Frees the snapshot first, so that the caller's writes after the
+        // future is ready do not race with dropping its shared chunks.
+        void finish() {
+            map.reset();
+            out.close();
+            auto temporary = path + ".tmp";
+            if (!error && !out) {
+                error = std::make_exception_ptr(std::runtime_error("Cannot write attribute file"));
+            }
+            if (!error) {
+                try {
+                    replaceFile(temporary, path);
+                } catch (...) {
+                    error = std::current_exception();
+                }
+            }
+            if (error) {
+                std::remove(temporary.c_str());
+                done.set_exception(error);
+            } else {
+                done.set_value();
+            }
+        }
+    };
+    
+    // State of a loadAsync(), shared by its read and decode tasks.
+    struct AsyncLoad : std::enable_shared_from_this<AsyncLoad> {
+        // Above this many bytes read but not decoded, the reader decodes
+        // records itself instead of handing them off.
+        static constexpr std::size_t maxBuffered = std::size_t{256} << 20;
+        
+        std::shared_ptr<NodeAttributeMap> map; // being loaded
+        std::function<void(std::shared_ptr<NodeAttributeMap> const&)> install;
+        std::atomic<std::size_t> pending{1}; // decode tasks and the reader
+        std::atomic<std::size_t> buffered{0};
+        std::atomic<bool> failed{false};
+        std::mutex mutex; // guards error
+        std::exception_ptr error;
+        std::promise<std::shared_ptr<NodeAttributeMap>> done;
+        
+        void read(std::string const& path) {
+            try {
+                std::ifstream in(path, std::ios::binary);
+                auto n = readFileHeader(in);
+                for (std::uint64_t k = 0; k < n && !failed; ++k) {
+                    auto name = readValue<std::string>(in);
+                    auto type = readValue<std::string>(in);
+                    auto length = readValue<std::uint64_t>(in);
+                    auto it = map->attrMap.find(name);
+                    if (it == map->attrMap.end() || type != typeid(*it->second).name()) {
+                        in.seekg(std::streamoff(length), std::ios::cur);
+                    } else {
+                        auto bytes = std::make_shared<std::string>(length, '\0');
+                        in.read(bytes->data(), std::streamsize(length));
+                        if (!in) {
+                            throw std::runtime_error("Truncated attribute file");
+                        }
+                        ++pending;
+                        buffered += length;
+                        auto task = [self = shared_from_this(), storage = it->second.get(), bytes] {
+                            self->decode(*storage, *bytes);
+                        };
+                        if (buffered > maxBuffered) {
+                            task();
+                        } else {
+                            IoPool::shared().submit(std::move(task));
+                        }
+                    }
+                    if (!in) {
+                        throw std::runtime_error("Truncated attribute file");
+                    }
+                }
+            } catch (...) {
+                fail(std::current_exception());
+            }
+            finishOne();
+        }
+        
+        void decode(NodeAttributeStorageBase& storage, std::string const& bytes) {
+            if (!failed) {
+                try {
+                    MemoryBuffer buffer{bytes.data(), bytes.size()};
+                    std::istream in(&buffer);
+                    storage.load(in);
+                } catch (...) {
+                    fail(std::current_exception());
+                }
+            }
+            buffered -= bytes.size();
+            finishOne();
+        }
+        
+        void fail(std::exception_ptr e) {
+            std::lock_guard<std::mutex> lock{mutex};
+            if (!error) {
+                error = e;
+            }
+            failed = true;
+        }
+        
+        void finishOne() {
+            if (--pending != 0) {
+                return;
+            }
+            if (!error) {
+                try {
+                    if (install) {
+                        install(map);
+                    }
+                } catch (...) {
+                    error = std::current_exception();
+                }
+            }
+            // The clone goes to the caller or, on failure, is freed here,
+            // before the future becomes ready.
+            if (error) {
+                map.reset();
+                done.set_exception(error);
+            } else {
+                done.set_value(std::move(map));
+            }
+        }
+    };
+    
+    NodeAttributeMap(NodeAttributeMap const& other, Cloning)
+    : resource{other.resource}, columns{other.columns}, attrMap{resource},
+      undoLog{resource}, reclaimer{other.reclaimer}, scratchPool{resource} {
+        for (auto& [name, ptr] : other.attrMap) {
+            auto copy = ptr->clone(std::pmr::string{name, resource});
+            attrMap.emplace(copy->getName(), std::move(copy));
+        }
+    }
+    
+    template<typename T>
+    void release(std::shared_ptr<NodeAttributeStorage<T>> storage) {
+        storage->invalidateAttributes();
+        storage->clear();
+        scratchPool[typeid(T)].push_back(std::move(storage));
+    }
+    
+    void endTransaction(bool commit) {
+        if (commit) {
+            undoLog.discard();
+        } else {
+            undoLog.rollback();
+        }
+        for (auto& [name, ptr] : attrMap) {
+            ptr->undoLog = nullptr;
+        }
+        inTransaction = false;
+    }
 }; //class NodeAttributeMap
 
+// Current version of a NodeAttributeMap, shared by readers and replaced
+// as a whole. Readers keep the version they got for as long as they hold
+// it, so a new version can be loaded while the old one is served.
+class AtomicMap {
+public:
+    explicit AtomicMap(std::shared_ptr<NodeAttributeMap> map = nullptr)
+    : current{std::move(map)} { }
+    
+    AtomicMap(AtomicMap const&) = delete;
+    AtomicMap& operator=(AtomicMap const&) = delete;
+    
+    std::shared_ptr<NodeAttributeMap> get() const {
+        return std::atomic_load(&current);
+    }
+    
+    // Installs map; returns the previous version.
+    std::shared_ptr<NodeAttributeMap> exchange(std::shared_ptr<NodeAttributeMap> map) {
+        return std::atomic_exchange(&current, std::move(map));
+    }
+    
+    // Loads path into a clone of the current version (see
+    // NodeAttributeMap::loadAsync()) and installs it once it is complete;
+    // on failure the current version stays. This holder must outlive the
+    // load.
+    std::future<std::shared_ptr<NodeAttributeMap>> loadAsync(std::string path) {
+        auto map = get();
+        if (!map) {
+            throw std::runtime_error("No attribute map to load into");
+        }
+        return map->loadAsync(std::move(path), [this](std::shared_ptr<NodeAttributeMap> const& loaded) {
+            exchange(loaded);
+        });
+    }
+    
+private:
+    std::shared_ptr<NodeAttributeMap> current;
+}; // class AtomicMap
+
+template<typename T>
+ScratchAttribute<T>::~ScratchAttribute() {
+    if (map) {
+        map->release(std::move(storage));
+    }
+}
+
 } // namespace Attributes
 
 #endif /* Attributes_h */
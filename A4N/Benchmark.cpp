@@ -0,0 +1,214 @@
+//
+//  Benchmark.cpp
+//  A4N
+//
+//  Memory placement benchmarks for attribute columns, built apart from
+//  the A4N target, e.g.
+//      c++ -std=c++17 -O2 -pthread Benchmark.cpp -o Benchmark
+//      ./Benchmark first-touch [nodes]
+//      ./Benchmark gather [nodes] [accesses]
+//
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "Column.hpp"
+
+using namespace Attributes;
+
+using Clock = std::chrono::steady_clock;
+
+static volatile double sink; // keeps the kernels from being optimised away
+
+template<typename F>
+static double seconds(F f) {
+    auto start = Clock::now();
+    f();
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Parallel sum over [0, n) with the partitioning of the parallel kernels.
+template<typename Get>
+static double parallelSum(std::size_t n, Get get) {
+    std::mutex mutex;
+    double sum = 0;
+    parallelFor(0, n, [&](std::size_t lo, std::size_t hi) {
+        double local = 0;
+        for (auto i = lo; i < hi; ++i) {
+            local += get(i);
+        }
+        std::lock_guard<std::mutex> lock{mutex};
+        sum += local;
+    });
+    return sum;
+}
+
+// Pages per NUMA node of about samples pages spread evenly over [p, p +
+// bytes), as move_pages(2) reports them; empty where it is unavailable.
+static std::map<int, std::size_t> pageNodes(void const* p, std::size_t bytes, std::size_t samples = 1024) {
+    std::map<int, std::size_t> nodes;
+#if defined(__linux__) && defined(SYS_move_pages)
+    constexpr std::size_t page = 4096;
+    auto pages = std::max<std::size_t>(1, bytes / page);
+    auto step = std::max<std::size_t>(1, pages / samples);
+    std::vector<void*> sample;
+    for (std::size_t k = 0; k < pages; k += step) {
+        sample.push_back(const_cast<char*>(static_cast<char const*>(p)) + k * page);
+    }
+    std::vector<int> status(sample.size());
+    if (syscall(SYS_move_pages, 0, sample.size(), sample.data(), nullptr, status.data(), 0) == 0) {
+        for (auto s : status) {
+            ++nodes[s];
+        }
+    }
+#endif
+    return nodes;
+}
+
+static void printNodes(std::map<int, std::size_t> const& nodes) {
+    if (nodes.empty()) {
+        std::cout << "  (placement unknown)";
+    }
+    for (auto [node, count] : nodes) {
+        if (node >= 0) {
+            std::cout << "  node " << node << ": " << count;
+        } else {
+            std::cout << "  error " << -node << ": " << count;
+        }
+    }
+    std::cout << "\n";
+}
+
+// Initialises n doubles as the old single-threaded resize did, and as a
+// column under each NUMA policy, then runs the same parallel kernel over
+// each. On one NUMA node, the placement columns show where pages would
+// land; on several, the kernel times show the interconnect traffic saved
+// by parallel first touch.
+static void firstTouch(std::size_t n) {
+    std::cout << "first touch of " << n << " doubles on " << parallelism() << " threads\n";
+    std::cout << std::left << std::setw(24) << "initialisation"
+              << std::setw(12) << "init s" << std::setw(12) << "kernel s" << "pages\n";
+    auto report = [](char const* name, double init, double kernel, std::map<int, std::size_t> const& nodes) {
+        std::cout << std::left << std::setw(24) << name << std::setw(12) << init << std::setw(12) << kernel;
+        printNodes(nodes);
+    };
+    {
+        std::vector<double> serial;
+        auto init = seconds([&] { serial.resize(n); });
+        auto kernel = seconds([&] { sink = parallelSum(n, [&](std::size_t i) { return serial[i]; }); });
+        report("serial (std::vector)", init, kernel, pageNodes(serial.data(), n * sizeof(double)));
+    }
+    struct Policy {
+        char const* name;
+        NumaPolicy numa;
+    };
+    for (auto [name, numa] : {Policy{"parallel, default", NumaPolicy::Default},
+                              Policy{"parallel, local", NumaPolicy::Local},
+                              Policy{"parallel, interleave", NumaPolicy::Interleave}}) {
+        Column<double> column{columnResource(numa)};
+        auto init = seconds([&] { column.resize(n); });
+        auto const& values = column;
+        auto kernel = seconds([&] { sink = parallelSum(n, [&](std::size_t i) { return values[i]; }); });
+        std::map<int, std::size_t> nodes;
+        auto samples = std::max<std::size_t>(1, 1024 / std::max<std::size_t>(1, values.chunkCount()));
+        for (std::size_t c = 0; c < values.chunkCount(); ++c) {
+            auto bytes = values.chunkLength(c) * sizeof(double);
+            for (auto [node, count] : pageNodes(values.chunk(c), bytes, samples)) {
+                nodes[node] += count;
+            }
+        }
+        report(name, init, kernel, nodes);
+    }
+}
+
+// Kilobytes of this process backed by transparent huge pages, or -1.
+static long anonHugePagesKiB() {
+    std::ifstream in("/proc/self/smaps_rollup");
+    std::string key;
+    long kib;
+    while (in >> key >> kib) {
+        if (key == "AnonHugePages:") {
+            return kib;
+        }
+        in.ignore(1 << 10, '\n');
+    }
+    return -1;
+}
+
+// Sums accesses doubles at random indices of a column of n under each
+// huge page mode, single-threaded, so that the time per access mostly
+// shows TLB misses once the column is far beyond the reach of the TLB.
+static void gather(std::size_t n, std::size_t accesses) {
+    std::cout << "random gather of " << accesses << " of " << n << " doubles ("
+              << n * sizeof(double) / (1 << 20) << " MiB)\n";
+    std::cout << std::left << std::setw(16) << "pages" << std::setw(12) << "ns/access" << "AnonHugePages\n";
+    std::vector<std::uint64_t> indices(accesses);
+    std::mt19937_64 random{42};
+    for (auto& i : indices) {
+        i = random() % n;
+    }
+    struct Mode {
+        char const* name;
+        HugePages hugePages;
+    };
+    for (auto [name, hugePages] : {Mode{"base", HugePages::None},
+                                   Mode{"transparent", HugePages::Transparent},
+                                   Mode{"explicit", HugePages::Explicit}}) {
+        Column<double> column{columnResource(NumaPolicy::Default, hugePages)};
+        column.resize(n);
+        auto const& values = column;
+        double sum = 0;
+        sum += values[indices[0]]; // warm up the page tables
+        auto time = seconds([&] {
+            for (auto i : indices) {
+                sum += values[i];
+            }
+        });
+        sink = sum;
+        auto kib = anonHugePagesKiB();
+        std::cout << std::left << std::setw(16) << name << std::setw(12) << time * 1e9 / double(accesses);
+        if (kib >= 0) {
+            std::cout << kib << " KiB";
+        } else {
+            std::cout << "unknown";
+        }
+        std::cout << "\n";
+    }
+}
+
+static void usage() {
+    std::cerr << "usage: Benchmark first-touch [nodes]\n"
+              << "       Benchmark gather [nodes] [accesses]\n";
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        usage();
+        return 1;
+    }
+    std::string mode = argv[1];
+    if (mode == "first-touch") {
+        firstTouch(argc > 2 ? std::strtoull(argv[2], nullptr, 10) : std::size_t{1} << 27);
+    } else if (mode == "gather") {
+        gather(argc > 2 ? std::strtoull(argv[2], nullptr, 10) : std::size_t{1} << 27,
+               argc > 3 ? std::strtoull(argv[3], nullptr, 10) : std::size_t{1} << 24);
+    } else {
+        usage();
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,105 @@
+//
+//  Bitmap.hpp
+//  A4N
+//
+
+#ifndef Bitmap_h
+#define Bitmap_h
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <stdexcept>
+
+#include "Column.hpp"
+
+namespace Attributes {
+
+// Dense bit set with word access (std::vector<bool> hides its words).
+// Words live in a Column, so bitmaps can be shared copy-on-write.
+class Bitmap {
+public:
+    using word = std::uint64_t;
+    static constexpr std::size_t wordBits = 64;
+    
+    explicit Bitmap(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+    : words{resource} { }
+    
+    std::size_t size() const {
+        return bits;
+    }
+    
+    void resize(std::size_t n) {
+        words.resize((n + wordBits - 1) / wordBits);
+        for (auto w = n / wordBits; n < bits && w < words.size(); ++w) {
+            words[w] &= w == n / wordBits ? (word{1} << (n % wordBits)) - 1 : 0;
+        }
+        bits = n;
+    }
+    
+    bool test(std::size_t i) const {
+        return (words[i / wordBits] >> (i % wordBits)) & 1;
+    }
+    
+    void set(std::size_t i) {
+        words[i / wordBits] |= word{1} << (i % wordBits);
+    }
+    
+    void reset(std::size_t i) {
+        words[i / wordBits] &= ~(word{1} << (i % wordBits));
+    }
+    
+    std::size_t wordCount() const {
+        return words.size();
+    }
+    
+    word getWord(std::size_t w) const {
+        return w < words.size() ? words[w] : 0;
+    }
+    
+    // Word w, followed by the next ones up to the end of its chunk (see
+    // Column), for zero-copy readers.
+    word const* wordData(std::size_t w) const {
+        return &words[w];
+    }
+    
+    void save(std::ostream& out) const {
+        writeValue<std::uint64_t>(out, bits);
+        words.save(out);
+    }
+    
+    void load(std::istream& in) {
+        resize(0);
+        auto n = readValue<std::uint64_t>(in);
+        words.load(in);
+        if (words.size() < (n + wordBits - 1) / wordBits) {
+            words.clear();
+            throw std::runtime_error("Truncated attribute file");
+        }
+        bits = n;
+    }
+    
+    // Uses the words at data for n bits, see Column::view().
+    void view(word* data, std::size_t n) {
+        words.view(data, (n + wordBits - 1) / wordBits);
+        bits = n;
+    }
+    
+    // Drops all bits and their memory.
+    void clear() {
+        words.clear();
+        bits = 0;
+    }
+    
+    void shareFrom(Bitmap const& other) {
+        words.shareFrom(other.words);
+        bits = other.bits;
+    }
+    
+private:
+    Column<word> words;
+    std::size_t bits = 0;
+}; // class Bitmap
+
+} // namespace Attributes
+
+#endif /* Bitmap_h */
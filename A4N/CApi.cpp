@@ -0,0 +1,299 @@
+//
+//  CApi.cpp
+//  A4N
+//
+//  The C interface of A4N.h.
+//
+
+#include <algorithm>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <typeindex>
+#include <unordered_map>
+
+#include "CApi.hpp"
+
+using namespace Attributes;
+
+struct a4n_map {
+    NodeAttributeMap* map;
+    std::unique_ptr<NodeAttributeMap> owned; // unless exported by the host
+};
+
+struct a4n_view {
+    std::shared_ptr<NodeAttributeStorageBase> snapshot;
+    ExportedType const* exported;
+    std::string name;
+    std::size_t valid;
+    Bitmap words; // copy of the validity unless it is dense
+    Bitmap const* validity;
+};
+
+namespace {
+
+thread_local std::string lastError;
+
+struct Registry {
+    std::mutex mutex;
+    std::unordered_map<std::type_index, ExportedType> byType;
+    std::unordered_map<std::string, std::type_index> byName;
+    
+    Registry() {
+        add<std::int8_t>("int8", A4N_KIND_SIGNED);
+        add<std::int16_t>("int16", A4N_KIND_SIGNED);
+        add<std::int32_t>("int32", A4N_KIND_SIGNED);
+        add<std::int64_t>("int64", A4N_KIND_SIGNED);
+        add<std::uint8_t>("uint8", A4N_KIND_UNSIGNED);
+        add<std::uint16_t>("uint16", A4N_KIND_UNSIGNED);
+        add<std::uint32_t>("uint32", A4N_KIND_UNSIGNED);
+        add<std::uint64_t>("uint64", A4N_KIND_UNSIGNED);
+        add<float>("float32", A4N_KIND_FLOAT);
+        add<double>("float64", A4N_KIND_FLOAT);
+        add<bool>("bool", A4N_KIND_BOOL);
+        // long and long long are distinct types of the same width; one of
+        // them is not std::int64_t.
+        if constexpr (sizeof(long) == 8) {
+            alias<long>("int64", A4N_KIND_SIGNED);
+            alias<unsigned long>("uint64", A4N_KIND_UNSIGNED);
+        }
+        alias<long long>("int64", A4N_KIND_SIGNED);
+        alias<unsigned long long>("uint64", A4N_KIND_UNSIGNED);
+    }
+    
+    void add(std::type_index type, ExportedType exported) {
+        auto [it, added] = byName.emplace(exported.type.name, type);
+        if (!added && it->second != type) {
+            throw std::runtime_error("Exported type name '" + it->first + "' is taken");
+        }
+        exported.type.name = it->first.c_str();
+        byType.insert_or_assign(type, exported);
+    }
+    
+    template<typename T>
+    void add(char const* name, a4n_kind kind) {
+        add(typeid(T), makeExport<T>(name, kind));
+    }
+    
+    // Registers T under the name of a registered type of the same layout.
+    template<typename T>
+    void alias(char const* name, a4n_kind kind) {
+        auto exported = makeExport<T>(name, kind);
+        exported.type.name = byName.find(name)->first.c_str();
+        byType.emplace(typeid(T), exported);
+    }
+};
+
+Registry& registry() {
+    static Registry r;
+    return r;
+}
+
+// Exported type of the values of storage, or null.
+ExportedType const* exportOf(NodeAttributeStorageBase const& storage) {
+    auto& r = registry();
+    std::lock_guard<std::mutex> lock{r.mutex};
+    auto it = r.byType.find(storage.getType());
+    return it != r.byType.end() && it->second.accepts(storage) ? &it->second : nullptr;
+}
+
+template<typename F>
+a4n_status guarded(F f) {
+    try {
+        return f();
+    } catch (std::exception const& e) {
+        lastError = e.what();
+    } catch (...) {
+        lastError = "Unknown error";
+    }
+    return A4N_ERROR;
+}
+
+void describe(std::string_view name, NodeAttributeStorageBase const& storage, a4n_attribute_info& info) {
+    info = a4n_attribute_info{};
+    info.name = name.data();
+    if (auto exported = exportOf(storage)) {
+        info.type = exported->type;
+        info.length = exported->length(storage);
+        info.valid = storage.validity().count();
+    }
+}
+
+} // namespace
+
+namespace Attributes {
+
+void registerExport(std::type_index type, ExportedType exported) {
+    auto& r = registry();
+    std::lock_guard<std::mutex> lock{r.mutex};
+    r.add(type, exported);
+}
+
+a4n_map* exportMap(NodeAttributeMap& map) {
+    return new a4n_map{&map, nullptr};
+}
+
+} // namespace Attributes
+
+extern "C" {
+
+uint32_t a4n_abi_version(void) {
+    return A4N_ABI_VERSION;
+}
+
+const char* a4n_last_error(void) {
+    return lastError.c_str();
+}
+
+a4n_map* a4n_map_create(void) {
+    try {
+        auto owned = std::make_unique<NodeAttributeMap>();
+        auto map = owned.get();
+        return new a4n_map{map, std::move(owned)};
+    } catch (std::exception const& e) {
+        lastError = e.what();
+        return nullptr;
+    }
+}
+
+void a4n_map_destroy(a4n_map* map) {
+    delete map;
+}
+
+a4n_status a4n_map_save(const a4n_map* map, const char* path) {
+    return guarded([&] {
+        map->map->save(path);
+        return A4N_OK;
+    });
+}
+
+a4n_status a4n_map_load(a4n_map* map, const char* path) {
+    return guarded([&] {
+        map->map->load(path);
+        return A4N_OK;
+    });
+}
+
+a4n_status a4n_attach(a4n_map* map, const char* name, const char* type) {
+    return guarded([&] {
+        auto& r = registry();
+        ExportedType exported;
+        {
+            std::lock_guard<std::mutex> lock{r.mutex};
+            auto it = r.byName.find(type);
+            if (it == r.byName.end()) {
+                return A4N_NOT_FOUND;
+            }
+            exported = r.byType.at(it->second);
+        }
+        exported.attach(*map->map, name);
+        return A4N_OK;
+    });
+}
+
+a4n_status a4n_set(a4n_map* map, const char* name, uint64_t node, const void* value) {
+    return guarded([&] {
+        auto storage = map->map->findStorage(name);
+        if (!storage) {
+            return A4N_NOT_FOUND;
+        }
+        auto exported = exportOf(*storage);
+        if (!exported) {
+            return A4N_UNSUPPORTED;
+        }
+        exported->set(const_cast<NodeAttributeStorageBase&>(*storage), node, value);
+        return A4N_OK;
+    });
+}
+
+size_t a4n_list(const a4n_map* map, a4n_attribute_info* infos, size_t capacity) {
+    std::size_t n = 0;
+    map->map->forEachStorage([&](std::string_view name, NodeAttributeStorageBase const& storage) {
+        if (n < capacity) {
+            describe(name, storage, infos[n]);
+        }
+        ++n;
+    });
+    return n;
+}
+
+a4n_status a4n_borrow(const a4n_map* map, const char* name, a4n_view** view) {
+    return guarded([&] {
+        *view = nullptr;
+        auto storage = map->map->findStorage(name);
+        if (!storage) {
+            return A4N_NOT_FOUND;
+        }
+        auto exported = exportOf(*storage);
+        if (!exported) {
+            return A4N_UNSUPPORTED;
+        }
+        auto v = std::make_unique<a4n_view>();
+        v->snapshot = storage->clone(std::pmr::string{name});
+        v->exported = exported;
+        v->name = name;
+        auto& validity = v->snapshot->validity();
+        v->valid = validity.count();
+        if (validity.getLayout() == ValidityLayout::Dense) {
+            v->validity = &validity.bitmap();
+        } else {
+            v->words.resize(validity.size());
+            validity.forEach([&](std::size_t i) { v->words.set(i); });
+            v->validity = &v->words;
+        }
+        *view = v.release();
+        return A4N_OK;
+    });
+}
+
+void a4n_release(a4n_view* view) {
+    delete view;
+}
+
+void a4n_view_info(const a4n_view* view, a4n_attribute_info* info) {
+    *info = a4n_attribute_info{};
+    info->name = view->name.c_str();
+    info->type = view->exported->type;
+    info->valid = view->valid;
+    info->length = view->exported->length(*view->snapshot);
+}
+
+uint64_t a4n_chunk_count(const a4n_view* view) {
+    auto n = view->exported->length(*view->snapshot);
+    return (n + view->exported->chunkSize - 1) / view->exported->chunkSize;
+}
+
+a4n_status a4n_get_chunk(const a4n_view* view, uint64_t c, a4n_chunk* chunk) {
+    if (c >= a4n_chunk_count(view)) {
+        return A4N_OUT_OF_RANGE;
+    }
+    std::size_t length = 0;
+    *chunk = a4n_chunk{};
+    chunk->values = view->exported->chunk(*view->snapshot, c, length);
+    chunk->first = c * view->exported->chunkSize;
+    chunk->length = length;
+    // A chunk of values covers at most 2M nodes (of one-byte values) and
+    // never spans two chunks of validity words, which cover 16M nodes.
+    auto& bits = *view->validity;
+    auto w = chunk->first / Bitmap::wordBits;
+    if (w < bits.wordCount()) {
+        chunk->validity = bits.wordData(w);
+        chunk->validity_words = std::min<std::uint64_t>(bits.wordCount() - w,
+                                                        (length + Bitmap::wordBits - 1) / Bitmap::wordBits);
+    }
+    return A4N_OK;
+}
+
+const void* a4n_value(const a4n_view* view, uint64_t node) {
+    auto& bits = *view->validity;
+    if (node >= bits.size() || !bits.test(node)) {
+        return nullptr;
+    }
+    auto size = view->exported->chunkSize;
+    std::size_t length = 0;
+    auto values = static_cast<char const*>(view->exported->chunk(*view->snapshot, node / size, length));
+    return values ? values + node % size * view->exported->type.size : nullptr;
+}
+
+} // extern "C"
@@ -0,0 +1,80 @@
+//
+//  CApi.hpp
+//  A4N
+//
+
+#ifndef CApi_h
+#define CApi_h
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <type_traits>
+#include <typeindex>
+
+#include "A4N.h"
+#include "Attributes.hpp"
+
+namespace Attributes {
+
+// How the C interface (A4N.h) handles plain attributes of one value type.
+struct ExportedType {
+    a4n_type type;
+    std::size_t chunkSize; // values per chunk, see Column
+    void (*attach)(NodeAttributeMap& map, std::string_view name);
+    // Whether storage is a plain storage of the type; the functions
+    // below take only those.
+    bool (*accepts)(NodeAttributeStorageBase const& storage);
+    void (*set)(NodeAttributeStorageBase& storage, index i, void const* value);
+    void const* (*chunk)(NodeAttributeStorageBase const& storage, std::size_t c, std::size_t& length);
+    std::size_t (*length)(NodeAttributeStorageBase const& storage);
+};
+
+template<typename T>
+ExportedType makeExport(char const* name, a4n_kind kind) {
+    static_assert(std::is_trivially_copyable_v<T>, "exported attributes hold trivially copyable values");
+    using Storage = NodeAttributeStorage<T>;
+    ExportedType e{};
+    e.type = a4n_type{name, std::uint32_t(kind), sizeof(T), alignof(T), 0};
+    e.chunkSize = Column<T>::chunkSize;
+    e.attach = [](NodeAttributeMap& map, std::string_view name) {
+        map.attach<T>(name);
+    };
+    e.accepts = [](NodeAttributeStorageBase const& storage) {
+        return dynamic_cast<Storage const*>(&storage) != nullptr;
+    };
+    e.set = [](NodeAttributeStorageBase& storage, index i, void const* value) {
+        T v;
+        std::memcpy(&v, value, sizeof(T));
+        dynamic_cast<Storage&>(storage).set(i, v);
+    };
+    e.chunk = [](NodeAttributeStorageBase const& storage, std::size_t c, std::size_t& length) -> void const* {
+        auto& column = dynamic_cast<Storage const&>(storage).column();
+        length = column.chunkLength(c);
+        return c < column.chunkCount() ? column.chunk(c) : nullptr;
+    };
+    e.length = [](NodeAttributeStorageBase const& storage) -> std::size_t {
+        return dynamic_cast<Storage const&>(storage).column().size();
+    };
+    return e;
+}
+
+// Registers an exported type under a copy of its name (see exportType()).
+void registerExport(std::type_index type, ExportedType exported);
+
+// Makes plain attributes of T readable through the C interface as the
+// type name, e.g. exportType<Point>("Point"). The scalar types are
+// exported from the start.
+template<typename T>
+void exportType(char const* name, a4n_kind kind = A4N_KIND_OPAQUE) {
+    registerExport(typeid(T), makeExport<T>(name, kind));
+}
+
+// C handle of map for foreign code; a4n_map_destroy() frees the handle
+// but leaves map alone. map must outlive the handle, not its views.
+a4n_map* exportMap(NodeAttributeMap& map);
+
+} // namespace Attributes
+
+#endif /* CApi_h */
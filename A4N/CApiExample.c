@@ -0,0 +1,93 @@
+/*
+ *  CApiExample.c
+ *  A4N
+ *
+ *  Reads attributes through the C interface without copying them, as a
+ *  foreign runtime would. Build it apart from the A4N target, e.g.
+ *      c++ -std=c++17 -c CApi.cpp && cc CApiExample.c CApi.o -lc++
+ *  (-lstdc++ with GCC); exits with 0 if every check passes.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "A4N.h"
+
+#define CHECK(condition)                                                    \
+    do {                                                                    \
+        if (!(condition)) {                                                 \
+            fprintf(stderr, "%s:%d: check failed: %s (%s)\n", __FILE__,     \
+                    __LINE__, #condition, a4n_last_error());                \
+            return 1;                                                       \
+        }                                                                   \
+    } while (0)
+
+int main(void) {
+    CHECK(a4n_abi_version() == A4N_ABI_VERSION);
+    a4n_map* map = a4n_map_create();
+    CHECK(map);
+    CHECK(a4n_attach(map, "weight", "float64") == A4N_OK);
+    CHECK(a4n_attach(map, "color", "int32") == A4N_OK);
+    CHECK(a4n_attach(map, "color", "int32") == A4N_ERROR); /* name taken */
+    CHECK(a4n_attach(map, "label", "string") == A4N_NOT_FOUND);
+
+    /* Every third node of 1000000 gets a weight. */
+    const uint64_t nodes = 1000000;
+    for (uint64_t i = 0; i < nodes; i += 3) {
+        double w = 0.5 * (double)i;
+        CHECK(a4n_set(map, "weight", i, &w) == A4N_OK);
+    }
+    int32_t color = 7;
+    CHECK(a4n_set(map, "color", 42, &color) == A4N_OK);
+
+    a4n_attribute_info infos[4];
+    size_t count = a4n_list(map, infos, 4);
+    CHECK(count == 2);
+    for (size_t k = 0; k < count; ++k) {
+        printf("%s: %s, %u bytes, %llu valid\n", infos[k].name, infos[k].type.name,
+               infos[k].type.size, (unsigned long long)infos[k].valid);
+    }
+
+    a4n_view* view = NULL;
+    CHECK(a4n_borrow(map, "weight", &view) == A4N_OK);
+    /* The view is a snapshot: later writes do not show in it. */
+    double changed = -1;
+    CHECK(a4n_set(map, "weight", 0, &changed) == A4N_OK);
+
+    a4n_attribute_info info;
+    a4n_view_info(view, &info);
+    CHECK(info.type.kind == A4N_KIND_FLOAT && info.type.size == sizeof(double));
+    CHECK(info.valid == (nodes + 2) / 3);
+
+    /* Sum the valid weights straight from the value buffers. */
+    double sum = 0;
+    uint64_t seen = 0;
+    for (uint64_t c = 0; c < a4n_chunk_count(view); ++c) {
+        a4n_chunk chunk;
+        CHECK(a4n_get_chunk(view, c, &chunk) == A4N_OK);
+        const double* values = (const double*)chunk.values;
+        for (uint64_t w = 0; w < chunk.validity_words; ++w) {
+            for (uint64_t bits = chunk.validity[w]; bits; bits &= bits - 1) {
+                uint64_t i = w * 64 + (uint64_t)__builtin_ctzll(bits);
+                CHECK(chunk.first + i == 0 || values[i] == 0.5 * (double)(chunk.first + i));
+                sum += values[i];
+                ++seen;
+            }
+        }
+    }
+    CHECK(seen == info.valid);
+    double expected = 0;
+    for (uint64_t i = 0; i < nodes; i += 3) {
+        expected += 0.5 * (double)i;
+    }
+    CHECK(sum == expected);
+    CHECK(*(const double*)a4n_value(view, 0) == 0 && a4n_value(view, 1) == NULL);
+    a4n_chunk none;
+    CHECK(a4n_get_chunk(view, a4n_chunk_count(view), &none) == A4N_OUT_OF_RANGE);
+    a4n_release(view);
+
+    CHECK(a4n_borrow(map, "missing", &view) == A4N_NOT_FOUND);
+    a4n_map_destroy(map);
+    printf("%llu weights, sum %.1f\n", (unsigned long long)seen, sum);
+    return 0;
+}
@@ -0,0 +1,273 @@
+//
+//  Codec.hpp
+//  A4N
+//
+
+#ifndef Codec_h
+#define Codec_h
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+namespace Attributes {
+
+// Appends values of up to 64 bits to a byte vector, least significant
+// bit first.
+class BitWriter {
+public:
+    explicit BitWriter(std::vector<char>& out)
+    : out{out} { }
+    
+    void put(std::uint64_t v, unsigned bits) {
+        if (bits == 0) {
+            return;
+        }
+        if (bits < 64) {
+            v &= (std::uint64_t{1} << bits) - 1;
+        }
+        acc |= v << fill;
+        if (fill + bits >= 64) {
+            auto n = out.size();
+            out.resize(n + 8);
+            std::memcpy(out.data() + n, &acc, 8);
+            acc = fill ? v >> (64 - fill) : 0;
+            fill = fill + bits - 64;
+        } else {
+            fill += bits;
+        }
+    }
+    
+    // Writes the bits still buffered; call once at the end.
+    void flush() {
+        auto n = out.size();
+        out.resize(n + (fill + 7) / 8);
+        std::memcpy(out.data() + n, &acc, (fill + 7) / 8);
+        acc = 0;
+        fill = 0;
+    }
+    
+private:
+    std::vector<char>& out;
+    std::uint64_t acc = 0;
+    unsigned fill = 0; // bits in acc
+};
+
+// Reads what BitWriter wrote.
+class BitReader {
+public:
+    BitReader(char const* data, std::size_t bytes)
+    : data{data}, bytes{bytes} { }
+    
+    std::uint64_t get(unsigned bits) {
+        if (bits == 0) {
+            return 0;
+        }
+        auto byte = pos >> 3;
+        auto offset = unsigned(pos & 7);
+        if (byte + 8 <= bytes && offset + bits <= 64) {
+            std::uint64_t word;
+            std::memcpy(&word, data + byte, 8);
+            pos += bits;
+            word >>= offset;
+            return bits < 64 ? word & ((std::uint64_t{1} << bits) - 1) : word;
+        }
+        std::uint64_t v = 0;
+        for (unsigned got = 0; got < bits;) {
+            byte = pos >> 3;
+            offset = unsigned(pos & 7);
+            auto take = std::min(8 - offset, bits - got);
+            auto b = byte < bytes ? std::uint64_t(std::uint8_t(data[byte])) : 0;
+            v |= ((b >> offset) & ((1u << take) - 1)) << got;
+            got += take;
+            pos += take;
+        }
+        return v;
+    }
+    
+private:
+    char const* data;
+    std::size_t bytes;
+    std::size_t pos = 0; // in bits
+};
+
+// Self-contained encoding of a chunk of values for compact storage in
+// memory or on disk, see TieredNodeAttributeStorage. Without a better
+// one, the bytes are copied.
+template<typename T, typename = void>
+struct ChunkCodec {
+    // Appends the encoding of v[0, n) to out.
+    static void encode(T const* v, std::size_t n, std::vector<char>& out) {
+        auto size = out.size();
+        out.resize(size + n * sizeof(T));
+        std::memcpy(out.data() + size, v, n * sizeof(T));
+    }
+    
+    // Decodes n values from the bytes written by encode().
+    static void decode(char const* data, std::size_t bytes, T* v, std::size_t n) {
+        std::memcpy(v, data, std::min(bytes, n * sizeof(T)));
+    }
+};
+
+// Integers, in blocks of 128 values, each bit-packed in the smaller of
+// two forms: the offsets from the block minimum (frame of reference), or
+// the zigzag-encoded differences of consecutive values (delta), which
+// suits sorted or slowly changing values. A block is a mode bit and a
+// 7-bit width, the base value and its packed values.
+template<typename T>
+struct ChunkCodec<T, std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>>> {
+    static constexpr std::size_t blockSize = 128;
+    static constexpr unsigned bits = 8 * sizeof(T);
+    using U = std::make_unsigned_t<T>;
+    
+    static void encode(T const* v, std::size_t n, std::vector<char>& out) {
+        for (std::size_t b = 0; b < n; b += blockSize) {
+            auto m = std::min(blockSize, n - b);
+            auto block = v + b;
+            auto [lo, hi] = std::minmax_element(block, block + m);
+            auto range = std::uint64_t(U(U(*hi) - U(*lo)));
+            std::uint64_t zigzags = 0;
+            for (std::size_t k = 1; k < m; ++k) {
+                zigzags |= zigzag(U(U(block[k]) - U(block[k - 1])));
+            }
+            auto forWidth = width(range), deltaWidth = width(zigzags);
+            auto delta = deltaWidth < forWidth;
+            auto w = delta ? deltaWidth : forWidth;
+            auto base = delta ? block[0] : *lo;
+            out.push_back(char((delta ? 0x80 : 0) | w));
+            auto size = out.size();
+            out.resize(size + sizeof(T));
+            std::memcpy(out.data() + size, &base, sizeof(T));
+            BitWriter writer{out};
+            for (std::size_t k = 0; k < m; ++k) {
+                writer.put(delta ? (k ? zigzag(U(U(block[k]) - U(block[k - 1]))) : 0)
+                                 : std::uint64_t(U(U(block[k]) - U(base))), w);
+            }
+            writer.flush();
+        }
+    }
+    
+    static void decode(char const* data, std::size_t bytes, T* v, std::size_t n) {
+        auto end = data + bytes;
+        for (std::size_t b = 0; b < n && data < end; b += blockSize) {
+            auto m = std::min(blockSize, n - b);
+            auto header = std::uint8_t(*data++);
+            auto delta = (header & 0x80) != 0;
+            unsigned w = header & 0x7f;
+            T base;
+            std::memcpy(&base, data, sizeof(T));
+            data += sizeof(T);
+            auto packed = (m * w + 7) / 8;
+            BitReader reader{data, std::size_t(std::min<std::ptrdiff_t>(end - data, std::ptrdiff_t(packed)))};
+            auto prev = U(base);
+            for (std::size_t k = 0; k < m; ++k) {
+                auto x = reader.get(w);
+                if (delta) {
+                    prev = U(prev + unzigzag(x));
+                    v[b + k] = T(prev);
+                } else {
+                    v[b + k] = T(U(U(base) + U(x)));
+                }
+            }
+            data += packed;
+        }
+    }
+    
+private:
+    static unsigned width(std::uint64_t x) {
+        return x ? 64 - unsigned(__builtin_clzll(x)) : 0;
+    }
+    
+    // Maps the difference d, read as signed, to small unsigned numbers.
+    static std::uint64_t zigzag(U d) {
+        auto s = std::int64_t(std::make_signed_t<T>(d));
+        return (std::uint64_t(s) << 1) ^ std::uint64_t(s >> 63);
+    }
+    
+    static U unzigzag(std::uint64_t z) {
+        return U((z >> 1) ^ (~(z & 1) + 1));
+    }
+};
+
+// Floats by XOR with the previous value (as in Gorilla): an equal value
+// takes one bit, and otherwise only the bits between the leading and
+// trailing zeros of the XOR are written, reusing the previous window if
+// they fit in it.
+template<typename T>
+struct ChunkCodec<T, std::enable_if_t<std::is_floating_point_v<T> && (sizeof(T) == 4 || sizeof(T) == 8)>> {
+    static constexpr unsigned bits = 8 * sizeof(T);
+    static constexpr unsigned fieldBits = sizeof(T) == 8 ? 6 : 5;
+    using U = std::conditional_t<sizeof(T) == 8, std::uint64_t, std::uint32_t>;
+    
+    static void encode(T const* v, std::size_t n, std::vector<char>& out) {
+        if (n == 0) {
+            return;
+        }
+        BitWriter writer{out};
+        auto prev = bitsOf(v[0]);
+        writer.put(prev, bits);
+        unsigned lead = bits, trail = 0; // window of the previous value
+        for (std::size_t k = 1; k < n; ++k) {
+            auto cur = bitsOf(v[k]);
+            auto x = std::uint64_t(cur ^ prev);
+            prev = cur;
+            if (x == 0) {
+                writer.put(0, 1);
+                continue;
+            }
+            auto l = unsigned(__builtin_clzll(x)) - (64 - bits);
+            auto t = unsigned(__builtin_ctzll(x));
+            if (l >= lead && t >= trail) {
+                writer.put(0b01, 2);
+                writer.put(x >> trail, bits - lead - trail);
+            } else {
+                lead = std::min(l, (1u << fieldBits) - 1);
+                trail = t;
+                writer.put(0b11, 2);
+                writer.put(lead, fieldBits);
+                writer.put(bits - lead - trail - 1, fieldBits);
+                writer.put(x >> trail, bits - lead - trail);
+            }
+        }
+        writer.flush();
+    }
+    
+    static void decode(char const* data, std::size_t bytes, T* v, std::size_t n) {
+        if (n == 0) {
+            return;
+        }
+        BitReader reader{data, bytes};
+        auto prev = U(reader.get(bits));
+        v[0] = valueOf(prev);
+        unsigned lead = bits, trail = 0;
+        for (std::size_t k = 1; k < n; ++k) {
+            if (reader.get(1)) {
+                if (reader.get(1)) {
+                    lead = unsigned(reader.get(fieldBits));
+                    trail = bits - lead - unsigned(reader.get(fieldBits)) - 1;
+                }
+                prev ^= U(reader.get(bits - lead - trail) << trail);
+            }
+            v[k] = valueOf(prev);
+        }
+    }
+    
+private:
+    static U bitsOf(T v) {
+        U u;
+        std::memcpy(&u, &v, sizeof(T));
+        return u;
+    }
+    
+    static T valueOf(U u) {
+        T v;
+        std::memcpy(&v, &u, sizeof(T));
+        return v;
+    }
+};
+
+} // namespace Attributes
+
+#endif /* Codec_h */
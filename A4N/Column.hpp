@@ -0,0 +1,281 @@
+//
+//  Column.hpp
+//  A4N
+//
+
+#ifndef Column_h
+#define Column_h
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <stdexcept>
+#include <vector>
+
+#include "Memory.hpp"
+#include "Parallel.hpp"
+#include "Serialize.hpp"
+
+namespace Attributes {
+
+// Values of one attribute, in chunks of up to 2 MiB (one huge page)
+// allocated from a memory resource. Growing never moves existing chunks,
+// and new elements are initialised in parallel with the static
+// partitioning of parallelFor, so every page is first touched by the
+// worker that owns it in the parallel kernels. A lone first chunk
+// grows geometrically, so small columns do not pay for a whole chunk.
+// Chunks are reference counted: shareFrom() makes a copy-on-write clone
+// in O(chunks), and a chunk still shared is duplicated on its first write
+// through operator[] or chunk(). Reads go through the const overloads.
+// Chunks viewed in external memory (see view()) are copied by the clone
+// up front, so the viewing column keeps writing to that memory.
+template<typename T>
+class Column {
+public:
+    static constexpr std::size_t chunkBits = [] {
+        std::size_t bits = 10;
+        while ((std::size_t{2} << bits) * sizeof(T) <= ColumnResource::hugePageSize) {
+            ++bits;
+        }
+        return bits;
+    }();
+    static constexpr std::size_t chunkSize = std::size_t{1} << chunkBits;
+    static constexpr std::size_t chunkMask = chunkSize - 1;
+    static constexpr std::size_t parallelThreshold = std::size_t{1} << 20;
+    
+    explicit Column(std::pmr::memory_resource* resource = columnResource())
+    : resource{resource}, chunks{resource}, owners{resource} { }
+    
+    Column(Column const&) = delete;
+    Column& operator=(Column const&) = delete;
+    
+    // Writable element; copies its chunk first if it is shared.
+    T& operator[](std::size_t i) {
+        return chunk(i >> chunkBits)[i & chunkMask];
+    }
+    
+    T const& operator[](std::size_t i) const {
+        return chunks[i >> chunkBits][i & chunkMask];
+    }
+    
+    std::size_t size() const {
+        return count;
+    }
+    
+    std::size_t chunkCount() const {
+        return chunks.size();
+    }
+    
+    T* chunk(std::size_t c) {
+        if (isShared(c)) {
+            unshare(c);
+        }
+        return chunks[c];
+    }
+    
+    T const* chunk(std::size_t c) const {
+        return chunks[c];
+    }
+    
+    // Whether chunk c is still shared with a clone. A clone may drop the
+    // chunk on another thread (see NodeAttributeMap::saveAsync()); the
+    // fence orders the writes that follow a false after its reads.
+    bool isShared(std::size_t c) const {
+        auto shared = owners[c].use_count() > 1;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return shared;
+    }
+    
+    // Number of constructed elements in chunk c.
+    std::size_t chunkLength(std::size_t c) const {
+        return count > c * chunkSize ? std::min(chunkSize, count - c * chunkSize) : 0;
+    }
+    
+    std::size_t capacityBytes() const {
+        auto capacity = owners.empty() ? 0 : owners[0]->capacity + (owners.size() - 1) * chunkSize;
+        return capacity * sizeof(T) + owners.capacity() * (sizeof(T*) + sizeof(owners[0]));
+    }
+    
+    std::pmr::memory_resource* getResource() const {
+        return resource;
+    }
+    
+    // Replaces the contents by those of other, sharing all its chunks but
+    // the viewed ones, which are copied.
+    void shareFrom(Column const& other) {
+        chunks = other.chunks;
+        owners = other.owners;
+        count = other.count;
+        for (std::size_t c = 0; c < owners.size(); ++c) {
+            if (!owners[c]->resource) {
+                unshare(c);
+            }
+        }
+    }
+    
+    // Replaces the contents by the n elements at data, which the column
+    // does not own; the caller keeps them alive. Writes go to data, also
+    // while the column has clones, but growth allocates from the resource.
+    void view(T* data, std::size_t n) {
+        chunks.clear();
+        owners.clear();
+        for (std::size_t c = 0; c * chunkSize < n; ++c) {
+            auto length = std::min(chunkSize, n - c * chunkSize);
+            owners.push_back(std::allocate_shared<Chunk>(std::pmr::polymorphic_allocator<Chunk>{resource},
+                                                         data + c * chunkSize, length));
+            chunks.push_back(data + c * chunkSize);
+        }
+        count = n;
+    }
+    
+    // Drops all elements and releases the chunks not shared with a clone.
+    void clear() {
+        chunks.clear();
+        owners.clear();
+        count = 0;
+    }
+    
+    // Writes the size and all elements, see ValueCodec.
+    void save(std::ostream& out) const {
+        writeValue<std::uint64_t>(out, count);
+        for (std::size_t c = 0; c < chunks.size(); ++c) {
+            ValueCodec<T>::write(out, chunks[c], chunkLength(c));
+        }
+    }
+    
+    // Reads what save() wrote into the first elements, growing if needed.
+    void load(std::istream& in) {
+        auto n = readValue<std::uint64_t>(in);
+        resize(n);
+        for (std::size_t c = 0; c * chunkSize < n; ++c) {
+            ValueCodec<T>::read(in, chunk(c), std::min(chunkSize, n - c * chunkSize));
+        }
+        if (!in) {
+            throw std::runtime_error("Truncated attribute file");
+        }
+    }
+    
+    // Grows to n value-initialised elements.
+    void resize(std::size_t n) {
+        if (n <= count) {
+            return;
+        }
+        if (n <= firstCapacity() && owners.size() <= 1) {
+            // fits
+        } else if (owners.size() <= 1 && n <= chunkSize) {
+            growFirst(std::min(chunkSize, std::max(n, 2 * firstCapacity())));
+        } else {
+            growFirst(chunkSize);
+            while (owners.size() * chunkSize < n) {
+                append(chunkSize);
+            }
+        }
+        // A clone must not see elements constructed past its own end, and
+        // a viewed chunk ends at its last element (see view()).
+        auto from = count;
+        if (from & chunkMask) {
+            auto c = from >> chunkBits;
+            if (owners[c]->capacity < std::min(chunkSize, n - c * chunkSize)) {
+                replace(c, chunkSize);
+            } else {
+                chunk(c);
+            }
+        }
+        // Each worker initialises its share of [0, n) as a kernel over
+        // the whole column would see it; small growth stays on the caller.
+        auto init = [&](std::size_t lo, std::size_t hi) {
+            for (auto i = std::max(lo, from); i < hi;) {
+                auto end = std::min(hi, (i | chunkMask) + 1);
+                std::uninitialized_value_construct_n(chunks[i >> chunkBits] + (i & chunkMask), end - i);
+                i = end;
+            }
+        };
+        if (n - from < parallelThreshold) {
+            init(from, n);
+        } else {
+            parallelFor(0, n, init);
+        }
+        count = n;
+        for (auto c = from >> chunkBits; c < owners.size(); ++c) {
+            owners[c]->length = chunkLength(c);
+        }
+    }
+    
+private:
+    struct Chunk {
+        Chunk(std::pmr::memory_resource* resource, std::size_t capacity)
+        : resource{resource}, capacity{capacity},
+          data{static_cast<T*>(resource->allocate(capacity * sizeof(T), alignof(T)))} { }
+        
+        // Elements owned by someone else, see view().
+        Chunk(T* data, std::size_t length)
+        : resource{nullptr}, capacity{length}, data{data}, length{length} { }
+        
+        ~Chunk() {
+            if (resource) {
+                std::destroy_n(data, length);
+                resource->deallocate(data, capacity * sizeof(T), alignof(T));
+            }
+        }
+        
+        std::pmr::memory_resource* resource; // null if not owned
+        std::size_t capacity;
+        T* data;
+        std::size_t length = 0; // constructed elements
+    };
+    
+    std::size_t firstCapacity() const {
+        return owners.empty() ? 0 : owners[0]->capacity;
+    }
+    
+    std::shared_ptr<Chunk> makeChunk(std::size_t capacity) {
+        return std::allocate_shared<Chunk>(std::pmr::polymorphic_allocator<Chunk>{resource},
+                                           resource, capacity);
+    }
+    
+    void append(std::size_t capacity) {
+        owners.push_back(makeChunk(capacity));
+        chunks.push_back(owners.back()->data);
+    }
+    
+    // Gives chunk c a private copy of its elements with the given
+    // capacity; they are moved instead if nobody else holds the chunk.
+    void replace(std::size_t c, std::size_t capacity) {
+        auto fresh = makeChunk(capacity);
+        auto& old = *owners[c];
+        if (!isShared(c)) {
+            std::uninitialized_move_n(old.data, old.length, fresh->data);
+        } else {
+            std::uninitialized_copy_n(old.data, old.length, fresh->data);
+        }
+        fresh->length = old.length;
+        owners[c] = std::move(fresh);
+        chunks[c] = owners[c]->data;
+    }
+    
+    // Copies of viewed chunks get room for chunkSize elements, unless
+    // the chunk is a lone first one, which grows geometrically.
+    void unshare(std::size_t c) {
+        auto& old = *owners[c];
+        replace(c, old.resource || owners.size() == 1 ? old.capacity : chunkSize);
+    }
+    
+    // Reallocates the first chunk with the given capacity.
+    void growFirst(std::size_t capacity) {
+        if (owners.empty()) {
+            append(capacity);
+        } else if (capacity > firstCapacity()) {
+            replace(0, capacity);
+        }
+    }
+    
+    std::pmr::memory_resource* resource;
+    std::pmr::vector<T*> chunks; // owners[c]->data, one indirection for reads
+    std::pmr::vector<std::shared_ptr<Chunk>> owners;
+    std::size_t count = 0;
+}; // class Column
+
+} // namespace Attributes
+
+#endif /* Column_h */
@@ -0,0 +1,364 @@
+//
+//  Group.hpp
+//  A4N
+//
+
+#ifndef Group_h
+#define Group_h
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "Attributes.hpp"
+
+namespace Attributes {
+
+// Memory layout of an attribute group.
+enum class GroupLayout {
+    Rows,   // one vector of tuples (AoS): a node's members share a cache line
+    Columns // one vector per member: scans over a single member stay dense
+};
+
+template<GroupLayout L, typename... Ts>
+class NodeAttributeGroup;
+
+// Attributes that are always set together, e.g. x, y, z.
+// All members share one validity bitmap, one element count and one
+// growth schedule, so lookup, validity check and resize happen once
+// per group instead of once per member.
+template<GroupLayout L, typename... Ts>
+class NodeAttributeGroupStorage : public NodeAttributeStorageBase {
+public:
+    using Row = std::tuple<Ts...>;
+    static constexpr std::size_t members = sizeof...(Ts);
+    
+    NodeAttributeGroupStorage(std::pmr::string name, std::array<std::string, members> memberNames)
+    : NodeAttributeStorageBase{std::move(name), typeid(NodeAttributeGroupStorage)},
+      memberNames{std::move(memberNames)}, values{makeValues(getResource())},
+      attrSet{getResource()} { }
+    
+    ~NodeAttributeGroupStorage() override {
+        invalidateAttributes();
+    }
+    
+    void invalidateAttributes() override {
+        for (auto att: attrSet) att->invalidateAttribute();
+    }
+    
+    auto size() {
+        return validElements;
+    }
+    
+    std::size_t memoryUsage() const override {
+        return NodeAttributeStorageBase::memoryUsage() + capacity * (sizeof(Ts) + ...);
+    }
+    
+    // Deep copy; values are not shared.
+    std::shared_ptr<NodeAttributeStorageBase> clone(std::pmr::string name) const override {
+        auto resource = name.get_allocator().resource();
+        auto copy = std::allocate_shared<NodeAttributeGroupStorage>(
+            std::pmr::polymorphic_allocator<NodeAttributeGroupStorage>{resource},
+            std::move(name), memberNames);
+        copy->copyState(*this);
+        copy->values = values;
+        copy->rows = copy->capacity = rows;
+        return copy;
+    }
+    
+    void save(std::ostream& out) const override {
+        saveValidity(out);
+        writeValue<std::uint64_t>(out, rows);
+        saveMembers(out, std::index_sequence_for<Ts...>{});
+    }
+    
+    void load(std::istream& in) override {
+        loadValidity(in);
+        auto n = readValue<std::uint64_t>(in);
+        if (n) {
+            resize(n - 1);
+        }
+        loadMembers(in, n, std::index_sequence_for<Ts...>{});
+        if (!in) {
+            throw std::runtime_error("Truncated attribute file");
+        }
+    }
+    
+    std::string_view memberName(std::size_t k) const {
+        return memberNames.at(k);
+    }
+    
+    // Position of a member name, throws if there is none.
+    std::size_t memberIndex(std::string_view member) const {
+        for (std::size_t k = 0; k < members; ++k) {
+            if (memberNames[k] == member) {
+                return k;
+            }
+        }
+        throw std::runtime_error("No such group member");
+    }
+    
+    // Grows all members together.
+    void resize(index i) {
+        if (i < rows) {
+            return;
+        }
+        if (i >= capacity) {
+            capacity = std::max(i + 1, 2 * capacity);
+            if constexpr (L == GroupLayout::Rows) {
+                values.reserve(capacity);
+            } else {
+                std::apply([&](auto&... column) { (column.reserve(capacity), ...); }, values);
+            }
+        }
+        rows = i + 1;
+        if constexpr (L == GroupLayout::Rows) {
+            values.resize(rows);
+        } else {
+            std::apply([&](auto&... column) { (column.resize(rows), ...); }, values);
+        }
+    }
+    
+    void set(index i, Ts... vs) {
+        resize(i);
+        touch(i);
+        assign(i, Row{std::move(vs)...}, std::index_sequence_for<Ts...>{});
+        markValid(i);
+    }
+    
+    // Updates one member of a row that is already set.
+    template<std::size_t K>
+    void set(index i, std::tuple_element_t<K, Row> v) {
+        checkIndex(i);
+        touch(i);
+        member<K>(i) = std::move(v);
+    }
+    
+    std::optional<Row> get(index i) {
+        if (!isValid(i)) {
+            return std::nullopt;
+        }
+        return row(i, std::index_sequence_for<Ts...>{});
+    }
+    
+    template<std::size_t K>
+    std::optional<std::tuple_element_t<K, Row>> get(index i) {
+        if (!isValid(i)) {
+            return std::nullopt;
+        }
+        return member<K>(i);
+    }
+    
+    // Contiguous values of member K (Columns layout only).
+    template<std::size_t K>
+    auto column() {
+        static_assert(L == GroupLayout::Columns, "column() needs GroupLayout::Columns");
+        return std::get<K>(values).data();
+    }
+    
+    // Calls f(i, members...) for every valid row.
+    template<typename F>
+    void forEach(F f) {
+        for (index i = 0; i < rows; ++i) {
+            if (isValid(i)) {
+                std::apply([&](auto&&... vs) { f(i, vs...); },
+                           row(i, std::index_sequence_for<Ts...>{}));
+            }
+        }
+    }
+    
+private:
+    template<std::size_t K>
+    auto& member(index i) {
+        if constexpr (L == GroupLayout::Rows) {
+            return std::get<K>(values[i]);
+        } else {
+            return std::get<K>(values)[i];
+        }
+    }
+    
+    template<std::size_t K>
+    auto const& member(index i) const {
+        if constexpr (L == GroupLayout::Rows) {
+            return std::get<K>(values[i]);
+        } else {
+            return std::get<K>(values)[i];
+        }
+    }
+    
+    // Member by member; contiguous per member in the Columns layout.
+    template<std::size_t... K>
+    void saveMembers(std::ostream& out, std::index_sequence<K...>) const {
+        auto save = [&](auto k) {
+            using V = std::tuple_element_t<decltype(k)::value, Row>;
+            if constexpr (L == GroupLayout::Columns) {
+                ValueCodec<V>::write(out, std::get<decltype(k)::value>(values).data(), rows);
+            } else {
+                for (index i = 0; i < rows; ++i) {
+                    ValueCodec<V>::write(out, &member<decltype(k)::value>(i), 1);
+                }
+            }
+        };
+        (save(std::integral_constant<std::size_t, K>{}), ...);
+    }
+    
+    template<std::size_t... K>
+    void loadMembers(std::istream& in, index n, std::index_sequence<K...>) {
+        auto load = [&](auto k) {
+            using V = std::tuple_element_t<decltype(k)::value, Row>;
+            if constexpr (L == GroupLayout::Columns) {
+                ValueCodec<V>::read(in, std::get<decltype(k)::value>(values).data(), n);
+            } else {
+                for (index i = 0; i < n; ++i) {
+                    ValueCodec<V>::read(in, &member<decltype(k)::value>(i), 1);
+                }
+            }
+        };
+        (load(std::integral_constant<std::size_t, K>{}), ...);
+    }
+    
+    template<std::size_t... K>
+    Row row(index i, std::index_sequence<K...>) {
+        return Row{member<K>(i)...};
+    }
+    
+    template<std::size_t... K>
+    void assign(index i, Row&& r, std::index_sequence<K...>) {
+        ((member<K>(i) = std::move(std::get<K>(r))), ...);
+    }
+    
+    struct UndoRecord : UndoLog::Record {
+        UndoRecord(NodeAttributeGroupStorage* storage, index i, std::optional<Row> value)
+        : storage{storage}, i{i}, value{std::move(value)} {
+            restore = [](UndoLog::Record* r) {
+                auto u = static_cast<UndoRecord*>(r);
+                u->storage->restore(u->i, std::move(u->value));
+            };
+            if constexpr (!std::is_trivially_destructible_v<std::optional<Row>>) {
+                destroy = [](UndoLog::Record* r) {
+                    static_cast<UndoRecord*>(r)->~UndoRecord();
+                };
+            }
+        }
+        NodeAttributeGroupStorage* storage;
+        index i;
+        std::optional<Row> value; // empty if the row was not valid
+    };
+    
+    void logUndo(UndoLog& log, index i) override {
+        log.append<UndoRecord>(this, i, get(i));
+    }
+    
+    void restore(index i, std::optional<Row> value) {
+        if (value) {
+            assign(i, std::move(*value), std::index_sequence_for<Ts...>{});
+            markValid(i);
+        } else if (isValid(i)) {
+            clearValid(i);
+        }
+    }
+    
+    using Values = std::conditional_t<L == GroupLayout::Rows,
+                                      std::pmr::vector<Row>,
+                                      std::tuple<std::pmr::vector<Ts>...>>;
+    
+    static Values makeValues(std::pmr::memory_resource* resource) {
+        if constexpr (L == GroupLayout::Rows) {
+            return Values{resource};
+        } else {
+            return Values{std::pmr::vector<Ts>{resource}...};
+        }
+    }
+    
+    std::array<std::string, members> memberNames;
+    Values values;
+    index rows = 0;
+    index capacity = 0;
+    friend class NodeAttributeGroup<L, Ts...>;
+    friend class AttributeHandle<NodeAttributeGroupStorage<L, Ts...>>;
+    std::pmr::unordered_set<AttributeHandle<NodeAttributeGroupStorage<L, Ts...>>*> attrSet;
+}; // class NodeAttributeGroupStorage
+
+template<GroupLayout L, typename... Ts>
+class NodeAttributeGroup : public AttributeHandle<NodeAttributeGroupStorage<L, Ts...>> {
+    using Storage = NodeAttributeGroupStorage<L, Ts...>;
+public:
+    explicit NodeAttributeGroup(std::shared_ptr<Storage> owned_storage)
+    : AttributeHandle<Storage>{std::move(owned_storage)} { }
+    
+    using AttributeHandle<Storage>::checkAttribute;
+    
+    auto size() {
+        return owned_storage->size();
+    }
+    
+    bool isValid(index i) {
+        checkAttribute();
+        return owned_storage->isValid(i);
+    }
+    
+    void set(index i, Ts... vs) {
+        checkAttribute();
+        owned_storage->set(i, std::move(vs)...);
+    }
+    
+    template<std::size_t K>
+    void set(index i, std::tuple_element_t<K, typename Storage::Row> v) {
+        checkAttribute();
+        owned_storage->template set<K>(i, std::move(v));
+    }
+    
+    auto get(index i) {
+        checkAttribute();
+        return owned_storage->get(i);
+    }
+    
+    template<std::size_t K>
+    auto get(index i) {
+        checkAttribute();
+        return owned_storage->template get<K>(i);
+    }
+    
+    template<std::size_t K>
+    auto column() {
+        checkAttribute();
+        return owned_storage->template column<K>();
+    }
+    
+    auto memberIndex(std::string_view member) {
+        return owned_storage->memberIndex(member);
+    }
+    
+    template<typename F>
+    void forEach(F f) {
+        checkAttribute();
+        owned_storage->forEach(f);
+    }
+    
+private:
+    using AttributeHandle<Storage>::owned_storage;
+}; // class NodeAttributeGroup
+
+// Attaches the members Ts... as one group named `name`.
+template<GroupLayout L, typename... Ts>
+auto attachGroup(NodeAttributeMap& map, std::string_view name,
+                 std::array<std::string, sizeof...(Ts)> memberNames) {
+    return NodeAttributeGroup<L, Ts...>{
+        map.attachStorage<NodeAttributeGroupStorage<L, Ts...>>(name, std::move(memberNames))};
+}
+
+template<GroupLayout L, typename... Ts>
+auto getGroup(NodeAttributeMap& map, std::string_view name) {
+    return NodeAttributeGroup<L, Ts...>{map.getStorage<NodeAttributeGroupStorage<L, Ts...>>(name)};
+}
+
+} // namespace Attributes
+
+#endif /* Group_h */
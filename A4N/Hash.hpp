@@ -0,0 +1,65 @@
+//
+//  Hash.hpp
+//  A4N
+//
+
+#ifndef Hash_h
+#define Hash_h
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <type_traits>
+
+namespace Attributes {
+
+using hash_t = std::uint64_t;
+
+// 64-bit finaliser (murmur3 fmix64).
+inline hash_t mix64(hash_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+inline hash_t hashCombine(hash_t h, hash_t v) {
+    return mix64(h ^ (v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2)));
+}
+
+inline hash_t hashBytes(void const* p, std::size_t n, hash_t seed = 0) {
+    auto bytes = static_cast<unsigned char const*>(p);
+    auto h = seed ^ (n * 0x9e3779b97f4a7c15ULL);
+    for (; n >= 8; bytes += 8, n -= 8) {
+        std::uint64_t w;
+        std::memcpy(&w, bytes, 8);
+        h = hashCombine(h, w);
+    }
+    if (n) {
+        std::uint64_t w = 0;
+        std::memcpy(&w, bytes, n);
+        h = hashCombine(h, w);
+    }
+    return h;
+}
+
+// Content hash of a single attribute value. Arithmetic types and types
+// without padding are hashed by their bytes, everything else by std::hash.
+// Specialise for structured types without a std::hash.
+template<typename T, typename = void>
+struct ContentHash {
+    hash_t operator()(T const& v) const {
+        if constexpr (std::is_arithmetic_v<T> || std::has_unique_object_representations_v<T>) {
+            return hashBytes(&v, sizeof(T));
+        } else {
+            return mix64(std::hash<T>{}(v));
+        }
+    }
+};
+
+} // namespace Attributes
+
+#endif /* Hash_h */
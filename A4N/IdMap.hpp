@@ -0,0 +1,378 @@
+//
+//  IdMap.hpp
+//  A4N
+//
+
+#ifndef IdMap_h
+#define IdMap_h
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <type_traits>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "Attributes.hpp"
+#include "Hash.hpp"
+#include "Parallel.hpp"
+
+namespace Attributes {
+
+// Maps external node ids (64-bit numbers, strings, ...) to dense node
+// indices 0, 1, 2, ... in order of first insertion, and back. Kept next to
+// a NodeAttributeMap by loaders whose inputs do not use internal indices.
+// The table is split by hash into shards that are independent open
+// addressing tables in the manner of Swiss tables: slots come in groups of
+// 16 with one control byte each (empty, or 7 bits of the hash), and a
+// probe compares a whole group of control bytes at once (SSE2 or NEON),
+// so most lookups touch one group and compare a single key. Ids are never
+// removed. Bulk insertion builds the shards in parallel; bulk lookup
+// prefetches in batches to hide cache misses.
+template<typename Key>
+class IdMap {
+public:
+    static constexpr index npos = ~index{0};
+    
+    explicit IdMap(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+    : ids(resource), shards(resource) {
+        shards.reserve(shardCount);
+        for (std::size_t s = 0; s < shardCount; ++s) {
+            shards.emplace_back(resource);
+        }
+    }
+    
+    index size() const {
+        return ids.size();
+    }
+    
+    // External id of node i.
+    Key const& id(index i) const {
+        return ids.at(i);
+    }
+    
+    // Room for n ids without rehashing.
+    void reserve(std::size_t n) {
+        ids.reserve(n);
+        for (auto& shard : shards) {
+            shard.reserve(*this, n / shardCount + 1);
+        }
+    }
+    
+    // Index of id, or npos if it was never inserted.
+    index find(Key const& id) const {
+        auto h = hashOf(id);
+        return shards[shardOf(h)].find(*this, id, h);
+    }
+    
+    bool contains(Key const& id) const {
+        return find(id) != npos;
+    }
+    
+    // Index of id; a new id gets the next free index.
+    index insert(Key const& id) {
+        auto h = hashOf(id);
+        auto& shard = shards[shardOf(h)];
+        auto slot = shard.findOrPrepare(*this, id, h);
+        if (shard.control[slot] == empty) {
+            shard.fill(slot, h, ids.size(), id);
+            ids.push_back(id);
+        }
+        return shard.slots[slot].value;
+    }
+    
+    // insert() for n ids, writing their indices to out. New ids are
+    // numbered in the order of their first occurrence in keys, as if
+    // inserted one by one, but the shards are built in parallel.
+    void insertAll(Key const* keys, std::size_t n, index* out) {
+        std::vector<hash_t> hashes(n);
+        parallelFor(0, n, [&](std::size_t lo, std::size_t hi) {
+            for (auto k = lo; k < hi; ++k) {
+                hashes[k] = hashOf(keys[k]);
+            }
+        });
+        auto order = partition(hashes);
+        // Per shard, in input order: known ids get their index, new ids
+        // the position of their first occurrence, marked as fresh. Shards
+        // grow up front, so the slots filled stay put until patched below.
+        std::vector<std::vector<std::size_t>> filled(shardCount);
+        parallelFor(0, shardCount, [&](std::size_t lo, std::size_t hi) {
+            for (auto s = lo; s < hi; ++s) {
+                auto& shard = shards[s];
+                shard.reserve(*this, shard.count + (order.begins[s + 1] - order.begins[s]));
+                for (auto k = order.begins[s]; k < order.begins[s + 1]; ++k) {
+                    auto pos = order.positions[k];
+                    auto slot = shard.findOrPrepare(*this, keys[pos], hashes[pos], keys);
+                    if (shard.control[slot] == empty) {
+                        shard.fill(slot, hashes[pos], fresh | pos, keys[pos]);
+                        filled[s].push_back(slot);
+                    }
+                    out[pos] = shard.slots[slot].value;
+                }
+            }
+        }, 1);
+        // Number the new ids in input order.
+        for (std::size_t k = 0; k < n; ++k) {
+            if (out[k] & fresh) {
+                auto first = out[k] & ~fresh;
+                if (first == k) {
+                    out[k] = ids.size();
+                    ids.push_back(keys[k]);
+                } else {
+                    out[k] = out[first];
+                }
+            }
+        }
+        // Only the slots filled above hold fresh positions, so this costs
+        // O(n) rather than O(capacity).
+        parallelFor(0, shardCount, [&](std::size_t lo, std::size_t hi) {
+            for (auto s = lo; s < hi; ++s) {
+                for (auto slot : filled[s]) {
+                    auto& value = shards[s].slots[slot].value;
+                    value = out[value & ~fresh];
+                }
+            }
+        }, 1);
+    }
+    
+    // find() for n ids, writing their indices or npos to out. Runs in
+    // parallel; each worker hashes a batch of ids and prefetches their
+    // groups before probing any of them.
+    void findAll(Key const* keys, std::size_t n, index* out) const {
+        constexpr std::size_t batch = 16;
+        parallelFor(0, n, [&](std::size_t lo, std::size_t hi) {
+            hash_t h[batch];
+            for (auto b = lo; b < hi; b += batch) {
+                auto m = std::min(batch, hi - b);
+                for (std::size_t k = 0; k < m; ++k) {
+                    h[k] = hashOf(keys[b + k]);
+                    shards[shardOf(h[k])].prefetch(h[k]);
+                }
+                for (std::size_t k = 0; k < m; ++k) {
+                    out[b + k] = shards[shardOf(h[k])].find(*this, keys[b + k], h[k]);
+                }
+            }
+        });
+    }
+    
+    std::size_t memoryUsage() const {
+        auto bytes = ids.capacity() * sizeof(Key);
+        for (auto& shard : shards) {
+            bytes += shard.control.capacity() + shard.slots.capacity() * sizeof(Slot);
+        }
+        return bytes;
+    }
+    
+private:
+    static constexpr std::size_t shardBits = 6;
+    static constexpr std::size_t shardCount = std::size_t{1} << shardBits;
+    static constexpr std::size_t groupSize = 16;
+    static constexpr std::uint8_t empty = 0x80;
+    static constexpr index fresh = ~(npos >> 1); // marks input positions in insertAll()
+    
+    // Small keys are kept in the slots as well, so that a probe compares
+    // them without another cache miss.
+    static constexpr bool inlineKeys = std::is_trivially_copyable_v<Key> && sizeof(Key) <= 16;
+    
+    struct IndexSlot {
+        index value = npos;
+    };
+    
+    struct KeySlot {
+        index value = npos;
+        Key key;
+    };
+    
+    using Slot = std::conditional_t<inlineKeys, KeySlot, IndexSlot>;
+    
+    // Bit k is set if control byte k of the group at p equals b.
+    static std::uint32_t matchByte(std::uint8_t const* p, std::uint8_t b) {
+#if defined(__SSE2__)
+        auto group = _mm_loadu_si128(reinterpret_cast<__m128i const*>(p));
+        return std::uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(char(b)))));
+#elif defined(__ARM_NEON)
+        static constexpr std::uint8_t bits[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+        auto eq = vandq_u8(vceqq_u8(vld1q_u8(p), vdupq_n_u8(b)), vld1q_u8(bits));
+        return std::uint32_t(vaddv_u8(vget_low_u8(eq))) | std::uint32_t(vaddv_u8(vget_high_u8(eq))) << 8;
+#else
+        std::uint32_t mask = 0;
+        for (std::size_t k = 0; k < groupSize; ++k) {
+            mask |= std::uint32_t(p[k] == b) << k;
+        }
+        return mask;
+#endif
+    }
+    
+    static hash_t hashOf(Key const& id) {
+        return mix64(ContentHash<Key>{}(id));
+    }
+    
+    static std::size_t shardOf(hash_t h) {
+        return h >> (64 - shardBits);
+    }
+    
+    static std::uint8_t tagOf(hash_t h) {
+        return std::uint8_t(h & 0x7f);
+    }
+    
+    // One open addressing table of 16-slot groups, at most 7/8 full.
+    // Slots hold the index of their id in ids (or, during insertAll(), a
+    // fresh position in its input).
+    struct Shard {
+        explicit Shard(std::pmr::memory_resource* resource)
+        : control(resource), slots(resource) { }
+        
+        std::size_t groups() const {
+            return control.size() / groupSize;
+        }
+        
+        void prefetch(hash_t h) const {
+            if (!control.empty()) {
+                auto g = (h >> 7) & (groups() - 1);
+                __builtin_prefetch(&control[g * groupSize]);
+                __builtin_prefetch(&slots[g * groupSize]);
+            }
+        }
+        
+        struct Probe {
+            std::size_t slot; // of the match, else the first empty slot seen
+            bool found;
+        };
+        
+        // Probes groups g, g + 1, g + 3, g + 6, ... which visits every
+        // group of a power-of-two table, until a match or an empty slot.
+        template<typename Match>
+        Probe probe(hash_t h, Match match) const {
+            auto mask = groups() - 1;
+            auto g = (h >> 7) & mask;
+            for (std::size_t step = 1;; g = (g + step++) & mask) {
+                auto group = &control[g * groupSize];
+                for (auto m = matchByte(group, tagOf(h)); m; m &= m - 1) {
+                    auto slot = g * groupSize + std::size_t(__builtin_ctz(m));
+                    if (match(slots[slot])) {
+                        return {slot, true};
+                    }
+                }
+                if (auto m = matchByte(group, empty)) {
+                    return {g * groupSize + std::size_t(__builtin_ctz(m)), false};
+                }
+            }
+        }
+        
+        index find(IdMap const& map, Key const& id, hash_t h) const {
+            if (control.empty()) {
+                return npos;
+            }
+            auto p = probe(h, [&](Slot const& slot) { return keyOf(map, slot, nullptr) == id; });
+            return p.found ? slots[p.slot].value : npos;
+        }
+        
+        // Slot of id, or the empty slot to put it in. pending holds the ids
+        // of fresh slots, see insertAll().
+        std::size_t findOrPrepare(IdMap const& map, Key const& id, hash_t h,
+                                  Key const* pending = nullptr) {
+            if ((count + 1) * 8 > groups() * groupSize * 7) {
+                grow(map, pending);
+            }
+            return probe(h, [&](Slot const& slot) { return keyOf(map, slot, pending) == id; }).slot;
+        }
+        
+        static Key const& keyOf(IdMap const& map, Slot const& slot, Key const* pending) {
+            if constexpr (inlineKeys) {
+                (void)map, (void)pending;
+                return slot.key;
+            } else {
+                return slot.value & fresh ? pending[slot.value & ~fresh] : map.ids[slot.value];
+            }
+        }
+        
+        void fill(std::size_t slot, hash_t h, index value, Key const& id) {
+            control[slot] = tagOf(h);
+            slots[slot].value = value;
+            if constexpr (inlineKeys) {
+                slots[slot].key = id;
+            } else {
+                (void)id;
+            }
+            ++count;
+        }
+        
+        void reserve(IdMap const& map, std::size_t n) {
+            while (n * 8 > groups() * groupSize * 7) {
+                grow(map, nullptr);
+            }
+        }
+        
+        // Doubles the table and reinserts every id.
+        void grow(IdMap const& map, Key const* pending) {
+            auto groupCount = std::max<std::size_t>(1, 2 * groups());
+            std::pmr::vector<std::uint8_t> oldControl(groupCount * groupSize, empty, control.get_allocator());
+            std::pmr::vector<Slot> oldSlots(groupCount * groupSize, Slot{}, slots.get_allocator());
+            control.swap(oldControl);
+            slots.swap(oldSlots);
+            for (std::size_t slot = 0; slot < oldControl.size(); ++slot) {
+                if (oldControl[slot] != empty) {
+                    auto h = hashOf(keyOf(map, oldSlots[slot], pending));
+                    auto free = probe(h, [](Slot const&) { return false; }).slot;
+                    control[free] = tagOf(h);
+                    slots[free] = oldSlots[slot];
+                }
+            }
+        }
+        
+        std::pmr::vector<std::uint8_t> control;
+        std::pmr::vector<Slot> slots;
+        std::size_t count = 0;
+    };
+    
+    // Input positions grouped by shard, in input order within a shard.
+    struct Partition {
+        std::vector<std::size_t> begins;
+        std::vector<std::size_t> positions;
+    };
+    
+    static Partition partition(std::vector<hash_t> const& hashes) {
+        auto n = hashes.size();
+        auto workers = std::max<std::size_t>(1, std::min<std::size_t>(parallelism(), n >> 14));
+        auto block = (n + workers - 1) / workers;
+        std::vector<std::size_t> counts(workers * shardCount);
+        parallelFor(0, workers, [&](std::size_t lo, std::size_t hi) {
+            for (auto t = lo; t < hi; ++t) {
+                for (auto k = t * block; k < std::min(n, (t + 1) * block); ++k) {
+                    ++counts[t * shardCount + shardOf(hashes[k])];
+                }
+            }
+        }, 1);
+        Partition p{std::vector<std::size_t>(shardCount + 1), std::vector<std::size_t>(n)};
+        std::size_t offset = 0;
+        for (std::size_t s = 0; s < shardCount; ++s) {
+            p.begins[s] = offset;
+            for (std::size_t t = 0; t < workers; ++t) {
+                auto c = counts[t * shardCount + s];
+                counts[t * shardCount + s] = offset;
+                offset += c;
+            }
+        }
+        p.begins[shardCount] = n;
+        parallelFor(0, workers, [&](std::size_t lo, std::size_t hi) {
+            for (auto t = lo; t < hi; ++t) {
+                for (auto k = t * block; k < std::min(n, (t + 1) * block); ++k) {
+                    p.positions[counts[t * shardCount + shardOf(hashes[k])]++] = k;
+                }
+            }
+        }, 1);
+        return p;
+    }
+    
+    std::pmr::vector<Key> ids; // by index
+    std::pmr::vector<Shard> shards;
+}; // class IdMap
+
+} // namespace Attributes
+
+#endif /* IdMap_h */
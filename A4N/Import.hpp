@@ -0,0 +1,353 @@
+//
+//  Import.hpp
+//  A4N
+//
+
+#ifndef Import_h
+#define Import_h
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <memory_resource>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "Attributes.hpp"
+#include "IdMap.hpp"
+#include "Parallel.hpp"
+#include "Parse.hpp"
+
+namespace Attributes {
+
+// Loads node files with many columns, e.g. "id color x y score label",
+// into several attributes in one pass. The file is read in large blocks;
+// every block is cut at line ends into one piece per worker, the pieces
+// are split into fields and parsed in parallel, and then every target
+// attribute is filled from all pieces at once, one attribute per worker
+// where that is safe (see TargetBase::concurrent), else one after another.
+// Values are parsed by ValueParser; an empty or malformed field leaves
+// its attribute unset for that node, a row without a valid id is skipped.
+// Without externalIds(), ids beyond maxNode() are not valid.
+// Later rows win over earlier rows for the same node.
+class DelimitedImporter {
+public:
+    struct Stats {
+        std::size_t rows = 0;           // rows with a valid id
+        std::size_t rejectedRows = 0;   // rows without one
+        std::size_t rejectedFields = 0; // malformed values
+    };
+    
+    // A delimiter of ' ' splits at every run of blanks and tabs.
+    explicit DelimitedImporter(NodeAttributeMap& map, char delimiter = '\t')
+    : map{map}, delimiter{delimiter} { }
+    
+    // Column of the node id, 0 by default.
+    DelimitedImporter& idColumn(std::size_t column) {
+        idField = column;
+        return *this;
+    }
+    
+    // Ids in the file are external ids, resolved (and added) through ids.
+    DelimitedImporter& externalIds(IdMap<std::uint64_t>& ids) {
+        this->ids = &ids;
+        return *this;
+    }
+    
+    // Largest node id accepted without externalIds(), defaultMaxNode
+    // unless given.
+    DelimitedImporter& maxNode(index node) {
+        largest = node;
+        return *this;
+    }
+    
+    DelimitedImporter& skipHeader(bool skip = true) {
+        header = skip;
+        return *this;
+    }
+    
+    DelimitedImporter& blockBytes(std::size_t bytes) {
+        block = std::max<std::size_t>(bytes, 1);
+        return *this;
+    }
+    
+    // Fills attribute from column, attaching it if the map has none of
+    // that name.
+    template<typename T>
+    DelimitedImporter& column(std::size_t column, std::string_view attribute) {
+        targets.push_back(std::make_unique<ColumnTarget<T>>(target<T>(attribute), column));
+        return *this;
+    }
+    
+    // Fills attribute with T{a, b} from two columns, e.g. a Point from x
+    // and y.
+    template<typename T, typename A = double, typename B = A>
+    DelimitedImporter& columns(std::size_t first, std::size_t second, std::string_view attribute) {
+        targets.push_back(std::make_unique<PairTarget<T, A, B>>(target<T>(attribute), first, second));
+        return *this;
+    }
+    
+    Stats import(std::string const& path) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            throw std::runtime_error("Cannot open '" + path + "' for reading");
+        }
+        return import(in);
+    }
+    
+    Stats import(std::istream& in) {
+        Stats stats;
+        std::string data, carry;
+        auto firstLine = header;
+        while (in) {
+            data.resize(block);
+            in.read(data.data(), std::streamsize(block));
+            data.resize(std::size_t(in.gcount()));
+            auto cut = in ? data.rfind('\n') : data.size();
+            if (cut == std::string::npos) {
+                carry += data;
+                continue;
+            }
+            carry.append(data, 0, in ? cut + 1 : data.size());
+            if (firstLine) {
+                auto eol = carry.find('\n');
+                carry.erase(0, eol == std::string::npos ? carry.size() : eol + 1);
+                firstLine = false;
+            }
+            importBlock(carry, stats);
+            carry.assign(data, in ? cut + 1 : data.size(), std::string::npos);
+        }
+        if (!carry.empty()) {
+            importBlock(carry, stats);
+        }
+        return stats;
+    }
+    
+private:
+    // One piece of a block, parsed by one worker.
+    struct Piece {
+        char* begin;
+        char* end;
+        std::vector<std::uint64_t> ids; // of its rows, in order
+        std::size_t rejectedRows = 0;
+        std::size_t rejectedFields = 0;
+    };
+    
+    struct TargetBase {
+        virtual ~TargetBase() = default;
+        virtual void prepare(std::size_t pieces) = 0;
+        // Parses the fields of row r of piece p; false if malformed.
+        virtual bool parse(std::size_t p, std::size_t r, std::vector<std::string_view> const& fields) = 0;
+        // Sets the parsed values; nodes[p][r] is the node of row r of piece p.
+        virtual void install(std::vector<std::vector<index>> const& nodes) = 0;
+        // Whether storage, the target attribute, may be installed while
+        // other targets are: it has no mirrors and allocates only from the
+        // default resource and the stateless column resources.
+        virtual bool concurrent(NodeAttributeStorageBase const& storage) const = 0;
+    };
+    
+    template<typename T>
+    struct TypedTarget : TargetBase {
+        explicit TypedTarget(NodeAttribute<T> attribute)
+        : attribute{std::move(attribute)} { }
+        
+        void prepare(std::size_t pieces) override {
+            values.assign(pieces, {});
+        }
+        
+        void install(std::vector<std::vector<index>> const& nodes) override {
+            for (std::size_t p = 0; p < values.size(); ++p) {
+                for (auto& [r, v] : values[p]) {
+                    attribute.set(nodes[p][r], std::move(v));
+                }
+            }
+            values.clear();
+        }
+        
+        bool concurrent(NodeAttributeStorageBase const& storage) const override {
+            auto typed = dynamic_cast<NodeAttributeStorage<T> const*>(&storage);
+            return typed && !typed->hasMirrors()
+                && typed->getResource() == std::pmr::get_default_resource()
+                && dynamic_cast<ColumnResource*>(typed->column().getResource());
+        }
+        
+        NodeAttribute<T> attribute;
+        std::vector<std::vector<std::pair<std::size_t, T>>> values; // per piece: row, value
+    };
+    
+    template<typename T>
+    struct ColumnTarget : TypedTarget<T> {
+        ColumnTarget(NodeAttribute<T> attribute, std::size_t field)
+        : TypedTarget<T>{std::move(attribute)}, field{field} { }
+        
+        bool parse(std::size_t p, std::size_t r, std::vector<std::string_view> const& row) override {
+            if (field >= row.size() || row[field].empty()) {
+                return true;
+            }
+            T v{};
+            if (!ValueParser<T>::parse(row[field].data(), row[field].data() + row[field].size(), v)) {
+                return false;
+            }
+            this->values[p].emplace_back(r, std::move(v));
+            return true;
+        }
+        
+        std::size_t field;
+    };
+    
+    template<typename T, typename A, typename B>
+    struct PairTarget : TypedTarget<T> {
+        PairTarget(NodeAttribute<T> attribute, std::size_t first, std::size_t second)
+        : TypedTarget<T>{std::move(attribute)}, first{first}, second{second} { }
+        
+        bool parse(std::size_t p, std::size_t r, std::vector<std::string_view> const& row) override {
+            if (std::max(first, second) >= row.size() || row[first].empty() || row[second].empty()) {
+                return true;
+            }
+            A a{};
+            B b{};
+            if (!ValueParser<A>::parse(row[first].data(), row[first].data() + row[first].size(), a)
+                || !ValueParser<B>::parse(row[second].data(), row[second].data() + row[second].size(), b)) {
+                return false;
+            }
+            this->values[p].emplace_back(r, T{std::move(a), std::move(b)});
+            return true;
+        }
+        
+        std::size_t first;
+        std::size_t second;
+    };
+    
+    template<typename T>
+    NodeAttribute<T> target(std::string_view attribute) {
+        names.emplace_back(attribute);
+        return map.contains(attribute) ? map.get<T>(attribute) : map.attach<T>(attribute);
+    }
+    
+    // Parses all complete lines in data, then installs them.
+    void importBlock(std::string& data, Stats& stats) {
+        auto workers = std::max<std::size_t>(1, std::min<std::size_t>(parallelism(), data.size() >> 16));
+        std::vector<Piece> pieces;
+        auto begin = data.data(), end = begin + data.size();
+        for (std::size_t w = 0; w < workers && begin != end; ++w) {
+            auto cut = w + 1 == workers ? end : std::min(end, begin + data.size() / workers);
+            cut = std::find(cut, end, '\n');
+            cut = cut == end ? end : cut + 1;
+            pieces.push_back(Piece{begin, cut, {}, 0, 0});
+            begin = cut;
+        }
+        for (auto& t : targets) {
+            t->prepare(pieces.size());
+        }
+        parallelFor(0, pieces.size(), [&](std::size_t lo, std::size_t hi) {
+            for (auto p = lo; p < hi; ++p) {
+                parsePiece(p, pieces[p]);
+            }
+        }, 1);
+        std::vector<std::vector<index>> nodes(pieces.size());
+        for (std::size_t p = 0; p < pieces.size(); ++p) {
+            auto& piece = pieces[p];
+            nodes[p].resize(piece.ids.size());
+            if (ids) {
+                ids->insertAll(piece.ids.data(), piece.ids.size(), nodes[p].data());
+            } else {
+                std::copy(piece.ids.begin(), piece.ids.end(), nodes[p].begin());
+            }
+            stats.rows += piece.ids.size();
+            stats.rejectedRows += piece.rejectedRows;
+            stats.rejectedFields += piece.rejectedFields;
+        }
+        // Attributes are independent, but a transaction logs to one undo
+        // log, two targets may fill the same attribute, mirrors are not
+        // synchronised, and a custom resource need not be thread-safe.
+        auto sorted = names;
+        std::sort(sorted.begin(), sorted.end());
+        auto shared = map.isInTransaction() || std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end();
+        for (std::size_t t = 0; t < targets.size() && !shared; ++t) {
+            shared = !targets[t]->concurrent(*map.findStorage(names[t]));
+        }
+        parallelFor(0, targets.size(), [&](std::size_t lo, std::size_t hi) {
+            for (auto t = lo; t < hi; ++t) {
+                targets[t]->install(nodes);
+            }
+        }, shared ? targets.size() : 1);
+    }
+    
+    void parsePiece(std::size_t p, Piece& piece) {
+        std::vector<std::string_view> fields;
+        for (auto line = piece.begin; line != piece.end;) {
+            auto eol = std::find(line, piece.end, '\n');
+            auto next = eol == piece.end ? eol : eol + 1;
+            if (eol != line && eol[-1] == '\r') {
+                --eol;
+            }
+            if (eol != line && *line != '#') {
+                split(line, eol, fields);
+                std::uint64_t id = 0;
+                auto field = idField < fields.size() ? fields[idField] : std::string_view{};
+                auto [ptr, ec] = std::from_chars(field.data(), field.data() + field.size(), id);
+                if (field.empty() || ec != std::errc{} || ptr != field.data() + field.size()
+                    || (!ids && id > largest)) {
+                    ++piece.rejectedRows;
+                } else {
+                    auto r = piece.ids.size();
+                    piece.ids.push_back(id);
+                    for (auto& t : targets) {
+                        piece.rejectedFields += !t->parse(p, r, fields);
+                    }
+                }
+            }
+            line = next;
+        }
+    }
+    
+    // Splits [begin, end) into fields, each followed by a NUL written over
+    // its delimiter (see ValueParser).
+    void split(char* begin, char* end, std::vector<std::string_view>& fields) {
+        fields.clear();
+        auto blank = [](char c) { return c == ' ' || c == '\t'; };
+        if (delimiter == ' ') {
+            while (begin != end && blank(*begin)) {
+                ++begin;
+            }
+        }
+        while (true) {
+            auto stop = delimiter == ' ' ? std::find_if(begin, end, blank) : std::find(begin, end, delimiter);
+            fields.emplace_back(begin, std::size_t(stop - begin));
+            if (stop == end) {
+                *stop = '\0';
+                return;
+            }
+            *stop = '\0';
+            begin = stop + 1;
+            if (delimiter == ' ') {
+                while (begin != end && blank(*begin)) {
+                    ++begin;
+                }
+                if (begin == end) {
+                    return;
+                }
+            }
+        }
+    }
+    
+    NodeAttributeMap& map;
+    char delimiter;
+    std::size_t idField = 0;
+    IdMap<std::uint64_t>* ids = nullptr;
+    index largest = defaultMaxNode;
+    bool header = false;
+    std::size_t block = std::size_t{64} << 20;
+    std::vector<std::unique_ptr<TargetBase>> targets;
+    std::vector<std::string> names; // of the target attributes
+}; // class DelimitedImporter
+
+} // namespace Attributes
+
+#endif /* Import_h */
@@ -0,0 +1,333 @@
+//
+//  Ingest.hpp
+//  A4N
+//
+
+#ifndef Ingest_h
+#define Ingest_h
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <istream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include "Attributes.hpp"
+#include "IdMap.hpp"
+#include "Parse.hpp"
+#include "Queue.hpp"
+
+namespace Attributes {
+
+// Applies an unbounded stream of "node value" lines, e.g. from a pipe, to
+// one attribute. Three stages run concurrently: a reader fills two
+// buffers in turn, a parser turns each filled buffer into records while
+// the reader fills the other one, and the calling thread applies the
+// records in batches. A batch is sorted by node and deduplicated, the
+// last write to a node winning, so its writes are applied in index order.
+// Both hand-offs are bounded queues, so a slow consumer stalls the reader
+// instead of buffering without limit. Lines that do not parse or name a
+// node beyond Options::maxNode are counted and skipped. With Options::ids,
+// nodes are external ids, resolved (and added) batch by batch on the
+// calling thread; maxNode does not apply to them.
+template<typename T>
+class StreamIngester {
+public:
+    struct Options {
+        std::size_t bufferBytes = std::size_t{1} << 20; // per read buffer
+        std::size_t batchSize = std::size_t{1} << 16;   // records per batch at most
+        std::size_t queuedBatches = 4;                  // parsed, not yet applied
+        index maxNode = defaultMaxNode;                 // larger nodes are rejected
+        IdMap<std::uint64_t>* ids = nullptr;            // external ids, if given
+    };
+    
+    explicit StreamIngester(NodeAttribute<T> target, Options options = {})
+    : target{std::move(target)}, options{options} { }
+    
+    StreamIngester(StreamIngester const&) = delete;
+    StreamIngester& operator=(StreamIngester const&) = delete;
+    
+    // Ingests from the file descriptor fd, e.g. STDIN_FILENO, until end of
+    // file. read(2) returns whatever a pipe holds, so records are applied
+    // while the stream is still open. The reader waits in poll(2) on fd and
+    // on a wake-up pipe, so a failing apply does not leave it blocked on an
+    // idle stream.
+    void run(int fd) {
+        WakePipe wake;
+        run([fd, &wake](char* data, std::size_t n) -> std::size_t {
+            while (true) {
+                pollfd fds[2] = {{fd, POLLIN, 0}, {wake.fds[0], POLLIN, 0}};
+                if (::poll(fds, 2, -1) < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    throw std::runtime_error("Cannot wait for update stream");
+                }
+                if (fds[1].revents) {
+                    return 0;
+                }
+                auto got = ::read(fd, data, n);
+                if (got >= 0) {
+                    return std::size_t(got);
+                }
+                if (errno != EINTR && errno != EAGAIN) {
+                    throw std::runtime_error("Cannot read update stream");
+                }
+            }
+        }, [&wake] { wake.signal(); });
+    }
+    
+    // Ingests from in until end of stream; every read fills a whole
+    // buffer unless the stream ends. A read blocked in the stream is not
+    // interrupted if applying fails; run(int) is for streams that may idle.
+    void run(std::istream& in) {
+        run([&in](char* data, std::size_t n) {
+            in.read(data, std::streamsize(n));
+            return std::size_t(in.gcount());
+        });
+    }
+    
+    // Metrics, readable from other threads while run() is busy.
+    std::size_t records() const {
+        return parsed;
+    }
+    
+    // Updates applied after deduplication.
+    std::size_t applied() const {
+        return written;
+    }
+    
+    std::size_t rejected() const {
+        return malformed;
+    }
+    
+    std::size_t batches() const {
+        return batchCount;
+    }
+    
+    // Applied updates per second of the last or running run().
+    double updatesPerSecond() const {
+        auto end = running ? Clock::now().time_since_epoch().count() : stopped.load();
+        auto seconds = std::chrono::duration<double>(Clock::duration{end - started}).count();
+        return seconds > 0 ? double(written) / seconds : 0;
+    }
+    
+private:
+    using Clock = std::chrono::steady_clock;
+    struct Buffer {
+        std::vector<char> bytes;
+        std::size_t length = 0;
+    };
+    using Batch = std::vector<std::pair<index, T>>;
+    
+    // Self-pipe that wakes a reader waiting in poll(2).
+    struct WakePipe {
+        WakePipe() {
+            if (::pipe(fds) != 0) {
+                throw std::runtime_error("Cannot create wake-up pipe");
+            }
+        }
+        WakePipe(WakePipe const&) = delete;
+        WakePipe& operator=(WakePipe const&) = delete;
+        ~WakePipe() {
+            ::close(fds[0]);
+            ::close(fds[1]);
+        }
+        void signal() {
+            char c = 0;
+            while (::write(fds[1], &c, 1) < 0 && errno == EINTR) { }
+        }
+        int fds[2];
+    };
+    
+    // read(data, n) returns the bytes read, 0 at the end; interrupt, if
+    // given, makes a blocked read return.
+    void run(std::function<std::size_t(char*, std::size_t)> read, std::function<void()> interrupt = {}) {
+        BoundedQueue<Buffer> free{2}, filled{2};
+        BoundedQueue<Batch> ready{options.queuedBatches};
+        for (int b = 0; b < 2; ++b) {
+            free.push(Buffer{std::vector<char>(options.bufferBytes), 0});
+        }
+        parsed = written = malformed = batchCount = 0;
+        started = Clock::now().time_since_epoch().count();
+        running = true;
+        std::exception_ptr readerError, parserError;
+        auto stop = [&] {
+            free.close();
+            filled.close();
+            ready.close();
+            if (interrupt) {
+                interrupt();
+            }
+        };
+        std::thread reader([&] {
+            try {
+                while (auto buffer = free.pop()) {
+                    buffer->length = read(buffer->bytes.data(), options.bufferBytes);
+                    if (buffer->length == 0) {
+                        break;
+                    }
+                    if (!filled.push(std::move(*buffer))) {
+                        break;
+                    }
+                }
+            } catch (...) {
+                readerError = std::current_exception();
+            }
+            filled.close();
+        });
+        std::thread parser([&] {
+            try {
+                parse(free, filled, ready);
+            } catch (...) {
+                parserError = std::current_exception();
+                stop();
+            }
+            ready.close();
+        });
+        std::exception_ptr applyError;
+        try {
+            while (auto batch = ready.pop()) {
+                apply(*batch);
+            }
+        } catch (...) {
+            applyError = std::current_exception();
+            stop();
+        }
+        reader.join();
+        parser.join();
+        stopped = Clock::now().time_since_epoch().count();
+        running = false;
+        for (auto error : {applyError, parserError, readerError}) {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+    }
+    
+    void parse(BoundedQueue<Buffer>& free, BoundedQueue<Buffer>& filled, BoundedQueue<Batch>& ready) {
+        Batch batch;
+        std::string carry; // unfinished line of the previous buffer
+        auto flush = [&] {
+            if (!batch.empty()) {
+                ready.push(std::move(batch));
+                batch = Batch{};
+            }
+        };
+        while (auto buffer = filled.pop()) {
+            auto begin = buffer->bytes.data(), end = begin + buffer->length;
+            while (begin != end) {
+                auto newline = std::find(begin, end, '\n');
+                if (newline == end) {
+                    carry.append(begin, end);
+                    break;
+                }
+                *newline = '\0';
+                if (carry.empty()) {
+                    parseLine(begin, newline, batch);
+                } else {
+                    carry.append(begin, newline);
+                    parseLine(carry.data(), carry.data() + carry.size(), batch);
+                    carry.clear();
+                }
+                if (batch.size() >= options.batchSize) {
+                    flush();
+                }
+                begin = newline + 1;
+            }
+            free.push(std::move(*buffer));
+            // Do not hold back records while the stream is idle.
+            if (filled.size() == 0) {
+                flush();
+            }
+        }
+        if (!carry.empty()) {
+            parseLine(carry.data(), carry.data() + carry.size(), batch);
+        }
+        flush();
+    }
+    
+    // One "node value" line, NUL-terminated at end.
+    void parseLine(char* begin, char* end, Batch& batch) {
+        auto space = [](char c) { return c == ' ' || c == '\t' || c == '\r'; };
+        while (end != begin && space(end[-1])) {
+            *--end = '\0';
+        }
+        while (begin != end && space(*begin)) {
+            ++begin;
+        }
+        if (begin == end) {
+            return;
+        }
+        index node = 0;
+        auto [ptr, ec] = std::from_chars(begin, end, node);
+        auto value = ptr;
+        while (value != end && space(*value)) {
+            ++value;
+        }
+        T v{};
+        if (ec != std::errc{} || value == ptr || (!options.ids && node > options.maxNode)
+            || !ValueParser<T>::parse(value, end, v)) {
+            ++malformed;
+            return;
+        }
+        batch.emplace_back(node, std::move(v));
+        ++parsed;
+    }
+    
+    void apply(Batch& batch) {
+        if (options.ids) {
+            resolve(batch);
+        }
+        std::stable_sort(batch.begin(), batch.end(),
+                         [](auto& a, auto& b) { return a.first < b.first; });
+        std::size_t n = 0;
+        for (std::size_t k = 0; k < batch.size(); ++k) {
+            if (k + 1 == batch.size() || batch[k + 1].first != batch[k].first) {
+                target.set(batch[k].first, std::move(batch[k].second));
+                ++n;
+            }
+        }
+        written += n;
+        ++batchCount;
+    }
+    
+    // Replaces the external ids of batch by their node indices.
+    void resolve(Batch& batch) {
+        std::vector<std::uint64_t> keys(batch.size());
+        std::vector<index> nodes(batch.size());
+        for (std::size_t k = 0; k < batch.size(); ++k) {
+            keys[k] = batch[k].first;
+        }
+        options.ids->insertAll(keys.data(), keys.size(), nodes.data());
+        for (std::size_t k = 0; k < batch.size(); ++k) {
+            batch[k].first = nodes[k];
+        }
+    }
+    
+    NodeAttribute<T> target;
+    Options options;
+    std::atomic<std::size_t> parsed{0};
+    std::atomic<std::size_t> written{0};
+    std::atomic<std::size_t> malformed{0};
+    std::atomic<std::size_t> batchCount{0};
+    std::atomic<Clock::rep> started{0};
+    std::atomic<Clock::rep> stopped{0};
+    std::atomic<bool> running{false};
+}; // class StreamIngester
+
+} // namespace Attributes
+
+#endif /* Ingest_h */
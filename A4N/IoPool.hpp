@@ -0,0 +1,94 @@
+//
+//  IoPool.hpp
+//  A4N
+//
+
+#ifndef IoPool_h
+#define IoPool_h
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "Parallel.hpp"
+
+namespace Attributes {
+
+// Fixed set of threads running the stages of asynchronous loads and saves
+// (see NodeAttributeMap::saveAsync() and loadAsync()). Tasks run in FIFO
+// order and must not wait for each other, or a small pool deadlocks: a
+// stage that depends on several tasks is run by the last of them to
+// finish. The destructor runs the queued tasks, then joins.
+class IoPool {
+public:
+    explicit IoPool(unsigned threads) {
+        for (unsigned t = 0; t < std::max(threads, 1u); ++t) {
+            workers.emplace_back([this] { work(); });
+        }
+    }
+    
+    IoPool(IoPool const&) = delete;
+    IoPool& operator=(IoPool const&) = delete;
+    
+    ~IoPool() {
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            stopping = true;
+        }
+        ready.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+    
+    // Pool of the map functions; at least two threads, so that reading
+    // overlaps decoding even on one core.
+    static IoPool& shared() {
+        static IoPool pool{std::max(parallelism(), 2u)};
+        return pool;
+    }
+    
+    void submit(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            tasks.push_back(std::move(task));
+        }
+        ready.notify_one();
+    }
+    
+    std::size_t size() const {
+        return workers.size();
+    }
+    
+private:
+    void work() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock{mutex};
+                ready.wait(lock, [&] { return stopping || !tasks.empty(); });
+                if (tasks.empty()) {
+                    return;
+                }
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+    
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    bool stopping = false;
+    std::mutex mutex;
+    std::condition_variable ready;
+}; // class IoPool
+
+} // namespace Attributes
+
+#endif /* IoPool_h */
@@ -0,0 +1,212 @@
+//
+//  MappedFile.hpp
+//  A4N
+//
+
+#ifndef MappedFile_h
+#define MappedFile_h
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Attributes.hpp"
+#include "SharedMemory.hpp"
+
+namespace Attributes {
+
+// One attribute kept in a regular file mapped shared, so that writes go
+// straight to the page cache and the values survive restarts without a
+// save. The layout is that of SharedSegment plus a maximum capacity: the
+// validity words and the values have room for maxCapacity nodes, and all
+// of it is mapped up front, but the file only covers capacity nodes and
+// grows by ftruncate. Growing therefore never moves values, and the parts
+// not yet written are holes in the file. flush() forces pages to disk.
+class MappedFile {
+public:
+    static constexpr char magic[8] = {'A', '4', 'N', 'M', 'A', 'P', '0', '1'};
+    
+    struct Header {
+        char magic[8];
+        std::uint64_t valueSize;
+        std::uint64_t typeHash;    // of the typeid name of the values
+        std::uint64_t capacity;    // nodes the file holds
+        std::uint64_t maxCapacity; // nodes it may grow to
+        std::uint64_t validityOffset;
+        std::uint64_t valuesOffset;
+    };
+    
+    // Creates the file at path, replacing one that exists, holding
+    // capacity values of the given size and growable to maxCapacity.
+    static std::shared_ptr<MappedFile> create(std::string const& path, std::size_t valueSize,
+                                              hash_t typeHash, index capacity, index maxCapacity) {
+        Header h{};
+        std::memcpy(h.magic, magic, sizeof(magic));
+        h.valueSize = valueSize;
+        h.typeHash = typeHash;
+        h.capacity = std::min(capacity, maxCapacity);
+        h.maxCapacity = maxCapacity;
+        h.validityOffset = sizeof(Header);
+        auto words = (maxCapacity + Bitmap::wordBits - 1) / Bitmap::wordBits;
+        h.valuesOffset = align(h.validityOffset + words * sizeof(Bitmap::word));
+        int fd = ::open(path.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot create attribute file '" + path + "'");
+        }
+        if (ftruncate(fd, off_t(h.valuesOffset + h.capacity * valueSize)) != 0) {
+            close(fd);
+            throw std::runtime_error("Cannot size attribute file '" + path + "'");
+        }
+        auto file = std::shared_ptr<MappedFile>{new MappedFile{fd, spanOf(h), false}};
+        std::memcpy(file->base, &h, sizeof(h));
+        return file;
+    }
+    
+    // Maps the existing file at path, read-only unless writable.
+    static std::shared_ptr<MappedFile> open(std::string const& path, bool writable = true) {
+        int fd = ::open(path.c_str(), writable ? O_RDWR : O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open attribute file '" + path + "'");
+        }
+        struct stat st;
+        Header h{};
+        if (fstat(fd, &st) != 0 || std::size_t(st.st_size) < sizeof(Header)
+            || pread(fd, &h, sizeof(h), 0) != ssize_t(sizeof(h))
+            || std::memcmp(h.magic, magic, sizeof(magic))
+            || h.capacity > h.maxCapacity
+            || h.valuesOffset + h.capacity * h.valueSize > std::uint64_t(st.st_size)) {
+            close(fd);
+            throw std::runtime_error("Not a mapped attribute file");
+        }
+        return std::shared_ptr<MappedFile>{new MappedFile{fd, spanOf(h), !writable}};
+    }
+    
+    MappedFile(MappedFile const&) = delete;
+    MappedFile& operator=(MappedFile const&) = delete;
+    
+    ~MappedFile() {
+        munmap(base, span);
+        close(fd);
+    }
+    
+    Header const& header() const {
+        return *static_cast<Header const*>(base);
+    }
+    
+    void* at(std::uint64_t offset) const {
+        return static_cast<char*>(base) + offset;
+    }
+    
+    bool isReadOnly() const {
+        return readOnly;
+    }
+    
+    index capacity() const {
+        return header().capacity;
+    }
+    
+    // Grows the file to hold at least n nodes, doubling the capacity up to
+    // maxCapacity; returns the new capacity.
+    index grow(index n) {
+        auto& h = *static_cast<Header*>(base);
+        if (n <= h.capacity) {
+            return h.capacity;
+        }
+        if (readOnly || n > h.maxCapacity) {
+            throw std::runtime_error("Attribute cannot grow beyond its external memory");
+        }
+        auto capacity = std::min<std::uint64_t>(h.maxCapacity, std::max<std::uint64_t>(n, 2 * h.capacity));
+        if (ftruncate(fd, off_t(h.valuesOffset + capacity * h.valueSize)) != 0) {
+            throw std::runtime_error("Cannot grow attribute file");
+        }
+        h.capacity = capacity;
+        return capacity;
+    }
+    
+    // Writes the values of nodes [first, last) and their validity bits
+    // back to the file, O(pages in the range), and waits for the disk.
+    void flush(index first, index last) const {
+        auto& h = header();
+        last = std::min<index>(last, h.capacity);
+        if (first >= last) {
+            return;
+        }
+        sync(h.validityOffset + first / Bitmap::wordBits * sizeof(Bitmap::word),
+             h.validityOffset + (last + Bitmap::wordBits - 1) / Bitmap::wordBits * sizeof(Bitmap::word));
+        sync(h.valuesOffset + first * h.valueSize, h.valuesOffset + last * h.valueSize);
+    }
+    
+    // Writes everything back, including the header.
+    void flush() const {
+        sync(0, sizeof(Header));
+        flush(0, capacity());
+    }
+    
+private:
+    // Offsets within the file are aligned for every common page size.
+    static constexpr std::uint64_t alignment = std::uint64_t{1} << 16;
+    
+    static std::uint64_t align(std::uint64_t offset) {
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+    
+    static std::size_t spanOf(Header const& h) {
+        return std::size_t(h.valuesOffset + h.maxCapacity * h.valueSize);
+    }
+    
+    MappedFile(int fd, std::size_t span, bool readOnly)
+    : fd{fd}, span{std::max<std::size_t>(span, sizeof(Header))}, readOnly{readOnly} {
+        base = mmap(nullptr, this->span, readOnly ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("Cannot map attribute file");
+        }
+    }
+    
+    // msync of the pages overlapping [begin, end).
+    void sync(std::uint64_t begin, std::uint64_t end) const {
+        static auto const page = std::uint64_t(sysconf(_SC_PAGESIZE));
+        begin = begin / page * page;
+        end = std::min<std::uint64_t>((end + page - 1) / page * page, span);
+        if (begin < end && msync(at(begin), std::size_t(end - begin), MS_SYNC) != 0) {
+            throw std::runtime_error("Cannot flush attribute file");
+        }
+    }
+    
+    int fd;
+    void* base;
+    std::size_t span;
+    bool readOnly;
+}; // class MappedFile
+
+// Attaches an attribute whose validity and values live in file; set()
+// writes through to it and growing extends it (see MappedFile::grow()).
+// Read-only files throw on every write. Clones of the map copy the
+// values, so writes keep going to the file while clones exist.
+template<typename T>
+auto attachMappedFile(NodeAttributeMap& map, std::string_view name, std::shared_ptr<MappedFile> file) {
+    static_assert(std::is_trivially_copyable_v<T>, "mapped attributes hold trivially copyable values");
+    auto& h = file->header();
+    if (h.valueSize != sizeof(T) || h.typeHash != sharedTypeHash<T>()) {
+        throw std::runtime_error("Type mismatch in mapped attribute");
+    }
+    auto storage = map.attachStorage<NodeAttributeStorage<T>>(name);
+    auto validity = static_cast<Bitmap::word*>(file->at(h.validityOffset));
+    auto values = static_cast<T*>(file->at(h.valuesOffset));
+    auto readOnly = file->isReadOnly();
+    auto grow = [f = file.get()](index n) { return f->grow(n); };
+    storage->adopt(std::move(file), validity, values, h.capacity, readOnly, grow);
+    return NodeAttribute<T>{storage};
+}
+
+} // namespace Attributes
+
+#endif /* MappedFile_h */
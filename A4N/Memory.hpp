@@ -0,0 +1,258 @@
+//
+//  Memory.hpp
+//  A4N
+//
+
+#ifndef Memory_h
+#define Memory_h
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace Attributes {
+
+// Placement of large column allocations across NUMA nodes.
+enum class NumaPolicy {
+    Default,    // whatever the process policy is (usually first touch)
+    Local,      // the node of the thread that touches a page first
+    Interleave, // round robin over all online nodes
+    Bind        // the node given to the resource, see nodeResource()
+};
+
+// Page size used for large column allocations.
+enum class HugePages {
+    None,        // base pages
+    Transparent, // 2 MiB aligned mappings advised with MADV_HUGEPAGE
+    Explicit     // MAP_HUGETLB from the reserved pool, base pages if it is empty
+};
+
+// Memory resource for attribute columns. Every allocation is at least
+// cacheLine aligned, so SIMD loads never split a line at a chunk start.
+// Allocations of at least mapThreshold bytes are mapped directly, so their
+// pages are untouched until the column initialises them (see
+// Column::resize), and carry the NUMA policy via mbind(2) and the huge
+// page mode. Both are ignored on systems without mbind and huge pages.
+class ColumnResource : public std::pmr::memory_resource {
+public:
+    static constexpr std::size_t cacheLine = 64;
+    static constexpr std::size_t mapThreshold = std::size_t{1} << 16;
+    static constexpr std::size_t hugePageSize = std::size_t{1} << 21;
+    
+    explicit ColumnResource(NumaPolicy numa = NumaPolicy::Default,
+                            HugePages hugePages = HugePages::None, int node = 0)
+    : numa{numa}, hugePages{hugePages}, node{node} { }
+    
+    NumaPolicy getNumaPolicy() const {
+        return numa;
+    }
+    
+    int getNode() const {
+        return node;
+    }
+    
+    HugePages getHugePages() const {
+        return hugePages;
+    }
+    
+private:
+    void* do_allocate(std::size_t bytes, std::size_t align) override {
+        if (bytes < mapThreshold) {
+            return ::operator new(bytes, std::align_val_t{std::max(align, cacheLine)});
+        }
+        auto length = mappedLength(bytes);
+        void* p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+        if (hugePages == HugePages::Explicit) {
+            p = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        }
+#endif
+        if (p == MAP_FAILED) {
+            p = mapAligned(length, hugePages == HugePages::None ? 0 : hugePageSize);
+        }
+#ifdef MADV_HUGEPAGE
+        if (hugePages == HugePages::Transparent) {
+            madvise(p, length, MADV_HUGEPAGE);
+        }
+#endif
+        bind(p, length);
+        return p;
+    }
+    
+    void do_deallocate(void* p, std::size_t bytes, std::size_t align) override {
+        if (bytes < mapThreshold) {
+            ::operator delete(p, std::align_val_t{std::max(align, cacheLine)});
+        } else {
+            munmap(p, mappedLength(bytes));
+        }
+    }
+    
+    std::size_t mappedLength(std::size_t bytes) const {
+        auto granule = hugePages == HugePages::None ? std::size_t{4096} : hugePageSize;
+        return (bytes + granule - 1) / granule * granule;
+    }
+    
+    // Maps length bytes at an address aligned to align (if non-zero)
+    // by trimming an oversized mapping.
+    static void* mapAligned(std::size_t length, std::size_t align) {
+        auto p = mmap(nullptr, length + align, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        if (!align) {
+            return p;
+        }
+        auto base = reinterpret_cast<std::uintptr_t>(p);
+        auto aligned = (base + align - 1) / align * align;
+        if (aligned > base) {
+            munmap(p, aligned - base);
+        }
+        if (base + align > aligned) {
+            munmap(reinterpret_cast<void*>(aligned + length), base + align - aligned);
+        }
+        return reinterpret_cast<void*>(aligned);
+    }
+    
+    bool do_is_equal(std::pmr::memory_resource const& other) const noexcept override {
+        return this == &other;
+    }
+    
+    void bind(void* p, std::size_t bytes) {
+#ifdef __linux__
+        constexpr int mpolBind = 2, mpolInterleave = 3, mpolLocal = 4; // <numaif.h>
+        if (numa == NumaPolicy::Bind) {
+            unsigned long nodes = 1UL << node;
+            syscall(SYS_mbind, p, bytes, mpolBind, &nodes, sizeof(nodes) * 8, 0);
+        } else if (numa == NumaPolicy::Local) {
+            syscall(SYS_mbind, p, bytes, mpolLocal, nullptr, 0, 0);
+        } else if (numa == NumaPolicy::Interleave) {
+            auto nodes = onlineNodes();
+            syscall(SYS_mbind, p, bytes, mpolInterleave, &nodes, sizeof(nodes) * 8, 0);
+        }
+#else
+        (void)p;
+        (void)bytes;
+#endif
+    }
+    
+#ifdef __linux__
+    // Mask of online nodes from sysfs, e.g. "0-1" or "0,2".
+    static unsigned long onlineNodes() {
+        unsigned long mask = 0;
+        std::ifstream in("/sys/devices/system/node/online");
+        unsigned long lo, hi;
+        char sep;
+        while (in >> lo) {
+            hi = lo;
+            if (in.peek() == '-') {
+                in >> sep >> hi;
+            }
+            for (auto n = lo; n <= hi && n < sizeof(mask) * 8; ++n) {
+                mask |= 1UL << n;
+            }
+            if (in.peek() == ',') {
+                in >> sep;
+            }
+        }
+        return mask ? mask : 1;
+    }
+#endif
+    
+    NumaPolicy numa;
+    HugePages hugePages;
+    int node; // for NumaPolicy::Bind
+}; // class ColumnResource
+
+// Shared resources that bind allocations to one NUMA node, e.g. to pin
+// the shard of a ShardedNodeAttributeStorage to the node processing it.
+inline ColumnResource* nodeResource(int node, HugePages hugePages = HugePages::None) {
+    constexpr int maxNodes = 64;
+    static auto resources = [] {
+        std::array<std::unique_ptr<ColumnResource>, maxNodes * 3> r;
+        for (int n = 0; n < maxNodes; ++n) {
+            for (int h = 0; h < 3; ++h) {
+                r[n * 3 + h] = std::make_unique<ColumnResource>(NumaPolicy::Bind, HugePages(h), n);
+            }
+        }
+        return r;
+    }();
+    if (node < 0 || node >= maxNodes) {
+        throw std::runtime_error("No such NUMA node");
+    }
+    return resources[node * 3 + static_cast<int>(hugePages)].get();
+}
+
+// Shared resources, one per combination of NUMA policy and page size;
+// NumaPolicy::Bind binds to node 0.
+inline ColumnResource* columnResource(NumaPolicy numa = NumaPolicy::Default,
+                                      HugePages hugePages = HugePages::None) {
+    if (numa == NumaPolicy::Bind) {
+        return nodeResource(0, hugePages);
+    }
+    static auto resources = [] {
+        std::array<std::unique_ptr<ColumnResource>, 9> r;
+        for (int n = 0; n < 3; ++n) {
+            for (int h = 0; h < 3; ++h) {
+                r[n * 3 + h] = std::make_unique<ColumnResource>(NumaPolicy(n), HugePages(h));
+            }
+        }
+        return r;
+    }();
+    return resources[static_cast<int>(numa) * 3 + static_cast<int>(hugePages)].get();
+}
+
+// Forwards to an upstream resource and keeps track of the bytes in use,
+// e.g. to account for the memory of one NodeAttributeMap.
+class AccountingResource : public std::pmr::memory_resource {
+public:
+    explicit AccountingResource(std::pmr::memory_resource* upstream = std::pmr::get_default_resource())
+    : upstream{upstream} { }
+    
+    std::size_t bytesInUse() const {
+        return inUse;
+    }
+    
+    std::size_t peakBytes() const {
+        return peak;
+    }
+    
+private:
+    void* do_allocate(std::size_t bytes, std::size_t align) override {
+        auto p = upstream->allocate(bytes, align);
+        auto now = inUse += bytes;
+        for (auto old = peak.load(); now > old && !peak.compare_exchange_weak(old, now);) { }
+        return p;
+    }
+    
+    void do_deallocate(void* p, std::size_t bytes, std::size_t align) override {
+        upstream->deallocate(p, bytes, align);
+        inUse -= bytes;
+    }
+    
+    bool do_is_equal(std::pmr::memory_resource const& other) const noexcept override {
+        return this == &other;
+    }
+    
+    std::pmr::memory_resource* upstream;
+    std::atomic<std::size_t> inUse{0};
+    std::atomic<std::size_t> peak{0};
+}; // class AccountingResource
+
+} // namespace Attributes
+
+#endif /* Memory_h */
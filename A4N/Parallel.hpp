@@ -0,0 +1,68 @@
+//
+//  Parallel.hpp
+//  A4N
+//
+
+#ifndef Parallel_h
+#define Parallel_h
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <thread>
+#include <vector>
+
+namespace Attributes {
+
+// Number of workers used by the parallel kernels.
+inline unsigned parallelism() {
+    auto n = std::thread::hardware_concurrency();
+    return n ? n : 1;
+}
+
+// Runs f(lo, hi) on a static block partition of [begin, end).
+// Worker t always gets the t-th block, so kernels over the same range
+// see the same partitioning. Ranges below grain run on the caller.
+template<typename F>
+void parallelFor(std::size_t begin, std::size_t end, F f,
+                 std::size_t grain = std::size_t{1} << 14) {
+    if (end <= begin) {
+        return;
+    }
+    auto n = end - begin;
+    auto workers = std::min<std::size_t>(parallelism(), (n + grain - 1) / grain);
+    if (workers <= 1) {
+        f(begin, end);
+        return;
+    }
+    auto block = (n + workers - 1) / workers;
+    std::vector<std::thread> threads;
+    std::vector<std::exception_ptr> errors(workers);
+    for (std::size_t t = 1; t < workers; ++t) {
+        auto lo = begin + t * block;
+        auto hi = std::min(end, lo + block);
+        threads.emplace_back([&, t, lo, hi] {
+            try {
+                f(lo, hi);
+            } catch (...) {
+                errors[t] = std::current_exception();
+            }
+        });
+    }
+    try {
+        f(begin, std::min(end, begin + block));
+    } catch (...) {
+        errors[0] = std::current_exception();
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (auto& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+}
+
+} // namespace Attributes
+
+#endif /* Parallel_h */
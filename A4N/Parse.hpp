@@ -0,0 +1,42 @@
+//
+//  Parse.hpp
+//  A4N
+//
+
+#ifndef Parse_h
+#define Parse_h
+#include <cerrno>
+#include <charconv>
+#include <cstdlib>
+#include <string>
+#include <system_error>
+#include <type_traits>
+
+namespace Attributes {
+
+// Parses one attribute value from the text [begin, end), which is
+// followed by a NUL. Numbers must use the whole text, strings take it as
+// is. Specialise for other types.
+template<typename T, typename = void>
+struct ValueParser {
+    static bool parse(char const* begin, char const* end, T& v) {
+        if constexpr (std::is_integral_v<T>) {
+            auto [ptr, ec] = std::from_chars(begin, end, v);
+            return ec == std::errc{} && ptr == end;
+        } else if constexpr (std::is_floating_point_v<T>) {
+            char* ptr = nullptr;
+            errno = 0;
+            v = T(std::strtod(begin, &ptr));
+            return ptr == end && begin != end && errno != ERANGE;
+        } else if constexpr (std::is_same_v<T, std::string>) {
+            v.assign(begin, end);
+            return true;
+        } else {
+            static_assert(sizeof(T) == 0, "no ValueParser for this attribute type");
+        }
+    }
+};
+
+} // namespace Attributes
+
+#endif /* Parse_h */
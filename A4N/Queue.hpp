@@ -0,0 +1,75 @@
+//
+//  Queue.hpp
+//  A4N
+//
+
+#ifndef Queue_h
+#define Queue_h
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+namespace Attributes {
+
+// Blocking FIFO of at most capacity elements between pipeline stages. A
+// full queue blocks its producer, so a slow stage throttles the ones
+// before it (back-pressure). close() ends the stream: pushes fail, and
+// pops return what is left, then nothing.
+template<typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(std::size_t capacity)
+    : capacity{capacity ? capacity : 1} { }
+    
+    // Blocks while the queue is full; false if it was closed.
+    bool push(T v) {
+        std::unique_lock<std::mutex> lock{mutex};
+        notFull.wait(lock, [&] { return closed || items.size() < capacity; });
+        if (closed) {
+            return false;
+        }
+        items.push_back(std::move(v));
+        notEmpty.notify_one();
+        return true;
+    }
+    
+    // Blocks while the queue is empty; nullopt once it is closed and empty.
+    std::optional<T> pop() {
+        std::unique_lock<std::mutex> lock{mutex};
+        notEmpty.wait(lock, [&] { return closed || !items.empty(); });
+        if (items.empty()) {
+            return std::nullopt;
+        }
+        auto v = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return v;
+    }
+    
+    void close() {
+        std::lock_guard<std::mutex> lock{mutex};
+        closed = true;
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+    
+    std::size_t size() const {
+        std::lock_guard<std::mutex> lock{mutex};
+        return items.size();
+    }
+    
+private:
+    std::size_t capacity;
+    std::deque<T> items;
+    bool closed = false;
+    mutable std::mutex mutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+}; // class BoundedQueue
+
+} // namespace Attributes
+
+#endif /* Queue_h */
@@ -0,0 +1,136 @@
+//
+//  Reclaimer.hpp
+//  A4N
+//
+
+#ifndef Reclaimer_h
+#define Reclaimer_h
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace Attributes {
+
+// Destroys retired objects (detached storages) off the caller's thread,
+// so that freeing a multi-GB column does not stall the request path.
+// Retiring blocks, or reclaims on the caller in Manual mode, while more
+// than maxPendingBytes are waiting.
+// Objects retired here must only use thread-safe memory resources.
+class Reclaimer {
+public:
+    enum class Mode {
+        Background, // a reclaimer thread destroys retired objects
+        Manual      // retired objects wait for reclaim()
+    };
+    
+    explicit Reclaimer(Mode mode = Mode::Background,
+                       std::size_t maxPendingBytes = std::size_t{1} << 30)
+    : mode{mode}, maxPendingBytes{maxPendingBytes} {
+        if (mode == Mode::Background) {
+            worker = std::thread([this] { run(); });
+        }
+    }
+    
+    Reclaimer(Reclaimer const&) = delete;
+    Reclaimer& operator=(Reclaimer const&) = delete;
+    
+    ~Reclaimer() {
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            stopping = true;
+        }
+        queued.notify_all();
+        if (worker.joinable()) {
+            worker.join();
+        }
+        reclaim();
+    }
+    
+    // Takes ownership of object, which holds about bytes of memory. O(1)
+    // unless the pending limit is reached.
+    void retire(std::shared_ptr<void> object, std::size_t bytes) {
+        std::unique_lock<std::mutex> lock{mutex};
+        // pendingBytes also counts objects being destroyed right now.
+        while (pendingBytes && pendingBytes + bytes > maxPendingBytes) {
+            if (mode == Mode::Background || pending.empty()) {
+                drained.wait(lock);
+            } else {
+                lock.unlock();
+                reclaimOne();
+                lock.lock();
+            }
+        }
+        pending.emplace_back(std::move(object), bytes);
+        pendingBytes += bytes;
+        lock.unlock();
+        queued.notify_one();
+    }
+    
+    // Destroys everything retired so far on the calling thread.
+    // Returns the number of objects destroyed.
+    std::size_t reclaim() {
+        std::size_t n = 0;
+        while (reclaimOne()) {
+            ++n;
+        }
+        return n;
+    }
+    
+    std::size_t getPendingBytes() {
+        std::lock_guard<std::mutex> lock{mutex};
+        return pendingBytes;
+    }
+    
+    std::size_t getPendingObjects() {
+        std::lock_guard<std::mutex> lock{mutex};
+        return pending.size();
+    }
+    
+private:
+    bool reclaimOne() {
+        std::unique_lock<std::mutex> lock{mutex};
+        if (pending.empty()) {
+            return false;
+        }
+        auto [object, bytes] = std::move(pending.front());
+        pending.pop_front();
+        lock.unlock();
+        object.reset();
+        lock.lock();
+        pendingBytes -= bytes;
+        lock.unlock();
+        drained.notify_all();
+        return true;
+    }
+    
+    void run() {
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock{mutex};
+                queued.wait(lock, [this] { return stopping || !pending.empty(); });
+                if (pending.empty()) {
+                    return;
+                }
+            }
+            reclaimOne();
+        }
+    }
+    
+    Mode mode;
+    std::size_t maxPendingBytes;
+    std::mutex mutex;
+    std::condition_variable queued;
+    std::condition_variable drained;
+    std::deque<std::pair<std::shared_ptr<void>, std::size_t>> pending;
+    std::size_t pendingBytes = 0;
+    bool stopping = false;
+    std::thread worker;
+}; // class Reclaimer
+
+} // namespace Attributes
+
+#endif /* Reclaimer_h */
@@ -0,0 +1,329 @@
+//
+//  RecordStore.hpp
+//  A4N
+//
+
+#ifndef RecordStore_h
+#define RecordStore_h
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <typeindex>
+#include <vector>
+
+#include "Attributes.hpp"
+
+namespace Attributes {
+
+class NodeRecordStore;
+
+// All fields of one node, read from its packed row. The row is looked
+// up on every access, so a view stays usable while the store grows.
+class NodeRecordView {
+public:
+    NodeRecordView(NodeRecordStore const* store, index i)
+    : store{store}, i{i} { }
+    
+    std::size_t fields() const;
+    
+    bool has(std::size_t field) const;
+    
+    template<typename T>
+    std::optional<T> get(std::size_t field) const;
+    
+    template<typename T>
+    std::optional<T> get(std::string_view name) const;
+    
+private:
+    // Null if the node has no row yet.
+    unsigned char const* row() const;
+    
+    NodeRecordStore const* store;
+    index i;
+}; // class NodeRecordView
+
+// Packed row store over a chosen set of attributes, for workloads that
+// read many attributes of one node at a time. Each row starts with a
+// 64-bit validity mask followed by the fields. Rows of up to 64 bytes are
+// padded to a power of two, longer ones to whole 64-byte lines, so a row
+// never straddles more cache lines than it must.
+// Fields either mirror an attribute column (kept up to date on every
+// write to the column, and refilled when the column is loaded) or live
+// only in the row store.
+class NodeRecordStore : public RecordMirror {
+public:
+    static constexpr std::size_t maxFields = 64;
+    
+    NodeRecordStore() = default;
+    NodeRecordStore(NodeRecordStore const&) = delete;
+    NodeRecordStore& operator=(NodeRecordStore const&) = delete;
+    
+    ~NodeRecordStore() override {
+        for (auto& f : layout) {
+            if (f.column) {
+                f.column->removeMirror(this);
+            }
+        }
+    }
+    
+    // Adds a field maintained alongside the attribute column `name`.
+    template<typename T>
+    NodeRecordStore& mirror(NodeAttributeMap& map, std::string_view name) {
+        auto column = map.getStorage<NodeAttributeStorage<T>>(name);
+        addField<T>(name, column);
+        column->addMirror(this, static_cast<unsigned>(layout.size() - 1));
+        return *this;
+    }
+    
+    // Adds a field stored only in the row store, instead of a column.
+    template<typename T>
+    NodeRecordStore& field(std::string_view name) {
+        addField<T>(name, nullptr);
+        return *this;
+    }
+    
+    std::size_t fields() const {
+        return layout.size();
+    }
+    
+    std::size_t fieldIndex(std::string_view name) const {
+        for (std::size_t k = 0; k < layout.size(); ++k) {
+            if (layout[k].name == name) {
+                return k;
+            }
+        }
+        throw std::runtime_error("No such record field");
+    }
+    
+    // Bytes per row.
+    std::size_t rowSize() const {
+        return stride;
+    }
+    
+    NodeRecordView record(index i) {
+        seal();
+        return NodeRecordView{this, i};
+    }
+    
+    // Writes a field; mirrored fields are written through their column.
+    template<typename T>
+    void set(index i, std::size_t field, T v) {
+        auto& f = checkedField<T>(field);
+        if (f.column) {
+            static_cast<NodeAttributeStorage<T>*>(f.column.get())->set(i, std::move(v));
+        } else {
+            update(i, static_cast<unsigned>(field), &v);
+        }
+    }
+    
+    void invalidate(index i, std::size_t field) {
+        if (field >= layout.size()) {
+            throw std::runtime_error("No such record field");
+        }
+        if (layout[field].column) {
+            layout[field].column->invalidate(i);
+        } else {
+            update(i, static_cast<unsigned>(field), nullptr);
+        }
+    }
+    
+    void update(index i, unsigned field, void const* value) override {
+        seal();
+        reserve(i + 1);
+        if (value) {
+            std::memcpy(row(i) + layout[field].offset, value, layout[field].size);
+        }
+        setMask(i, field, value != nullptr);
+    }
+    
+    void reload(unsigned field) override {
+        if (!sealed) {
+            return; // seal() backfills
+        }
+        for (index i = 0; i < rows; ++i) {
+            setMask(i, field, false);
+        }
+        backfill(field);
+    }
+    
+private:
+    struct Field {
+        std::string name;
+        std::type_index type;
+        std::size_t size;
+        std::size_t align;
+        std::size_t offset;
+        std::shared_ptr<NodeAttributeStorageBase> column; // null for row-only fields
+        bool (*pull)(NodeAttributeStorageBase*, index, void*);
+    };
+    
+    struct AlignedDelete {
+        void operator()(unsigned char* p) const {
+            ::operator delete(p, std::align_val_t{64});
+        }
+    };
+    
+    template<typename T>
+    void addField(std::string_view name, std::shared_ptr<NodeAttributeStorageBase> column) {
+        static_assert(std::is_trivially_copyable_v<T>, "record fields are copied bytewise");
+        if (sealed) {
+            throw std::runtime_error("Record layout is fixed once the store is used");
+        }
+        if (layout.size() == maxFields) {
+            throw std::runtime_error("Too many record fields");
+        }
+        layout.push_back(Field{std::string{name}, typeid(T), sizeof(T), alignof(T), 0, std::move(column),
+            [](NodeAttributeStorageBase* s, index i, void* dst) {
+                auto v = static_cast<NodeAttributeStorage<T>*>(s)->get(i);
+                if (v) {
+                    std::memcpy(dst, &*v, sizeof(T));
+                }
+                return v.has_value();
+            }});
+    }
+    
+    template<typename T>
+    Field const& checkedField(std::size_t field) const {
+        if (field >= layout.size()) {
+            throw std::runtime_error("No such record field");
+        }
+        if (layout[field].type != typeid(T)) {
+            throw std::runtime_error("Type mismatch in record field");
+        }
+        return layout[field];
+    }
+    
+    // Fixes the layout (widest alignment first) and backfills the rows
+    // from the mirrored columns.
+    void seal() {
+        if (sealed) {
+            return;
+        }
+        sealed = true;
+        std::vector<std::size_t> order(layout.size());
+        for (std::size_t k = 0; k < order.size(); ++k) {
+            order[k] = k;
+        }
+        std::stable_sort(order.begin(), order.end(), [&](auto a, auto b) {
+            return layout[a].align > layout[b].align;
+        });
+        std::size_t offset = sizeof(std::uint64_t);
+        for (auto k : order) {
+            offset = (offset + layout[k].align - 1) / layout[k].align * layout[k].align;
+            layout[k].offset = offset;
+            offset += layout[k].size;
+        }
+        // Rows never straddle more cache lines than they must: rows of up
+        // to 64 bytes take a power of two that divides a line, longer rows
+        // whole lines.
+        stride = 8;
+        while (stride < offset && stride < 64) {
+            stride *= 2;
+        }
+        if (stride < offset) {
+            stride = (offset + 63) / 64 * 64;
+        }
+        for (unsigned k = 0; k < layout.size(); ++k) {
+            backfill(k);
+        }
+    }
+    
+    // Copies the valid slots of the column of field k into the rows.
+    void backfill(unsigned k) {
+        auto column = layout[k].column.get();
+        for (index i = 0; column && i < column->validity().size(); ++i) {
+            if (column->isValid(i)) {
+                pullField(i, k);
+            }
+        }
+    }
+    
+    void pullField(index i, unsigned k) {
+        reserve(i + 1);
+        auto& f = layout[k];
+        setMask(i, k, f.pull(f.column.get(), i, row(i) + f.offset));
+    }
+    
+    void setMask(index i, unsigned field, bool valid) {
+        std::uint64_t mask;
+        std::memcpy(&mask, row(i), sizeof(mask));
+        if (valid) {
+            mask |= std::uint64_t{1} << field;
+        } else {
+            mask &= ~(std::uint64_t{1} << field);
+        }
+        std::memcpy(row(i), &mask, sizeof(mask));
+    }
+    
+    unsigned char* row(index i) {
+        return data.get() + i * stride;
+    }
+    
+    void reserve(index n) {
+        if (n <= rows) {
+            return;
+        }
+        if (n > capacity) {
+            auto grown = std::max(n, 2 * capacity);
+            std::unique_ptr<unsigned char[], AlignedDelete> fresh{
+                static_cast<unsigned char*>(::operator new(grown * stride, std::align_val_t{64}))};
+            if (rows) {
+                std::memcpy(fresh.get(), data.get(), rows * stride);
+            }
+            data = std::move(fresh);
+            capacity = grown;
+        }
+        std::memset(row(rows), 0, (n - rows) * stride);
+        rows = n;
+    }
+    
+    std::vector<Field> layout;
+    bool sealed = false;
+    std::size_t stride = 0;
+    std::unique_ptr<unsigned char[], AlignedDelete> data;
+    index rows = 0;
+    index capacity = 0;
+    friend class NodeRecordView;
+}; // class NodeRecordStore
+
+inline std::size_t NodeRecordView::fields() const {
+    return store->fields();
+}
+
+inline unsigned char const* NodeRecordView::row() const {
+    return i < store->rows ? store->data.get() + i * store->stride : nullptr;
+}
+
+inline bool NodeRecordView::has(std::size_t field) const {
+    std::uint64_t mask = 0;
+    if (auto r = row()) {
+        std::memcpy(&mask, r, sizeof(mask));
+    }
+    return (mask >> field) & 1;
+}
+
+template<typename T>
+std::optional<T> NodeRecordView::get(std::size_t field) const {
+    auto& f = store->checkedField<T>(field);
+    if (!has(field)) {
+        return std::nullopt;
+    }
+    T v;
+    std::memcpy(&v, row() + f.offset, sizeof(T));
+    return v;
+}
+
+template<typename T>
+std::optional<T> NodeRecordView::get(std::string_view name) const {
+    return get<T>(store->fieldIndex(name));
+}
+
+} // namespace Attributes
+
+#endif /* RecordStore_h */
@@ -0,0 +1,555 @@
+//
+//  Roaring.hpp
+//  A4N
+//
+
+#ifndef Roaring_h
+#define Roaring_h
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory_resource>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "Serialize.hpp"
+
+namespace Attributes {
+
+// Compressed bit set in the manner of Roaring bitmaps: indices are split
+// into blocks of 64K, and every non-empty block is held by the smallest of
+// a sorted array of offsets (up to 4096), a 64K-bit bitmap or a list of
+// runs. Good for sparse but clustered sets, where a dense Bitmap wastes
+// memory on empty ranges. Runs are only chosen by optimize().
+class RoaringBitmap {
+public:
+    using word = std::uint64_t;
+    static constexpr std::size_t wordBits = 64;
+    static constexpr std::size_t blockBits = 16;
+    static constexpr std::size_t blockSize = std::size_t{1} << blockBits;
+    static constexpr std::size_t blockWords = blockSize / wordBits;
+    static constexpr std::size_t arrayMax = 4096;
+    
+    explicit RoaringBitmap(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+    : keys{resource}, blocks{resource} { }
+    
+    RoaringBitmap(RoaringBitmap const& other, std::pmr::memory_resource* resource)
+    : keys{other.keys, resource}, blocks{other.blocks, resource}, bits{other.bits} { }
+    
+    RoaringBitmap(RoaringBitmap const&) = default;
+    RoaringBitmap(RoaringBitmap&&) = default;
+    RoaringBitmap& operator=(RoaringBitmap const&) = default;
+    RoaringBitmap& operator=(RoaringBitmap&&) = default;
+    
+    // Bit length, as for Bitmap.
+    std::size_t size() const {
+        return bits;
+    }
+    
+    // Shrinking clears the bits from n on.
+    void resize(std::size_t n) {
+        if (n < bits) {
+            auto k = std::lower_bound(keys.begin(), keys.end(), n >> blockBits) - keys.begin();
+            if (std::size_t(k) < keys.size() && keys[k] == n >> blockBits && (n & (blockSize - 1))) {
+                blocks[k].truncate(n & (blockSize - 1));
+                k += blocks[k].cardinality ? 1 : 0;
+            }
+            keys.erase(keys.begin() + k, keys.end());
+            blocks.erase(blocks.begin() + k, blocks.end());
+        }
+        bits = n;
+    }
+    
+    bool test(std::size_t i) const {
+        auto b = find(i >> blockBits);
+        return b && b->test(low(i));
+    }
+    
+    void set(std::size_t i) {
+        auto key = i >> blockBits;
+        auto k = std::lower_bound(keys.begin(), keys.end(), key) - keys.begin();
+        if (std::size_t(k) == keys.size() || keys[k] != key) {
+            keys.insert(keys.begin() + k, key);
+            blocks.emplace(blocks.begin() + k);
+        }
+        blocks[k].set(low(i));
+        bits = std::max(bits, i + 1);
+    }
+    
+    void reset(std::size_t i) {
+        auto k = std::lower_bound(keys.begin(), keys.end(), i >> blockBits) - keys.begin();
+        if (std::size_t(k) < keys.size() && keys[k] == i >> blockBits) {
+            blocks[k].reset(low(i));
+            if (!blocks[k].cardinality) {
+                keys.erase(keys.begin() + k);
+                blocks.erase(blocks.begin() + k);
+            }
+        }
+    }
+    
+    std::size_t cardinality() const {
+        std::size_t n = 0;
+        for (auto& b : blocks) {
+            n += b.cardinality;
+        }
+        return n;
+    }
+    
+    // Number of set bits below i.
+    std::size_t rank(std::size_t i) const {
+        std::size_t n = 0;
+        for (std::size_t k = 0; k < keys.size() && keys[k] <= i >> blockBits; ++k) {
+            n += keys[k] < i >> blockBits ? blocks[k].cardinality : blocks[k].rank(low(i));
+        }
+        return n;
+    }
+    
+    // Calls f(i) for every set bit in increasing order.
+    template<typename F>
+    void forEach(F f) const {
+        for (std::size_t k = 0; k < keys.size(); ++k) {
+            auto base = keys[k] << blockBits;
+            blocks[k].forEach([&](std::size_t lo) { f(base + lo); });
+        }
+    }
+    
+    std::size_t wordCount() const {
+        return (bits + wordBits - 1) / wordBits;
+    }
+    
+    // The 64 bits from w * 64 on, as in Bitmap.
+    word getWord(std::size_t w) const {
+        auto b = find(w / blockWords);
+        return b ? b->getWord(w % blockWords) : 0;
+    }
+    
+    RoaringBitmap& operator|=(RoaringBitmap const& other) {
+        return combine(other, [](word a, word b) { return a | b; }, true);
+    }
+    
+    RoaringBitmap& operator&=(RoaringBitmap const& other) {
+        return combine(other, [](word a, word b) { return a & b; }, false);
+    }
+    
+    // Removes the bits set in other.
+    RoaringBitmap& operator-=(RoaringBitmap const& other) {
+        return combine(other, [](word a, word b) { return a & ~b; }, false);
+    }
+    
+    // Converts every block to its smallest form, including runs.
+    void optimize() {
+        for (auto& b : blocks) {
+            b.optimize();
+        }
+    }
+    
+    std::size_t memoryUsage() const {
+        auto bytes = keys.capacity() * sizeof(std::uint64_t) + blocks.capacity() * sizeof(Block);
+        for (auto& b : blocks) {
+            bytes += b.values.capacity() * sizeof(std::uint16_t) + b.words.capacity() * sizeof(word)
+                + b.runs.capacity() * sizeof(Run);
+        }
+        return bytes;
+    }
+    
+    void save(std::ostream& out) const {
+        writeValue<std::uint64_t>(out, bits);
+        writeVector(out, keys);
+        for (auto& b : blocks) {
+            writeValue(out, b.kind);
+            writeValue(out, b.cardinality);
+            writeVector(out, b.values);
+            writeVector(out, b.words);
+            writeVector(out, b.runs);
+        }
+    }
+    
+    void load(std::istream& in) {
+        bits = readValue<std::uint64_t>(in);
+        readVector(in, keys);
+        blocks.clear();
+        blocks.resize(keys.size());
+        for (auto& b : blocks) {
+            b.kind = readValue<Kind>(in);
+            b.cardinality = readValue<std::uint32_t>(in);
+            readVector(in, b.values);
+            readVector(in, b.words);
+            readVector(in, b.runs);
+        }
+        if (!wellFormed()) {
+            keys.clear();
+            blocks.clear();
+            bits = 0;
+            throw std::runtime_error("Invalid roaring bitmap in attribute file");
+        }
+    }
+    
+private:
+    enum class Kind : std::uint8_t { Array, Bitset, Runs };
+    
+    struct Run {
+        std::uint16_t first;
+        std::uint16_t last;
+    };
+    
+    // The set bits of one 64K block in one of three forms.
+    struct Block {
+        using allocator_type = std::pmr::polymorphic_allocator<std::byte>;
+        
+        explicit Block(allocator_type alloc = {})
+        : values(alloc), words(alloc), runs(alloc) { }
+        
+        Block(Block const& other, allocator_type alloc = {})
+        : kind{other.kind}, cardinality{other.cardinality},
+          values(other.values, alloc), words(other.words, alloc), runs(other.runs, alloc) { }
+        
+        Block(Block&& other, allocator_type alloc)
+        : kind{other.kind}, cardinality{other.cardinality},
+          values(std::move(other.values), alloc), words(std::move(other.words), alloc),
+          runs(std::move(other.runs), alloc) { }
+        
+        Block(Block&&) = default;
+        Block& operator=(Block const&) = default;
+        Block& operator=(Block&&) = default;
+        
+        bool test(std::uint16_t lo) const {
+            switch (kind) {
+                case Kind::Array:
+                    return std::binary_search(values.begin(), values.end(), lo);
+                case Kind::Bitset:
+                    return (words[lo / wordBits] >> (lo % wordBits)) & 1;
+                case Kind::Runs: {
+                    auto r = std::upper_bound(runs.begin(), runs.end(), lo,
+                                              [](std::uint16_t v, Run const& run) { return v < run.first; });
+                    return r != runs.begin() && lo <= std::prev(r)->last;
+                }
+            }
+            return false;
+        }
+        
+        void set(std::uint16_t lo) {
+            if (kind == Kind::Runs) {
+                if (test(lo)) {
+                    return;
+                }
+                unpack();
+            }
+            if (kind == Kind::Array) {
+                auto it = std::lower_bound(values.begin(), values.end(), lo);
+                if (it != values.end() && *it == lo) {
+                    return;
+                }
+                values.insert(it, lo);
+                if (++cardinality > arrayMax) {
+                    toBitset();
+                }
+            } else if (!test(lo)) {
+                words[lo / wordBits] |= word{1} << (lo % wordBits);
+                ++cardinality;
+            }
+        }
+        
+        void reset(std::uint16_t lo) {
+            if (!test(lo)) {
+                return;
+            }
+            unpack();
+            if (kind == Kind::Array) {
+                values.erase(std::lower_bound(values.begin(), values.end(), lo));
+                --cardinality;
+            } else {
+                words[lo / wordBits] &= ~(word{1} << (lo % wordBits));
+                if (--cardinality <= arrayMax) {
+                    toArray();
+                }
+            }
+        }
+        
+        std::size_t rank(std::uint16_t lo) const {
+            switch (kind) {
+                case Kind::Array:
+                    return std::size_t(std::lower_bound(values.begin(), values.end(), lo) - values.begin());
+                case Kind::Bitset: {
+                    std::size_t n = 0;
+                    for (std::size_t w = 0; w < lo / wordBits; ++w) {
+                        n += __builtin_popcountll(words[w]);
+                    }
+                    return n + __builtin_popcountll(words[lo / wordBits] & ((word{1} << (lo % wordBits)) - 1));
+                }
+                case Kind::Runs: {
+                    std::size_t n = 0;
+                    for (auto& r : runs) {
+                        if (r.first >= lo) {
+                            break;
+                        }
+                        n += std::min<std::size_t>(r.last + 1, lo) - r.first;
+                    }
+                    return n;
+                }
+            }
+            return 0;
+        }
+        
+        template<typename F>
+        void forEach(F f) const {
+            switch (kind) {
+                case Kind::Array:
+                    for (auto v : values) {
+                        f(v);
+                    }
+                    break;
+                case Kind::Bitset:
+                    for (std::size_t w = 0; w < blockWords; ++w) {
+                        for (auto bits = words[w]; bits; bits &= bits - 1) {
+                            f(w * wordBits + __builtin_ctzll(bits));
+                        }
+                    }
+                    break;
+                case Kind::Runs:
+                    for (auto& r : runs) {
+                        for (std::size_t v = r.first; v <= r.last; ++v) {
+                            f(v);
+                        }
+                    }
+                    break;
+            }
+        }
+        
+        word getWord(std::size_t w) const {
+            if (kind == Kind::Bitset) {
+                return words[w];
+            }
+            word result = 0;
+            auto lo = w * wordBits, hi = lo + wordBits;
+            if (kind == Kind::Array) {
+                for (auto it = std::lower_bound(values.begin(), values.end(), lo);
+                     it != values.end() && *it < hi; ++it) {
+                    result |= word{1} << (*it - lo);
+                }
+            } else {
+                for (auto& r : runs) {
+                    auto first = std::max<std::size_t>(r.first, lo);
+                    auto last = std::min<std::size_t>(r.last + 1, hi);
+                    for (auto v = first; v < last; ++v) {
+                        result |= word{1} << (v - lo);
+                    }
+                }
+            }
+            return result;
+        }
+        
+        // Clears the offsets from lo on.
+        void truncate(std::uint16_t lo) {
+            toBitset();
+            for (std::size_t v = lo; v < blockSize; ++v) {
+                words[v / wordBits] &= ~(word{1} << (v % wordBits));
+            }
+            recount();
+        }
+        
+        void toBitset() {
+            if (kind == Kind::Bitset) {
+                return;
+            }
+            std::pmr::vector<word> bitset(blockWords, 0, words.get_allocator());
+            forEach([&](std::size_t v) { bitset[v / wordBits] |= word{1} << (v % wordBits); });
+            words.swap(bitset);
+            values.clear();
+            values.shrink_to_fit();
+            runs.clear();
+            runs.shrink_to_fit();
+            kind = Kind::Bitset;
+        }
+        
+        void toArray() {
+            if (kind == Kind::Array) {
+                return;
+            }
+            std::pmr::vector<std::uint16_t> array(values.get_allocator());
+            array.reserve(cardinality);
+            forEach([&](std::size_t v) { array.push_back(std::uint16_t(v)); });
+            values.swap(array);
+            words.clear();
+            words.shrink_to_fit();
+            runs.clear();
+            runs.shrink_to_fit();
+            kind = Kind::Array;
+        }
+        
+        void toRuns() {
+            std::pmr::vector<Run> list(runs.get_allocator());
+            forEach([&](std::size_t v) {
+                if (!list.empty() && list.back().last + 1u == v) {
+                    list.back().last = std::uint16_t(v);
+                } else {
+                    list.push_back(Run{std::uint16_t(v), std::uint16_t(v)});
+                }
+            });
+            runs.swap(list);
+            values.clear();
+            values.shrink_to_fit();
+            words.clear();
+            words.shrink_to_fit();
+            kind = Kind::Runs;
+        }
+        
+        // Array or bitset, whichever fits the cardinality.
+        void unpack() {
+            if (kind == Kind::Runs) {
+                if (cardinality <= arrayMax) {
+                    toArray();
+                } else {
+                    toBitset();
+                }
+            }
+        }
+        
+        void recount() {
+            cardinality = 0;
+            for (auto w : words) {
+                cardinality += __builtin_popcountll(w);
+            }
+            if (cardinality <= arrayMax) {
+                toArray();
+            }
+        }
+        
+        void optimize() {
+            std::size_t runCount = 0;
+            std::size_t previous = blockSize + 1;
+            forEach([&](std::size_t v) {
+                runCount += v != previous + 1;
+                previous = v;
+            });
+            auto arrayBytes = cardinality * sizeof(std::uint16_t);
+            auto bitsetBytes = blockWords * sizeof(word);
+            auto runBytes = runCount * sizeof(Run);
+            if (runBytes < std::min(arrayBytes, bitsetBytes)) {
+                toRuns();
+            } else if (arrayBytes <= bitsetBytes) {
+                toArray();
+            } else {
+                toBitset();
+            }
+        }
+        
+        // Only the vector of its kind is used, in order, and holds
+        // cardinality bits; blocks are never empty.
+        bool wellFormed() const {
+            std::size_t n = 0;
+            switch (kind) {
+                case Kind::Array:
+                    if (!words.empty() || !runs.empty()
+                        || std::adjacent_find(values.begin(), values.end(), std::greater_equal<>{}) != values.end()) {
+                        return false;
+                    }
+                    n = values.size();
+                    break;
+                case Kind::Bitset:
+                    if (!values.empty() || !runs.empty() || words.size() != blockWords) {
+                        return false;
+                    }
+                    for (auto w : words) {
+                        n += __builtin_popcountll(w);
+                    }
+                    break;
+                case Kind::Runs:
+                    if (!values.empty() || !words.empty()) {
+                        return false;
+                    }
+                    for (std::size_t r = 0; r < runs.size(); ++r) {
+                        if (runs[r].last < runs[r].first || (r && runs[r].first <= runs[r - 1].last)) {
+                            return false;
+                        }
+                        n += runs[r].last + 1u - runs[r].first;
+                    }
+                    break;
+                default:
+                    return false;
+            }
+            return n && n == cardinality;
+        }
+        
+        Kind kind = Kind::Array;
+        std::uint32_t cardinality = 0;
+        std::pmr::vector<std::uint16_t> values; // Array: sorted offsets
+        std::pmr::vector<word> words;           // Bitset: blockWords words
+        std::pmr::vector<Run> runs;             // Runs: sorted, disjoint
+    };
+    
+    static std::uint16_t low(std::size_t i) {
+        return std::uint16_t(i & (blockSize - 1));
+    }
+    
+    // Keys increase and stay below the bit length, every block is valid.
+    bool wellFormed() const {
+        if (std::adjacent_find(keys.begin(), keys.end(), std::greater_equal<>{}) != keys.end()
+            || (!keys.empty() && (bits == 0 || keys.back() > (bits - 1) >> blockBits))) {
+            return false;
+        }
+        return std::all_of(blocks.begin(), blocks.end(), [](Block const& b) { return b.wellFormed(); });
+    }
+    
+    Block const* find(std::size_t key) const {
+        auto it = std::lower_bound(keys.begin(), keys.end(), key);
+        return it != keys.end() && *it == key ? &blocks[std::size_t(it - keys.begin())] : nullptr;
+    }
+    
+    // Blocks present in both are combined word by word; blocks only in
+    // other are copied if keepOther (union), blocks only in this are
+    // kept unless intersecting.
+    template<typename Op>
+    RoaringBitmap& combine(RoaringBitmap const& other, Op op, bool keepOther) {
+        auto intersect = !keepOther && op(1, 1) && !op(1, 0);
+        std::pmr::vector<std::uint64_t> mergedKeys{keys.get_allocator()};
+        std::pmr::vector<Block> merged{blocks.get_allocator()};
+        std::size_t a = 0, b = 0;
+        while (a < keys.size() || b < other.keys.size()) {
+            if (b == other.keys.size() || (a < keys.size() && keys[a] < other.keys[b])) {
+                if (!intersect) {
+                    mergedKeys.push_back(keys[a]);
+                    merged.push_back(std::move(blocks[a]));
+                }
+                ++a;
+            } else if (a == keys.size() || other.keys[b] < keys[a]) {
+                if (keepOther) {
+                    mergedKeys.push_back(other.keys[b]);
+                    merged.push_back(other.blocks[b]);
+                }
+                ++b;
+            } else {
+                auto block = std::move(blocks[a]);
+                Block rhs{other.blocks[b]};
+                block.toBitset();
+                rhs.toBitset();
+                for (std::size_t w = 0; w < blockWords; ++w) {
+                    block.words[w] = op(block.words[w], rhs.words[w]);
+                }
+                block.recount();
+                if (block.cardinality) {
+                    mergedKeys.push_back(keys[a]);
+                    merged.push_back(std::move(block));
+                }
+                ++a;
+                ++b;
+            }
+        }
+        keys.swap(mergedKeys);
+        blocks.swap(merged);
+        if (keepOther) {
+            bits = std::max(bits, other.bits);
+        }
+        return *this;
+    }
+    
+    std::pmr::vector<std::uint64_t> keys; // block numbers, sorted
+    std::pmr::vector<Block> blocks;
+    std::size_t bits = 0;
+}; // class RoaringBitmap
+
+} // namespace Attributes
+
+#endif /* Roaring_h */
@@ -0,0 +1,148 @@
+//
+//  Serialize.hpp
+//  A4N
+//
+
+#ifndef Serialize_h
+#define Serialize_h
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace Attributes {
+
+// Binary encoding of attribute values, in native byte order. Trivially
+// copyable types are written as their bytes, strings with a length
+// prefix. Specialise for other types; without a specialisation, saving
+// an attribute of the type throws.
+template<typename T, typename = void>
+struct ValueCodec {
+    static constexpr bool supported = std::is_trivially_copyable_v<T>;
+    
+    static void write(std::ostream& out, T const* v, std::size_t n) {
+        if constexpr (supported) {
+            out.write(reinterpret_cast<char const*>(v), std::streamsize(n * sizeof(T)));
+        } else {
+            (void)out, (void)v, (void)n;
+            throw std::runtime_error("Attribute type cannot be saved");
+        }
+    }
+    
+    static void read(std::istream& in, T* v, std::size_t n) {
+        if constexpr (supported) {
+            in.read(reinterpret_cast<char*>(v), std::streamsize(n * sizeof(T)));
+        } else {
+            (void)in, (void)v, (void)n;
+            throw std::runtime_error("Attribute type cannot be loaded");
+        }
+    }
+};
+
+template<>
+struct ValueCodec<std::string> {
+    static constexpr bool supported = true;
+    
+    static void write(std::ostream& out, std::string const* v, std::size_t n) {
+        for (auto end = v + n; v != end; ++v) {
+            std::uint64_t length = v->size();
+            out.write(reinterpret_cast<char const*>(&length), sizeof(length));
+            out.write(v->data(), std::streamsize(length));
+        }
+    }
+    
+    static void read(std::istream& in, std::string* v, std::size_t n) {
+        for (auto end = v + n; v != end && in; ++v) {
+            std::uint64_t length = 0;
+            in.read(reinterpret_cast<char*>(&length), sizeof(length));
+            v->resize(length);
+            in.read(v->data(), std::streamsize(length));
+        }
+    }
+};
+
+template<typename T>
+void writeValue(std::ostream& out, T const& v) {
+    ValueCodec<T>::write(out, &v, 1);
+}
+
+template<typename T>
+T readValue(std::istream& in) {
+    T v{};
+    ValueCodec<T>::read(in, &v, 1);
+    if (!in) {
+        throw std::runtime_error("Truncated attribute file");
+    }
+    return v;
+}
+
+template<typename V>
+void writeVector(std::ostream& out, V const& v) {
+    writeValue<std::uint64_t>(out, v.size());
+    ValueCodec<typename V::value_type>::write(out, v.data(), v.size());
+}
+
+template<typename V>
+void readVector(std::istream& in, V& v) {
+    v.resize(readValue<std::uint64_t>(in));
+    ValueCodec<typename V::value_type>::read(in, v.data(), v.size());
+}
+
+// Input buffer over n bytes at data, which it does not own, so that a
+// record read into memory can be decoded with the stream functions.
+class MemoryBuffer : public std::streambuf {
+public:
+    MemoryBuffer(char const* data, std::size_t n) {
+        auto begin = const_cast<char*>(data);
+        setg(begin, begin, begin + n);
+    }
+};
+
+// First bytes of a file written by NodeAttributeMap::save().
+inline constexpr char attributeFileMagic[8] = {'A', '4', 'N', 'A', 'T', 'T', 'R', '1'};
+
+// Counters of a running save, see NodeAttributeMap::save(). Lock-free so
+// they can live in memory shared with a child process.
+struct SaveProgress {
+    std::atomic<std::size_t> attributes{0};      // attributes to save
+    std::atomic<std::size_t> savedAttributes{0}; // attributes written so far
+    std::atomic<std::size_t> bytesWritten{0};
+    std::atomic<std::size_t> overheadBytes{0};   // peak extra memory, if known
+};
+
+// Moves the complete file temporary over path once its data is on disk,
+// so that path holds either the old or the new contents, even after a
+// crash.
+inline void replaceFile(std::string const& temporary, std::string const& path) {
+    auto sync = [](std::string const& name) {
+        int fd = ::open(name.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        auto synced = ::fsync(fd) == 0;
+        ::close(fd);
+        return synced;
+    };
+    if (!sync(temporary)) {
+        throw std::runtime_error("Cannot sync attribute file");
+    }
+    if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+        throw std::runtime_error("Cannot replace attribute file");
+    }
+    // Makes the rename itself durable; not every file system allows it.
+    auto slash = path.find_last_of('/');
+    sync(slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash));
+}
+
+} // namespace Attributes
+
+#endif /* Serialize_h */
@@ -0,0 +1,366 @@
+//
+//  Sharded.hpp
+//  A4N
+//
+
+#ifndef Sharded_h
+#define Sharded_h
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "Attributes.hpp"
+
+namespace Attributes {
+
+template<typename T>
+class ShardedNodeAttribute;
+
+// One attribute split into shards of consecutive node ids, e.g. one per
+// partition. Every shard is a NodeAttributeStorage<T> over local indices
+// with its own memory resource (see nodeResource()), lock, dirty flag and
+// serialisation, so partitions are processed and checkpointed without a
+// global lock. get(), set() and invalidate() route to the shard of a node
+// and lock only that shard. Validity lives in the shards, not in the
+// base class. Shards are written concurrently, so writes cannot be undone
+// and throw while the map is in a transaction.
+template<typename T>
+class ShardedNodeAttributeStorage : public NodeAttributeStorageBase {
+public:
+    // Shard s holds the nodes [starts[s], starts[s + 1]), the last one all
+    // nodes from starts.back(). starts must begin with 0 and increase.
+    // Shard s allocates its values from resources[s] if given.
+    ShardedNodeAttributeStorage(std::pmr::string name, std::vector<index> starts,
+                                std::vector<std::pmr::memory_resource*> resources = {})
+    : NodeAttributeStorageBase{std::move(name), typeid(ShardedNodeAttributeStorage<T>)},
+      starts{std::move(starts)}, attrSet{getResource()} {
+        if (this->starts.empty() || this->starts[0] != 0
+            || std::adjacent_find(this->starts.begin(), this->starts.end(), std::greater_equal<>{})
+                   != this->starts.end()) {
+            throw std::runtime_error("Shard starts must begin with 0 and increase");
+        }
+        if (!resources.empty() && resources.size() != this->starts.size()) {
+            throw std::runtime_error("Need one resource per shard");
+        }
+        width = this->starts.size() > 1 ? this->starts[1] : 0;
+        for (index s = 0; s < this->starts.size(); ++s) {
+            if (this->starts[s] != s * width) {
+                width = 0;
+            }
+            shards.push_back(std::make_unique<Shard>());
+            shards.back()->storage = makeStorage(resources.empty() ? columnResource() : resources[s]);
+        }
+    }
+    
+    ~ShardedNodeAttributeStorage() override {
+        invalidateAttributes();
+    }
+    
+    void invalidateAttributes() override {
+        for (auto att: attrSet) att->invalidateAttribute();
+    }
+    
+    index shardCount() const {
+        return shards.size();
+    }
+    
+    // Shard holding node i; O(1) for shards of equal width.
+    index shardOf(index i) const {
+        if (width) {
+            return std::min(i / width, starts.size() - 1);
+        }
+        return index(std::upper_bound(starts.begin(), starts.end(), i) - starts.begin()) - 1;
+    }
+    
+    index shardBegin(index s) const {
+        return starts.at(s);
+    }
+    
+    std::size_t size() const {
+        std::size_t n = 0;
+        for (auto& shard : shards) {
+            std::shared_lock<std::shared_mutex> lock{shard->mutex};
+            n += shard->storage->size();
+        }
+        return n;
+    }
+    
+    std::size_t memoryUsage() const override {
+        auto bytes = NodeAttributeStorageBase::memoryUsage();
+        for (auto& shard : shards) {
+            std::shared_lock<std::shared_mutex> lock{shard->mutex};
+            bytes += shard->storage->memoryUsage();
+        }
+        return bytes;
+    }
+    
+    bool isValid(index i) const {
+        auto& shard = *shards[shardOf(i)];
+        std::shared_lock<std::shared_mutex> lock{shard.mutex};
+        return shard.storage->isValid(i - starts[shardOf(i)]);
+    }
+    
+    std::optional<T> get(index i) const {
+        auto s = shardOf(i);
+        std::shared_lock<std::shared_mutex> lock{shards[s]->mutex};
+        return shards[s]->storage->get(i - starts[s]);
+    }
+    
+    void set(index i, T v) {
+        checkTransaction();
+        auto s = shardOf(i);
+        std::unique_lock<std::shared_mutex> lock{shards[s]->mutex};
+        shards[s]->storage->set(i - starts[s], std::move(v));
+        shards[s]->dirty = true;
+    }
+    
+    void invalidate(index i) override {
+        checkTransaction();
+        auto s = shardOf(i);
+        std::unique_lock<std::shared_mutex> lock{shards[s]->mutex};
+        shards[s]->storage->invalidate(i - starts[s]);
+        shards[s]->dirty = true;
+    }
+    
+    // Runs f(storage, begin) with shard s locked exclusively, for batches
+    // of writes by the owner of a partition; storage uses local indices
+    // (node begin + k is slot k). Marks the shard dirty.
+    template<typename F>
+    void update(index s, F f) {
+        checkTransaction();
+        auto& shard = *shards.at(s);
+        std::unique_lock<std::shared_mutex> lock{shard.mutex};
+        f(*shard.storage, starts[s]);
+        shard.dirty = true;
+    }
+    
+    // Calls f(i, value) for the valid nodes of shard s in id order, with
+    // the shard locked for reading.
+    template<typename F>
+    void forEach(index s, F f) const {
+        auto& shard = *shards.at(s);
+        std::shared_lock<std::shared_mutex> lock{shard.mutex};
+        auto begin = starts[s];
+        shard.storage->forEach([&](index k, T const& v) { f(begin + k, v); });
+    }
+    
+    template<typename F>
+    void forEach(F f) const {
+        for (index s = 0; s < shards.size(); ++s) {
+            forEach(s, f);
+        }
+    }
+    
+    // Whether shard s changed since it was last saved or loaded.
+    bool isDirty(index s) const {
+        return shards.at(s)->dirty;
+    }
+    
+    std::vector<index> dirtyShards() const {
+        std::vector<index> dirty;
+        for (index s = 0; s < shards.size(); ++s) {
+            if (shards[s]->dirty) {
+                dirty.push_back(s);
+            }
+        }
+        return dirty;
+    }
+    
+    // Writes shard s alone, e.g. for per-shard checkpoints.
+    void saveShard(index s, std::ostream& out) const {
+        auto& shard = *shards.at(s);
+        std::shared_lock<std::shared_mutex> lock{shard.mutex};
+        shard.storage->save(out);
+        shard.dirty = false;
+    }
+    
+    void loadShard(index s, std::istream& in) {
+        checkTransaction();
+        auto& shard = *shards.at(s);
+        std::unique_lock<std::shared_mutex> lock{shard.mutex};
+        shard.storage->load(in);
+        shard.dirty = false;
+    }
+    
+    void save(std::ostream& out) const override {
+        writeVector(out, starts);
+        for (index s = 0; s < shards.size(); ++s) {
+            saveShard(s, out);
+        }
+    }
+    
+    void load(std::istream& in) override {
+        std::vector<index> saved;
+        readVector(in, saved);
+        if (saved != starts) {
+            throw std::runtime_error("Sharded attribute saved with other shards");
+        }
+        for (index s = 0; s < shards.size(); ++s) {
+            loadShard(s, in);
+        }
+    }
+    
+    // Clones every shard copy-on-write, on the same resources.
+    std::shared_ptr<NodeAttributeStorageBase> clone(std::pmr::string name) const override {
+        auto resource = name.get_allocator().resource();
+        auto copy = std::allocate_shared<ShardedNodeAttributeStorage>(
+            std::pmr::polymorphic_allocator<ShardedNodeAttributeStorage>{resource},
+            std::move(name), starts);
+        for (index s = 0; s < shards.size(); ++s) {
+            std::shared_lock<std::shared_mutex> lock{shards[s]->mutex};
+            copy->shards[s]->storage = std::static_pointer_cast<NodeAttributeStorage<T>>(
+                shards[s]->storage->clone(std::pmr::string{resource}));
+        }
+        return copy;
+    }
+    
+private:
+    struct Shard {
+        std::shared_ptr<NodeAttributeStorage<T>> storage;
+        mutable std::shared_mutex mutex;
+        mutable std::atomic<bool> dirty{false};
+    };
+    
+    std::shared_ptr<NodeAttributeStorage<T>> makeStorage(std::pmr::memory_resource* values) {
+        return std::allocate_shared<NodeAttributeStorage<T>>(
+            std::pmr::polymorphic_allocator<NodeAttributeStorage<T>>{getResource()},
+            std::pmr::string{getResource()}, values);
+    }
+    
+    // The shards never join a transaction, so writes check here.
+    void checkTransaction() const {
+        if (isInTransaction()) {
+            throw std::runtime_error("Transactions are not supported for sharded attributes");
+        }
+    }
+    
+    void logUndo(UndoLog&, index) override {
+        throw std::runtime_error("Transactions are not supported for sharded attributes");
+    }
+    
+    std::vector<index> starts;
+    index width = 0; // of every shard if they are equally wide, else 0
+    std::vector<std::unique_ptr<Shard>> shards;
+    
+    friend class ShardedNodeAttribute<T>;
+    friend class AttributeHandle<ShardedNodeAttributeStorage<T>>;
+    std::pmr::unordered_set<AttributeHandle<ShardedNodeAttributeStorage<T>>*> attrSet;
+}; // class ShardedNodeAttributeStorage<T>
+
+template<typename T>
+class ShardedNodeAttribute : public AttributeHandle<ShardedNodeAttributeStorage<T>> {
+public:
+    explicit ShardedNodeAttribute(std::shared_ptr<ShardedNodeAttributeStorage<T>> owned_storage)
+    : AttributeHandle<ShardedNodeAttributeStorage<T>>{std::move(owned_storage)} { }
+    
+    using AttributeHandle<ShardedNodeAttributeStorage<T>>::checkAttribute;
+    
+    auto size() {
+        return owned_storage->size();
+    }
+    
+    auto shardCount() {
+        return owned_storage->shardCount();
+    }
+    
+    auto shardOf(index i) {
+        return owned_storage->shardOf(i);
+    }
+    
+    bool isValid(index i) {
+        checkAttribute();
+        return owned_storage->isValid(i);
+    }
+    
+    auto get(index i) {
+        checkAttribute();
+        return owned_storage->get(i);
+    }
+    
+    void set(index i, T v) {
+        checkAttribute();
+        owned_storage->set(i, std::move(v));
+    }
+    
+    void invalidate(index i) {
+        checkAttribute();
+        owned_storage->invalidate(i);
+    }
+    
+    template<typename F>
+    void update(index s, F f) {
+        checkAttribute();
+        owned_storage->update(s, f);
+    }
+    
+    template<typename F>
+    void forEach(index s, F f) {
+        checkAttribute();
+        owned_storage->forEach(s, f);
+    }
+    
+    template<typename F>
+    void forEach(F f) {
+        checkAttribute();
+        owned_storage->forEach(f);
+    }
+    
+    auto dirtyShards() {
+        checkAttribute();
+        return owned_storage->dirtyShards();
+    }
+    
+    void saveShard(index s, std::ostream& out) {
+        checkAttribute();
+        owned_storage->saveShard(s, out);
+    }
+    
+    void loadShard(index s, std::istream& in) {
+        checkAttribute();
+        owned_storage->loadShard(s, in);
+    }
+    
+private:
+    using AttributeHandle<ShardedNodeAttributeStorage<T>>::owned_storage;
+}; // class ShardedNodeAttribute
+
+// Attaches an attribute split into shards starting at the given nodes,
+// optionally with one resource per shard, e.g. nodeResource(node).
+// Without them, every shard allocates from the values resource of map.
+template<typename T>
+auto attachSharded(NodeAttributeMap& map, std::string_view name, std::vector<index> starts,
+                   std::vector<std::pmr::memory_resource*> resources = {}) {
+    if (resources.empty()) {
+        resources.assign(starts.size(), map.getColumnResource());
+    }
+    return ShardedNodeAttribute<T>{
+        map.attachStorage<ShardedNodeAttributeStorage<T>>(name, std::move(starts), std::move(resources))};
+}
+
+// Attaches an attribute split into shards of width nodes each.
+template<typename T>
+auto attachSharded(NodeAttributeMap& map, std::string_view name, index shards, index width,
+                   std::vector<std::pmr::memory_resource*> resources = {}) {
+    std::vector<index> starts(shards);
+    for (index s = 0; s < shards; ++s) {
+        starts[s] = s * width;
+    }
+    return attachSharded<T>(map, name, std::move(starts), std::move(resources));
+}
+
+template<typename T>
+auto getSharded(NodeAttributeMap& map, std::string_view name) {
+    return ShardedNodeAttribute<T>{map.getStorage<ShardedNodeAttributeStorage<T>>(name)};
+}
+
+} // namespace Attributes
+
+#endif /* Sharded_h */
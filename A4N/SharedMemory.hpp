@@ -0,0 +1,174 @@
+//
+//  SharedMemory.hpp
+//  A4N
+//
+
+#ifndef SharedMemory_h
+#define SharedMemory_h
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <typeinfo>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Attributes.hpp"
+
+namespace Attributes {
+
+// One attribute in a POSIX shared memory segment (shm_open + mmap), so
+// that processes attaching it share one physical copy. The layout only
+// uses offsets from the start of the segment, so it may be mapped at any
+// address: a header, the validity words at validityOffset and the values
+// at valuesOffset (page aligned). The capacity is fixed at creation;
+// pages are only backed once written.
+class SharedSegment {
+public:
+    static constexpr char magic[8] = {'A', '4', 'N', 'S', 'H', 'M', '0', '1'};
+    
+    struct Header {
+        char magic[8];
+        std::uint64_t valueSize;
+        std::uint64_t typeHash; // of the typeid name of the values
+        std::uint64_t capacity; // nodes
+        std::uint64_t validityOffset;
+        std::uint64_t valuesOffset;
+    };
+    
+    // Creates the segment `name` (e.g. "/graph.weight"), replacing one of
+    // the same name, with room for capacity values of the given size.
+    static std::shared_ptr<SharedSegment> create(std::string const& name, std::size_t valueSize,
+                                                 hash_t typeHash, index capacity) {
+        Header h{};
+        h.valueSize = valueSize;
+        h.typeHash = typeHash;
+        h.capacity = capacity;
+        h.validityOffset = sizeof(Header);
+        auto words = (capacity + Bitmap::wordBits - 1) / Bitmap::wordBits;
+        h.valuesOffset = (h.validityOffset + words * sizeof(Bitmap::word) + pageSize - 1) / pageSize * pageSize;
+        auto bytes = h.valuesOffset + capacity * valueSize;
+        int fd = shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0600);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot create shared memory segment");
+        }
+        if (ftruncate(fd, off_t(bytes)) != 0) {
+            close(fd);
+            shm_unlink(name.c_str());
+            throw std::runtime_error("Cannot size shared memory segment");
+        }
+        auto segment = std::shared_ptr<SharedSegment>{new SharedSegment{fd, bytes, false}};
+        std::memcpy(h.magic, magic, sizeof(magic));
+        std::memcpy(segment->base, &h, sizeof(h));
+        return segment;
+    }
+    
+    // Maps the existing segment `name`, read-only unless writable.
+    static std::shared_ptr<SharedSegment> open(std::string const& name, bool writable = false) {
+        int fd = shm_open(name.c_str(), writable ? O_RDWR : O_RDONLY, 0);
+        if (fd < 0) {
+            throw std::runtime_error("No such shared memory segment");
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || std::size_t(st.st_size) < sizeof(Header)) {
+            close(fd);
+            throw std::runtime_error("Not a shared attribute segment");
+        }
+        auto segment = std::shared_ptr<SharedSegment>{new SharedSegment{fd, std::size_t(st.st_size), !writable}};
+        auto& h = segment->header();
+        if (std::memcmp(h.magic, magic, sizeof(magic))
+            || h.valuesOffset + h.capacity * h.valueSize > segment->bytes) {
+            throw std::runtime_error("Not a shared attribute segment");
+        }
+        return segment;
+    }
+    
+    // Removes the name; mappings stay valid until they are unmapped.
+    static void remove(std::string const& name) {
+        shm_unlink(name.c_str());
+    }
+    
+    SharedSegment(SharedSegment const&) = delete;
+    SharedSegment& operator=(SharedSegment const&) = delete;
+    
+    ~SharedSegment() {
+        munmap(base, bytes);
+    }
+    
+    Header const& header() const {
+        return *static_cast<Header const*>(base);
+    }
+    
+    void* at(std::uint64_t offset) const {
+        return static_cast<char*>(base) + offset;
+    }
+    
+    bool isReadOnly() const {
+        return readOnly;
+    }
+    
+private:
+    static constexpr std::size_t pageSize = 4096;
+    
+    SharedSegment(int fd, std::size_t bytes, bool readOnly)
+    : bytes{bytes}, readOnly{readOnly} {
+        base = mmap(nullptr, bytes, readOnly ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (base == MAP_FAILED) {
+            throw std::runtime_error("Cannot map shared memory segment");
+        }
+    }
+    
+    void* base;
+    std::size_t bytes;
+    bool readOnly;
+}; // class SharedSegment
+
+template<typename T>
+hash_t sharedTypeHash() {
+    auto name = typeid(T).name();
+    return hashBytes(name, std::strlen(name));
+}
+
+template<typename T>
+auto attachSegment(NodeAttributeMap& map, std::string_view name, std::shared_ptr<SharedSegment> segment) {
+    auto& h = segment->header();
+    if (h.valueSize != sizeof(T) || h.typeHash != sharedTypeHash<T>()) {
+        throw std::runtime_error("Type mismatch in shared attribute");
+    }
+    auto storage = map.attachStorage<NodeAttributeStorage<T>>(name);
+    auto validity = static_cast<Bitmap::word*>(segment->at(h.validityOffset));
+    auto values = static_cast<T*>(segment->at(h.valuesOffset));
+    auto readOnly = segment->isReadOnly();
+    storage->adopt(std::move(segment), validity, values, h.capacity, readOnly);
+    return NodeAttribute<T>{storage};
+}
+
+// Attaches a new attribute with room for capacity nodes in the shared
+// memory segment `segment`. Other processes attach it by that name.
+template<typename T>
+auto attachShared(NodeAttributeMap& map, std::string_view name, std::string const& segment,
+                  index capacity) {
+    static_assert(std::is_trivially_copyable_v<T>, "shared attributes hold trivially copyable values");
+    return attachSegment<T>(map, name, SharedSegment::create(segment, sizeof(T), sharedTypeHash<T>(), capacity));
+}
+
+// Attaches an existing segment. Read-only attachments map it without
+// write permission and throw on every write; their size() counts the
+// values valid at the time of attaching. Writes by other processes are
+// visible immediately but without ordering.
+template<typename T>
+auto openShared(NodeAttributeMap& map, std::string_view name, std::string const& segment,
+                bool writable = false) {
+    static_assert(std::is_trivially_copyable_v<T>, "shared attributes hold trivially copyable values");
+    return attachSegment<T>(map, name, SharedSegment::open(segment, writable));
+}
+
+} // namespace Attributes
+
+#endif /* SharedMemory_h */
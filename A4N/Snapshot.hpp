@@ -0,0 +1,183 @@
+//
+//  Snapshot.hpp
+//  A4N
+//
+
+#ifndef Snapshot_h
+#define Snapshot_h
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <limits>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "Serialize.hpp"
+
+namespace Attributes {
+
+// Save running in a child process, see NodeAttributeMap::backgroundSave().
+// fork(2) gives the child a copy-on-write image of the caller, so it writes
+// the state at the time of the call while the caller keeps mutating; the
+// caller pays for the fork and for every page it modifies meanwhile
+// (reported by overheadBytes() on Linux). The destructor waits for the child.
+// Only the forking thread exists in the child, so save must not wait for
+// other threads or for locks they may have held at the fork, e.g. tasks
+// of IoPool, the Reclaimer, an ingester or a custom memory resource.
+// The child itself starts no threads; the watcher samples its memory.
+class BackgroundSave {
+public:
+    // Runs save in the child; done(success) is called on a watcher thread.
+    BackgroundSave(std::function<void(SaveProgress&)> save, std::function<void(bool)> done = {})
+    : shared{std::make_shared<Shared>()} {
+        auto progress = shared->progress;
+        pid = fork();
+        if (pid < 0) {
+            throw std::runtime_error("Cannot fork for background save");
+        }
+        if (pid == 0) {
+            // Never return to the caller.
+            int status = 0;
+            try {
+                save(*progress);
+            } catch (...) {
+                status = 1;
+            }
+            _exit(status);
+        }
+        result = shared->promise.get_future().share();
+        watcher = std::thread([shared = shared, pid = pid, done = std::move(done)] {
+            int status = 0;
+            auto base = privateDirtyBytes(pid);
+            pid_t exited;
+            while (true) {
+                exited = waitpid(pid, &status, WNOHANG);
+                if (exited == pid || (exited < 0 && errno != EINTR)) {
+                    break;
+                }
+                auto now = privateDirtyBytes(pid);
+                auto extra = now > base ? now - base : 0;
+                auto& overhead = shared->progress->overheadBytes;
+                overhead = std::max<std::size_t>(overhead, extra);
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            }
+            auto success = exited == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+            if (success) {
+                shared->promise.set_value();
+            } else {
+                shared->promise.set_exception(std::make_exception_ptr(
+                    std::runtime_error("Background save failed")));
+            }
+            if (done) {
+                done(success);
+            }
+        });
+    }
+    
+    BackgroundSave(BackgroundSave&&) = default;
+    BackgroundSave& operator=(BackgroundSave&&) = delete;
+    
+    ~BackgroundSave() {
+        if (watcher.joinable()) {
+            watcher.join();
+        }
+    }
+    
+    // Ready when the child has exited; get() throws if the save failed.
+    std::shared_future<void> future() const {
+        return result;
+    }
+    
+    bool ready() const {
+        return result.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }
+    
+    void wait() const {
+        result.get();
+    }
+    
+    pid_t getPid() const {
+        return pid;
+    }
+    
+    std::size_t attributes() const {
+        return shared->progress->attributes;
+    }
+    
+    std::size_t savedAttributes() const {
+        return shared->progress->savedAttributes;
+    }
+    
+    std::size_t bytesWritten() const {
+        return shared->progress->bytesWritten;
+    }
+    
+    // Peak memory duplicated by copy-on-write since the fork, 0 if unknown.
+    std::size_t overheadBytes() const {
+        return shared->progress->overheadBytes;
+    }
+    
+private:
+    // Progress lives in a shared mapping written by the child.
+    struct Shared {
+        Shared() {
+            auto p = mmap(nullptr, sizeof(SaveProgress), PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+            if (p == MAP_FAILED) {
+                throw std::bad_alloc();
+            }
+            progress = new (p) SaveProgress;
+        }
+        
+        ~Shared() {
+            progress->~SaveProgress();
+            munmap(progress, sizeof(SaveProgress));
+        }
+        
+        SaveProgress* progress;
+        std::promise<void> promise;
+    };
+    
+    // Pages the child holds privately; once the caller writes a shared
+    // page, the child keeps the original, so this grows with the overhead.
+    static std::size_t privateDirtyBytes(pid_t pid) {
+        std::size_t total = 0;
+#ifdef __linux__
+        std::ifstream in("/proc/" + std::to_string(pid) + "/smaps_rollup");
+        std::string key;
+        std::size_t kb;
+        while (in >> key) {
+            if (key == "Private_Dirty:" && in >> kb) {
+                total += kb * 1024;
+            }
+            in.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+        }
+#else
+        (void)pid;
+#endif
+        return total;
+    }
+    
+    std::shared_ptr<Shared> shared;
+    pid_t pid;
+    std::shared_future<void> result;
+    std::thread watcher;
+}; // class BackgroundSave
+
+} // namespace Attributes
+
+#endif /* Snapshot_h */
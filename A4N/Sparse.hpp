@@ -0,0 +1,537 @@
+//
+//  Sparse.hpp
+//  A4N
+//
+
+#ifndef Sparse_h
+#define Sparse_h
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "Attributes.hpp"
+
+namespace Attributes {
+
+template<typename T>
+class SparseNodeAttribute;
+
+// Attribute over the full 64-bit index space, e.g. external ids used as
+// node indices, in a radix tree of 8 bits per level. Inner nodes and
+// leaves keep a 256-bit presence bitmap and only their present children
+// or values, in order, found by the rank of their bit (as in Judy arrays
+// and bitwise tries). Lookups take at most 8 steps, iteration is in index
+// order and memory grows with the number of values, not the largest
+// index. The root grows upwards, so small indices need fewer levels.
+// Validity lives in the tree, not in the base class. Writes cannot be
+// undone (slots are not dense enough to track) and throw while the map
+// is in a transaction.
+template<typename T>
+class SparseNodeAttributeStorage : public NodeAttributeStorageBase {
+    static constexpr unsigned digitBits = 8;
+    static constexpr unsigned maxLevels = 64 / digitBits;
+    
+    // Presence of the 256 children of a node.
+    struct Bits {
+        std::uint64_t words[4] = {};
+        
+        bool test(unsigned b) const {
+            return (words[b >> 6] >> (b & 63)) & 1;
+        }
+        
+        void set(unsigned b) {
+            words[b >> 6] |= std::uint64_t{1} << (b & 63);
+        }
+        
+        void reset(unsigned b) {
+            words[b >> 6] &= ~(std::uint64_t{1} << (b & 63));
+        }
+        
+        bool empty() const {
+            return !(words[0] | words[1] | words[2] | words[3]);
+        }
+        
+        // Number of children before b.
+        unsigned rank(unsigned b) const {
+            unsigned r = 0;
+            for (unsigned k = 0; k < (b >> 6); ++k) {
+                r += __builtin_popcountll(words[k]);
+            }
+            return r + __builtin_popcountll(words[b >> 6] & ((std::uint64_t{1} << (b & 63)) - 1));
+        }
+        
+        // First child at or after b, or -1.
+        int next(unsigned b) const {
+            for (unsigned k = b >> 6; k < 4; ++k) {
+                auto w = k == (b >> 6) ? words[k] & (~std::uint64_t{0} << (b & 63)) : words[k];
+                if (w) {
+                    return int(k * 64 + __builtin_ctzll(w));
+                }
+            }
+            return -1;
+        }
+    };
+    
+    struct Inner {
+        explicit Inner(std::pmr::memory_resource* resource)
+        : children(resource) { }
+        Bits present;
+        std::pmr::vector<void*> children; // Inner* or Leaf* one level down
+    };
+    
+    struct Leaf {
+        explicit Leaf(std::pmr::memory_resource* resource)
+        : values(resource) { }
+        Bits present;
+        std::pmr::vector<T> values;
+    };
+    
+public:
+    // Valid slots in index order; values are read-only, see set().
+    class Iterator {
+    public:
+        Iterator(SparseNodeAttributeStorage* storage = nullptr)
+        : storage{storage} {
+            if (storage && storage->root) {
+                nodes[0] = storage->root;
+                descend(0, 0);
+            } else {
+                this->storage = nullptr;
+            }
+        }
+        
+        Iterator& operator++() {
+            if (!storage) {
+                throw std::runtime_error("Invalid attribute iterator");
+            }
+            // Next sibling on the deepest level that has one.
+            for (auto level = storage->levels; level-- > 0;) {
+                if (pos[level] < 255 && descend(level, pos[level] + 1)) {
+                    return *this;
+                }
+            }
+            storage = nullptr;
+            return *this;
+        }
+        
+        T const& operator*() const {
+            auto leaf = static_cast<Leaf const*>(nodes[storage->levels - 1]);
+            return leaf->values[leaf->present.rank(pos[storage->levels - 1])];
+        }
+        
+        index key() const {
+            index i = 0;
+            for (unsigned level = 0; level < storage->levels; ++level) {
+                i = (i << digitBits) | pos[level];
+            }
+            return i;
+        }
+        
+        auto nodeValuePair() {
+            return std::make_pair(key(), **this);
+        }
+        
+        bool operator==(Iterator const& iter) const {
+            if (storage == nullptr || iter.storage == nullptr) {
+                return storage == iter.storage;
+            }
+            return key() == iter.key();
+        }
+        
+        bool operator!=(Iterator const& iter) const {
+            return !(*this == iter);
+        }
+    private:
+        // Moves to the first slot at or after child b of nodes[level].
+        bool descend(unsigned level, unsigned b) {
+            auto last = storage->levels - 1;
+            for (;;) {
+                auto& present = level == last ? static_cast<Leaf*>(nodes[level])->present
+                                              : static_cast<Inner*>(nodes[level])->present;
+                auto next = present.next(b);
+                if (next < 0) {
+                    return false;
+                }
+                pos[level] = unsigned(next);
+                if (level == last) {
+                    return true;
+                }
+                auto inner = static_cast<Inner*>(nodes[level]);
+                nodes[level + 1] = inner->children[inner->present.rank(pos[level])];
+                ++level;
+                b = 0;
+            }
+        }
+        
+        SparseNodeAttributeStorage* storage;
+        std::array<void*, maxLevels> nodes{};
+        std::array<unsigned, maxLevels> pos{};
+    }; // class Iterator
+    
+    explicit SparseNodeAttributeStorage(std::pmr::string name)
+    : NodeAttributeStorageBase{std::move(name), typeid(SparseNodeAttributeStorage<T>)},
+      attrSet{getResource()} { }
+    
+    ~SparseNodeAttributeStorage() override {
+        invalidateAttributes();
+        clear();
+    }
+    
+    void invalidateAttributes() override {
+        for (auto att: attrSet) att->invalidateAttribute();
+    }
+    
+    std::size_t size() const {
+        return count;
+    }
+    
+    std::size_t memoryUsage() const override {
+        return NodeAttributeStorageBase::memoryUsage() + innerNodes * sizeof(Inner)
+            + leafNodes * sizeof(Leaf) + (innerNodes + leafNodes - (root ? 1 : 0)) * sizeof(void*)
+            + count * sizeof(T);
+    }
+    
+    bool contains(index i) const {
+        return find(i) != nullptr;
+    }
+    
+    std::optional<T> get(index i) const {
+        auto v = find(i);
+        return v ? std::optional<T>{*v} : std::nullopt;
+    }
+    
+    void set(index i, T v) {
+        checkWritable();
+        if (!root) {
+            root = makeNode(levelsFor(i) == 1);
+            levels = levelsFor(i);
+        }
+        while (levels < levelsFor(i)) {
+            auto top = make<Inner>();
+            top->present.set(0);
+            top->children.push_back(root);
+            root = top;
+            ++levels;
+        }
+        void* node = root;
+        for (unsigned level = 0; level + 1 < levels; ++level) {
+            auto inner = static_cast<Inner*>(node);
+            auto b = digit(i, level);
+            auto r = inner->present.rank(b);
+            if (!inner->present.test(b)) {
+                inner->children.insert(inner->children.begin() + r, makeNode(level + 2 == levels));
+                inner->present.set(b);
+            }
+            node = inner->children[r];
+        }
+        auto leaf = static_cast<Leaf*>(node);
+        auto b = digit(i, levels - 1);
+        auto r = leaf->present.rank(b);
+        if (leaf->present.test(b)) {
+            leaf->values[r] = std::move(v);
+        } else {
+            leaf->values.insert(leaf->values.begin() + r, std::move(v));
+            leaf->present.set(b);
+            ++count;
+        }
+    }
+    
+    // Removes slot i and every node it leaves empty.
+    void invalidate(index i) override {
+        checkWritable();
+        if (!find(i)) {
+            return;
+        }
+        std::array<Inner*, maxLevels> path{};
+        void* node = root;
+        for (unsigned level = 0; level + 1 < levels; ++level) {
+            path[level] = static_cast<Inner*>(node);
+            node = path[level]->children[path[level]->present.rank(digit(i, level))];
+        }
+        auto leaf = static_cast<Leaf*>(node);
+        auto b = digit(i, levels - 1);
+        leaf->values.erase(leaf->values.begin() + leaf->present.rank(b));
+        leaf->present.reset(b);
+        --count;
+        if (!leaf->present.empty()) {
+            return;
+        }
+        destroy(leaf, levels - 1);
+        for (auto level = levels - 1; level-- > 0;) {
+            auto inner = path[level];
+            auto c = digit(i, level);
+            inner->children.erase(inner->children.begin() + inner->present.rank(c));
+            inner->present.reset(c);
+            if (!inner->present.empty()) {
+                return;
+            }
+            destroy(inner, level);
+        }
+        root = nullptr;
+        levels = 0;
+    }
+    
+    void clear() {
+        if (root) {
+            destroy(root, 0);
+        }
+        root = nullptr;
+        levels = 0;
+        count = 0;
+    }
+    
+    Iterator begin() {
+        return Iterator{this};
+    }
+    
+    Iterator end() {
+        return Iterator{};
+    }
+    
+    // Calls f(i, value) for every slot in index order.
+    template<typename F>
+    void forEach(F f) {
+        for (auto it = begin(); it != end(); ++it) {
+            f(it.key(), *it);
+        }
+    }
+    
+    void save(std::ostream& out) const override {
+        writeValue<std::uint64_t>(out, count);
+        for (auto it = const_cast<SparseNodeAttributeStorage*>(this)->begin(); it != Iterator{}; ++it) {
+            writeValue<std::uint64_t>(out, it.key());
+            writeValue(out, *it);
+        }
+    }
+    
+    void load(std::istream& in) override {
+        checkWritable();
+        clear();
+        auto n = readValue<std::uint64_t>(in);
+        for (std::uint64_t k = 0; k < n; ++k) {
+            auto i = readValue<std::uint64_t>(in);
+            set(i, readValue<T>(in));
+        }
+    }
+    
+    // Deep copy of the tree.
+    std::shared_ptr<NodeAttributeStorageBase> clone(std::pmr::string name) const override {
+        auto resource = name.get_allocator().resource();
+        auto copy = std::allocate_shared<SparseNodeAttributeStorage>(
+            std::pmr::polymorphic_allocator<SparseNodeAttributeStorage>{resource}, std::move(name));
+        if (root) {
+            copy->root = copy->copyNode(root, 0, levels);
+        }
+        copy->levels = levels;
+        copy->count = count;
+        return copy;
+    }
+    
+private:
+    // Levels needed for index i.
+    static unsigned levelsFor(index i) {
+        unsigned n = 1;
+        while (n < maxLevels && (i >> (n * digitBits))) {
+            ++n;
+        }
+        return n;
+    }
+    
+    unsigned digit(index i, unsigned level) const {
+        return unsigned(i >> ((levels - 1 - level) * digitBits)) & 0xff;
+    }
+    
+    T const* find(index i) const {
+        if (!root || levelsFor(i) > levels) {
+            return nullptr;
+        }
+        void const* node = root;
+        for (unsigned level = 0; level + 1 < levels; ++level) {
+            auto inner = static_cast<Inner const*>(node);
+            auto b = digit(i, level);
+            if (!inner->present.test(b)) {
+                return nullptr;
+            }
+            node = inner->children[inner->present.rank(b)];
+        }
+        auto leaf = static_cast<Leaf const*>(node);
+        auto b = digit(i, levels - 1);
+        return leaf->present.test(b) ? &leaf->values[leaf->present.rank(b)] : nullptr;
+    }
+    
+    template<typename N>
+    N* make() {
+        std::pmr::polymorphic_allocator<N> alloc{getResource()};
+        auto p = alloc.allocate(1);
+        ::new (p) N{getResource()};
+        ++(std::is_same_v<N, Leaf> ? leafNodes : innerNodes);
+        return p;
+    }
+    
+    void* makeNode(bool leaf) {
+        return leaf ? static_cast<void*>(make<Leaf>()) : static_cast<void*>(make<Inner>());
+    }
+    
+    // Frees node at level and everything below it.
+    void destroy(void* node, unsigned level) {
+        if (level + 1 == levels) {
+            auto leaf = static_cast<Leaf*>(node);
+            leaf->~Leaf();
+            std::pmr::polymorphic_allocator<Leaf>{getResource()}.deallocate(leaf, 1);
+            --leafNodes;
+        } else {
+            auto inner = static_cast<Inner*>(node);
+            for (auto child : inner->children) {
+                destroy(child, level + 1);
+            }
+            inner->~Inner();
+            std::pmr::polymorphic_allocator<Inner>{getResource()}.deallocate(inner, 1);
+            --innerNodes;
+        }
+    }
+    
+    void* copyNode(void const* node, unsigned level, unsigned height) {
+        if (level + 1 == height) {
+            auto leaf = make<Leaf>();
+            leaf->present = static_cast<Leaf const*>(node)->present;
+            leaf->values = static_cast<Leaf const*>(node)->values;
+            return leaf;
+        }
+        auto from = static_cast<Inner const*>(node);
+        auto inner = make<Inner>();
+        inner->present = from->present;
+        for (auto child : from->children) {
+            inner->children.push_back(copyNode(child, level + 1, height));
+        }
+        return inner;
+    }
+    
+    // Stands in for touch(), whose per-slot bookkeeping would span the
+    // largest index.
+    void checkWritable() const {
+        if (readOnly) {
+            throw std::runtime_error("Attribute is read-only");
+        }
+        if (isInTransaction()) {
+            throw std::runtime_error("Transactions are not supported for sparse attributes");
+        }
+    }
+    
+    void logUndo(UndoLog&, index) override {
+        throw std::runtime_error("Transactions are not supported for sparse attributes");
+    }
+    
+    void* root = nullptr;
+    unsigned levels = 0; // including the leaves
+    std::size_t count = 0;
+    std::size_t innerNodes = 0;
+    std::size_t leafNodes = 0;
+    
+    friend class SparseNodeAttribute<T>;
+    friend class AttributeHandle<SparseNodeAttributeStorage<T>>;
+    std::pmr::unordered_set<AttributeHandle<SparseNodeAttributeStorage<T>>*> attrSet;
+}; // class SparseNodeAttributeStorage<T>
+
+// Handle with the interface of NodeAttribute<T> over a sparse storage.
+template<typename T>
+class SparseNodeAttribute : public AttributeHandle<SparseNodeAttributeStorage<T>> {
+    using Storage = SparseNodeAttributeStorage<T>;
+    
+    class IndexProxy {
+    public:
+        IndexProxy(Storage* storage, index idx)
+        : storage{storage}, idx{idx} {}
+        
+        // reading at idx
+        operator T() {
+            auto v = storage->get(idx);
+            if (!v) {
+                throw std::runtime_error("Invalid attribute value");
+            }
+            return *v;
+        }
+        
+        // writing at idx
+        IndexProxy& operator=(T const& other) {
+            storage->set(idx, other);
+            return *this;
+        }
+    private:
+        Storage* storage;
+        index idx;
+    }; // class IndexProxy
+public:
+    explicit SparseNodeAttribute(std::shared_ptr<Storage> owned_storage)
+    : AttributeHandle<Storage>{std::move(owned_storage)} { }
+    
+    using AttributeHandle<Storage>::checkAttribute;
+    
+    auto begin() {
+        checkAttribute();
+        return owned_storage->begin();
+    }
+    
+    auto end() {
+        return owned_storage->end();
+    }
+    
+    auto size() {
+        return owned_storage->size();
+    }
+    
+    bool isValid(index i) {
+        checkAttribute();
+        return owned_storage->contains(i);
+    }
+    
+    void set(index i, T v) {
+        checkAttribute();
+        owned_storage->set(i, std::move(v));
+    }
+    
+    auto get(index i) {
+        checkAttribute();
+        return owned_storage->get(i);
+    }
+    
+    IndexProxy operator[](index i) {
+        checkAttribute();
+        return IndexProxy(owned_storage.get(), i);
+    }
+    
+    void invalidate(index i) {
+        checkAttribute();
+        owned_storage->invalidate(i);
+    }
+    
+    template<typename F>
+    void forEach(F f) {
+        checkAttribute();
+        owned_storage->forEach(f);
+    }
+    
+private:
+    using AttributeHandle<Storage>::owned_storage;
+}; // class SparseNodeAttribute
+
+template<typename T>
+auto attachSparse(NodeAttributeMap& map, std::string_view name) {
+    return SparseNodeAttribute<T>{map.attachStorage<SparseNodeAttributeStorage<T>>(name)};
+}
+
+template<typename T>
+auto getSparse(NodeAttributeMap& map, std::string_view name) {
+    return SparseNodeAttribute<T>{map.getStorage<SparseNodeAttributeStorage<T>>(name)};
+}
+
+} // namespace Attributes
+
+#endif /* Sparse_h */
@@ -0,0 +1,369 @@
+//
+//  Temporal.hpp
+//  A4N
+//
+
+#ifndef Temporal_h
+#define Temporal_h
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_set>
+#include <vector>
+
+#include "Attributes.hpp"
+
+namespace Attributes {
+
+template<typename T>
+class TemporalNodeAttribute;
+
+// How samples advance in a TemporalNodeAttributeStorage.
+enum class Ticks {
+    Synchronous,  // one shared head, all nodes advance with tick()
+    Asynchronous  // every node advances on its own record()
+};
+
+// The last `window` samples of every node in one ring buffer.
+// Samples are stored slot-major (samples[slot * stride + node]), so the
+// windowed aggregates run over contiguous node ranges and vectorise.
+// Writes, ticks and loads cannot be undone and throw while the map is in
+// a transaction.
+template<typename T>
+class TemporalNodeAttributeStorage : public NodeAttributeStorageBase {
+    static_assert(std::is_arithmetic_v<T>, "temporal attributes hold arithmetic samples");
+public:
+    TemporalNodeAttributeStorage(std::pmr::string name, index window, Ticks ticks)
+    : NodeAttributeStorageBase{std::move(name), typeid(TemporalNodeAttributeStorage<T>)},
+      window{window}, ticks{ticks}, samples{getResource()}, since{getResource()},
+      heads{getResource()}, counts{getResource()}, attrSet{getResource()} {
+        if (window == 0) {
+            throw std::runtime_error("Temporal attribute needs a window of at least one sample");
+        }
+    }
+    
+    ~TemporalNodeAttributeStorage() override {
+        invalidateAttributes();
+    }
+    
+    void invalidateAttributes() override {
+        for (auto att: attrSet) att->invalidateAttribute();
+    }
+    
+    auto size() {
+        return validElements;
+    }
+    
+    std::size_t memoryUsage() const override {
+        return NodeAttributeStorageBase::memoryUsage() + samples.capacity() * sizeof(T)
+            + since.capacity() * sizeof(index)
+            + (heads.capacity() + counts.capacity()) * sizeof(std::uint32_t);
+    }
+    
+    // Deep copy; samples are not shared.
+    std::shared_ptr<NodeAttributeStorageBase> clone(std::pmr::string name) const override {
+        auto resource = name.get_allocator().resource();
+        auto copy = std::allocate_shared<TemporalNodeAttributeStorage>(
+            std::pmr::polymorphic_allocator<TemporalNodeAttributeStorage>{resource},
+            std::move(name), window, ticks);
+        copy->copyState(*this);
+        copy->stride = stride;
+        copy->samples = samples;
+        copy->latest = latest;
+        copy->now = now;
+        copy->since = since;
+        copy->heads = heads;
+        copy->counts = counts;
+        return copy;
+    }
+    
+    void save(std::ostream& out) const override {
+        saveValidity(out);
+        writeValue<std::uint64_t>(out, window);
+        writeValue<std::uint64_t>(out, static_cast<std::uint64_t>(ticks));
+        writeValue<std::uint64_t>(out, stride);
+        writeValue<std::uint64_t>(out, latest);
+        writeValue<std::uint64_t>(out, now);
+        writeVector(out, samples);
+        writeVector(out, since);
+        writeVector(out, heads);
+        writeVector(out, counts);
+    }
+    
+    void load(std::istream& in) override {
+        checkTransaction();
+        loadValidity(in);
+        if (readValue<std::uint64_t>(in) != window
+            || readValue<std::uint64_t>(in) != static_cast<std::uint64_t>(ticks)) {
+            throw std::runtime_error("Temporal attribute saved with another window or ticks");
+        }
+        stride = readValue<std::uint64_t>(in);
+        latest = readValue<std::uint64_t>(in);
+        now = readValue<std::uint64_t>(in);
+        readVector(in, samples);
+        readVector(in, since);
+        readVector(in, heads);
+        readVector(in, counts);
+    }
+    
+    index getWindow() const {
+        return window;
+    }
+    
+    Ticks getTicks() const {
+        return ticks;
+    }
+    
+    // Synchronous mode: opens the next sample slot for all nodes.
+    // Nodes not recorded in the new tick keep their previous value.
+    void tick() {
+        if (ticks != Ticks::Synchronous) {
+            throw std::runtime_error("tick() on asynchronous temporal attribute");
+        }
+        checkTransaction();
+        auto next = (latest + 1) % window;
+        std::copy_n(samples.begin() + latest * stride, stride, samples.begin() + next * stride);
+        latest = next;
+        ++now;
+    }
+    
+    // Synchronous mode: sets the sample of node i in the current tick.
+    // Asynchronous mode: appends a sample to the window of node i.
+    void record(index i, T v) {
+        checkTransaction();
+        reserve(i + 1);
+        touch(i);
+        if (ticks == Ticks::Synchronous) {
+            if (!isValid(i)) {
+                since[i] = now;
+            }
+            samples[latest * stride + i] = v;
+        } else {
+            if (!isValid(i)) {
+                counts[i] = 0;
+            }
+            samples[heads[i] * stride + i] = v;
+            heads[i] = static_cast<std::uint32_t>((heads[i] + 1) % window);
+            counts[i] = static_cast<std::uint32_t>(std::min<index>(counts[i] + 1, window));
+        }
+        markValid(i);
+    }
+    
+    void invalidate(index i) override {
+        checkTransaction();
+        NodeAttributeStorageBase::invalidate(i);
+    }
+    
+    // Number of samples in the window of node i.
+    index count(index i) {
+        if (!isValid(i)) {
+            return 0;
+        }
+        return ticks == Ticks::Synchronous
+            ? std::min<index>(window, now - since[i] + 1)
+            : counts[i];
+    }
+    
+    // Sample of node i taken `age` steps before the latest one.
+    std::optional<T> sample(index i, index age = 0) {
+        if (age >= count(i)) {
+            return std::nullopt;
+        }
+        return samples[slot(i, age) * stride + i];
+    }
+    
+    // Windowed aggregates for all nodes; NaN for nodes without samples.
+    std::vector<double> mean() {
+        std::vector<double> sum(stride, 0.0);
+        auto n = windowCounts();
+        for (index age = 0; age < window; ++age) {
+            forRow(age, [&](index i, T x) {
+                sum[i] += age < n[i] ? x : 0;
+            });
+        }
+        for (index i = 0; i < stride; ++i) {
+            sum[i] = n[i] ? sum[i] / n[i] : std::numeric_limits<double>::quiet_NaN();
+        }
+        return sum;
+    }
+    
+    std::vector<double> max() {
+        std::vector<double> best(stride, -std::numeric_limits<double>::infinity());
+        auto n = windowCounts();
+        for (index age = 0; age < window; ++age) {
+            forRow(age, [&](index i, T x) {
+                best[i] = age < n[i] && x > best[i] ? x : best[i];
+            });
+        }
+        for (index i = 0; i < stride; ++i) {
+            best[i] = n[i] ? best[i] : std::numeric_limits<double>::quiet_NaN();
+        }
+        return best;
+    }
+    
+    // Exponentially weighted mean, oldest sample first:
+    // e = alpha * x + (1 - alpha) * e.
+    std::vector<double> ewma(double alpha) {
+        std::vector<double> e(stride, std::numeric_limits<double>::quiet_NaN());
+        auto n = windowCounts();
+        for (index age = window; age-- > 0;) {
+            forRow(age, [&](index i, T x) {
+                auto first = age + 1 == n[i];
+                auto next = first ? double(x) : alpha * x + (1 - alpha) * e[i];
+                e[i] = age < n[i] ? next : e[i];
+            });
+        }
+        return e;
+    }
+    
+private:
+    // Slot of the sample of node i taken age steps before the latest.
+    index slot(index i, index age) {
+        auto newest = ticks == Ticks::Synchronous ? latest : (heads[i] + window - 1) % window;
+        return (newest + window - age) % window;
+    }
+    
+    // Calls f(i, sample) for all nodes at the given age.
+    template<typename F>
+    void forRow(index age, F f) {
+        if (ticks == Ticks::Synchronous) {
+            auto row = samples.data() + slot(0, age) * stride;
+            for (index i = 0; i < stride; ++i) {
+                f(i, row[i]);
+            }
+        } else {
+            for (index i = 0; i < stride; ++i) {
+                f(i, samples[slot(i, age) * stride + i]);
+            }
+        }
+    }
+    
+    std::vector<index> windowCounts() {
+        std::vector<index> n(stride);
+        for (index i = 0; i < stride; ++i) {
+            n[i] = count(i);
+        }
+        return n;
+    }
+    
+    // Grows the node dimension geometrically; rows are re-laid out.
+    void reserve(index nodes) {
+        if (nodes <= stride) {
+            return;
+        }
+        auto grown = std::max(nodes, 2 * stride);
+        std::pmr::vector<T> relaid(window * grown, getResource());
+        for (index s = 0; s < window; ++s) {
+            std::copy_n(samples.begin() + s * stride, stride, relaid.begin() + s * grown);
+        }
+        samples.swap(relaid);
+        stride = grown;
+        if (ticks == Ticks::Synchronous) {
+            since.resize(grown);
+        } else {
+            heads.resize(grown);
+            counts.resize(grown);
+        }
+    }
+    
+    // tick() writes no slot, and touch() marks a slot as logged before
+    // logUndo() throws, so writes check here first.
+    void checkTransaction() const {
+        if (isInTransaction()) {
+            throw std::runtime_error("Transactions are not supported for temporal attributes");
+        }
+    }
+    
+    void logUndo(UndoLog&, index) override {
+        throw std::runtime_error("Transactions are not supported for temporal attributes");
+    }
+    
+    index window;
+    Ticks ticks;
+    index stride = 0;        // node capacity of one slot
+    std::pmr::vector<T> samples;  // window * stride
+    // Synchronous
+    index latest = 0;        // slot of the current tick
+    index now = 0;           // number of ticks so far
+    std::pmr::vector<index> since; // tick of the first sample per node
+    // Asynchronous
+    std::pmr::vector<std::uint32_t> heads;  // next slot per node
+    std::pmr::vector<std::uint32_t> counts; // samples per node
+    
+    friend class TemporalNodeAttribute<T>;
+    friend class AttributeHandle<TemporalNodeAttributeStorage<T>>;
+    std::pmr::unordered_set<AttributeHandle<TemporalNodeAttributeStorage<T>>*> attrSet;
+}; // class TemporalNodeAttributeStorage<T>
+
+template<typename T>
+class TemporalNodeAttribute : public AttributeHandle<TemporalNodeAttributeStorage<T>> {
+public:
+    explicit TemporalNodeAttribute(std::shared_ptr<TemporalNodeAttributeStorage<T>> owned_storage)
+    : AttributeHandle<TemporalNodeAttributeStorage<T>>{std::move(owned_storage)} { }
+    
+    using AttributeHandle<TemporalNodeAttributeStorage<T>>::checkAttribute;
+    
+    auto size() {
+        return owned_storage->size();
+    }
+    
+    void tick() {
+        checkAttribute();
+        owned_storage->tick();
+    }
+    
+    void record(index i, T v) {
+        checkAttribute();
+        owned_storage->record(i, v);
+    }
+    
+    auto count(index i) {
+        checkAttribute();
+        return owned_storage->count(i);
+    }
+    
+    auto sample(index i, index age = 0) {
+        checkAttribute();
+        return owned_storage->sample(i, age);
+    }
+    
+    auto mean() {
+        checkAttribute();
+        return owned_storage->mean();
+    }
+    
+    auto max() {
+        checkAttribute();
+        return owned_storage->max();
+    }
+    
+    auto ewma(double alpha) {
+        checkAttribute();
+        return owned_storage->ewma(alpha);
+    }
+    
+private:
+    using AttributeHandle<TemporalNodeAttributeStorage<T>>::owned_storage;
+}; // class TemporalNodeAttribute
+
+template<typename T>
+auto attachTemporal(NodeAttributeMap& map, std::string_view name, index window,
+                    Ticks ticks = Ticks::Synchronous) {
+    return TemporalNodeAttribute<T>{
+        map.attachStorage<TemporalNodeAttributeStorage<T>>(name, window, ticks)};
+}
+
+template<typename T>
+auto getTemporal(NodeAttributeMap& map, std::string_view name) {
+    return TemporalNodeAttribute<T>{map.getStorage<TemporalNodeAttributeStorage<T>>(name)};
+}
+
+} // namespace Attributes
+
+#endif /* Temporal_h */
@@ -0,0 +1,1337 @@
+//
+//  Tests.cpp
+//  A4N
+//
+//  Regression checks, built apart from the A4N target, e.g.
+//      c++ -std=c++17 -pthread Tests.cpp -o Tests && ./Tests
+//  Exits with 0 if every check passes.
+//
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <limits>
+#include <memory_resource>
+#include <optional>
+#include <set>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <unistd.h>
+
+#include "Attributes.hpp"
+#include "Codec.hpp"
+#include "Group.hpp"
+#include "IdMap.hpp"
+#include "Import.hpp"
+#include "Ingest.hpp"
+#include "MappedFile.hpp"
+#include "Reclaimer.hpp"
+#include "RecordStore.hpp"
+#include "Roaring.hpp"
+#include "Sharded.hpp"
+#include "Sparse.hpp"
+#include "SharedMemory.hpp"
+#include "Temporal.hpp"
+#include "Tiered.hpp"
+
+using namespace Attributes;
+
+static int failures = 0;
+
+#define CHECK(condition)                                                    \
+    do {                                                                    \
+        if (!(condition)) {                                                 \
+            std::cerr << __FILE__ << ":" << __LINE__                        \
+                      << ": check failed: " #condition "\n";                \
+            ++failures;                                                     \
+        }                                                                   \
+    } while (0)
+
+template<typename T>
+static NodeAttributeStorage<T> const& storageOf(NodeAttributeMap const& map, std::string_view name) {
+    return dynamic_cast<NodeAttributeStorage<T> const&>(*map.findStorage(name));
+}
+
+// Reading through iterators inside a transaction logs and copies nothing.
+static void iteratorReadsInTransaction() {
+    NodeAttributeMap map;
+    auto attr = map.attach<int>("a");
+    for (int i = 0; i < 10; ++i) {
+        attr.set(i, i);
+    }
+    auto copy = map.clone();
+    {
+        auto transaction = map.beginTransaction();
+        long sum = 0;
+        for (auto v : attr) {
+            sum += v;
+        }
+        CHECK(sum == 45);
+        CHECK(storageOf<int>(map, "a").column().chunk(0) == storageOf<int>(copy, "a").column().chunk(0));
+        auto it = attr.begin();
+        it.set(100);
+        transaction.rollback();
+    }
+    CHECK(*attr.begin() == 0);
+}
+
+// An assigned handle follows its new attribute: it is invalidated when
+// that one is detached, not when its old one is.
+static void handleAssignment() {
+    auto invalid = [](auto& attr) {
+        try {
+            attr.checkAttribute();
+        } catch (std::runtime_error const&) {
+            return true;
+        }
+        return false;
+    };
+    NodeAttributeMap map;
+    auto a = map.attach<int>("a");
+    auto b = map.attach<int>("b");
+    auto sparse = attachSparse<int>(map, "sparse");
+    auto other = attachSparse<int>(map, "other");
+    a = b;
+    sparse = other;
+    other = other;
+    map.detach("a");
+    map.detach("sparse");
+    CHECK(!invalid(a) && !invalid(sparse));
+    a.set(1, 1);
+    CHECK(b.get(1) == 1);
+    map.detach("b");
+    map.detach("other");
+    CHECK(invalid(a) && invalid(b) && invalid(sparse) && invalid(other));
+}
+
+// A scratch attribute returned to the pool forgets its hashed values.
+static void scratchHashAfterRelease() {
+    NodeAttributeMap map;
+    {
+        auto scratch = map.scratch<int>();
+        scratch->set(3, 42);
+        scratch->contentHash();
+    }
+    auto reset = map.attach<int>("reset");
+    reset.set(3, 42);
+    reset.contentHash();
+    const_cast<NodeAttributeStorageBase*>(map.findStorage("reset"))->invalidate(3);
+    auto scratch = map.scratch<int>();
+    CHECK(scratch->size() == 0);
+    CHECK(scratch->contentHash() == reset.contentHash());
+}
+
+// After small updates, also rolled-back ones, the cached content hash
+// equals the hash of an attribute built from scratch with the same
+// values, and it changes with any one value or validity bit.
+static void contentHashMatchesScratch() {
+    auto const n = 3 * NodeAttributeStorageBase::chunkSize + 100;
+    std::mt19937_64 random{6};
+    std::vector<std::optional<int>> model(n);
+    NodeAttributeMap map;
+    auto attr = map.attach<int>("a");
+    auto storage = map.getStorage<NodeAttributeStorage<int>>("a");
+    auto change = [&](std::vector<std::optional<int>>& values) {
+        auto i = random() % n;
+        if (random() % 4 == 0) {
+            values[i].reset();
+            storage->invalidate(i);
+        } else {
+            values[i] = int(random() % 100);
+            attr.set(i, *values[i]);
+        }
+    };
+    auto scratchHash = [&] {
+        NodeAttributeMap fresh;
+        auto built = fresh.attach<int>("a");
+        built.set(n - 1, 0);
+        for (Attributes::index i = 0; i < n; ++i) {
+            if (model[i]) {
+                built.set(i, *model[i]);
+            } else {
+                fresh.getStorage<NodeAttributeStorage<int>>("a")->invalidate(i);
+            }
+        }
+        return built.contentHash();
+    };
+    for (Attributes::index i = 0; i < n; ++i) {
+        model[i] = int(random() % 100);
+        attr.set(i, *model[i]);
+    }
+    for (Attributes::index k = 0; k < n / 10; ++k) {
+        change(model);
+    }
+    CHECK(attr.contentHash() == scratchHash());
+    for (int round = 0; round < 10; ++round) {
+        for (int k = 0; k < 1 + round % 4; ++k) {
+            change(model);
+        }
+        if (round % 3 == 0) {
+            auto transaction = map.beginTransaction();
+            auto scratch = model;
+            for (int k = 0; k < 20; ++k) {
+                change(scratch);
+            }
+            attr.contentHash();
+            transaction.rollback();
+        }
+        CHECK(attr.contentHash() == scratchHash());
+    }
+    auto hash = attr.contentHash();
+    auto i = Attributes::index(std::find_if(model.begin(), model.end(),
+                                            [](auto& v) { return v.has_value(); }) - model.begin());
+    auto v = *model[i];
+    attr.set(i, v + 1);
+    CHECK(attr.contentHash() != hash);
+    attr.set(i, v);
+    CHECK(attr.contentHash() == hash);
+    storage->invalidate(i);
+    CHECK(attr.contentHash() != hash);
+    attr.set(i, v);
+    CHECK(attr.contentHash() == hash);
+}
+
+// A failed save leaves the previous file; a background save replaces it.
+static void saveReplacesFile() {
+    std::string path = "/tmp/a4n-tests-save.bin";
+    NodeAttributeMap map;
+    auto attr = map.attach<int>("a");
+    attr.set(1, 1);
+    map.save(path);
+    auto broken = map.attach<std::vector<int>>("unsaved");
+    broken.set(0, {1});
+    attr.set(1, 2);
+    bool failed = false;
+    try {
+        map.save(path);
+    } catch (std::exception const&) {
+        failed = true;
+    }
+    CHECK(failed);
+    CHECK(!std::ifstream(path + ".tmp"));
+    map.detach("unsaved");
+    NodeAttributeMap loaded;
+    auto read = loaded.attach<int>("a");
+    loaded.load(path);
+    CHECK(read.get(1) == 1);
+    auto save = map.backgroundSave(path);
+    save.wait();
+    loaded.load(path);
+    CHECK(read.get(1) == 2);
+    std::remove(path.c_str());
+}
+
+// A clone of a shared attribute grows past the end of the segment.
+static void sharedCloneGrows() {
+    std::string segment = "/a4n-tests-grow";
+    NodeAttributeMap map;
+    auto n = Column<int>::chunkSize + 5;
+    auto attr = attachShared<int>(map, "x", segment, n);
+    attr.set(n - 1, 7);
+    auto copy = map.clone();
+    auto grown = copy.get<int>("x");
+    grown.set(2 * Column<int>::chunkSize, 1);
+    CHECK(grown.get(n - 1) == 7);
+    CHECK(grown.get(2 * Column<int>::chunkSize) == 1);
+    CHECK(!attr.get(2 * Column<int>::chunkSize));
+    SharedSegment::remove(segment);
+}
+
+// Read-only shared attributes can be iterated.
+static void readOnlySharedIteration() {
+    std::string segment = "/a4n-tests-read";
+    NodeAttributeMap writer, reader;
+    auto attr = attachShared<int>(writer, "x", segment, 100);
+    attr.set(0, 1);
+    attr.set(50, 2);
+    auto view = openShared<int>(reader, "x", segment);
+    int sum = 0;
+    for (auto v : view) {
+        sum += v;
+    }
+    CHECK(sum == 3);
+    SharedSegment::remove(segment);
+}
+
+// Counts the bytes allocated through it, from the default resource.
+class CountingResource : public std::pmr::memory_resource {
+public:
+    std::size_t allocated = 0;
+
+private:
+    void* do_allocate(std::size_t bytes, std::size_t align) override {
+        allocated += bytes;
+        return std::pmr::get_default_resource()->allocate(bytes, align);
+    }
+
+    void do_deallocate(void* p, std::size_t bytes, std::size_t align) override {
+        std::pmr::get_default_resource()->deallocate(p, bytes, align);
+    }
+
+    bool do_is_equal(std::pmr::memory_resource const& other) const noexcept override {
+        return this == &other;
+    }
+};
+
+// Shard starts must increase strictly.
+static void shardStartsIncrease() {
+    int refused = 0;
+    for (auto starts : {std::vector<Attributes::index>{0, 5, 5}, std::vector<Attributes::index>{0, 7, 3},
+                        std::vector<Attributes::index>{1, 2}}) {
+        NodeAttributeMap map;
+        try {
+            attachSharded<int>(map, "s", starts);
+        } catch (std::exception const&) {
+            ++refused;
+        }
+    }
+    CHECK(refused == 3);
+    NodeAttributeMap map;
+    CHECK(attachSharded<int>(map, "s", {0, 5, 6}).shardOf(5) == 1);
+}
+
+// Shards of an attribute in an arena-backed map allocate from the arena.
+static void shardedUsesMapResource() {
+    CountingResource counting;
+    std::pmr::monotonic_buffer_resource arena{&counting};
+    auto n = 4 * Column<int>::chunkSize;
+    {
+        NodeAttributeMap map{&arena};
+        auto attr = attachSharded<int>(map, "s", 4, n / 4);
+        for (std::size_t i = 0; i < n; i += 7) {
+            attr.set(i, int(i));
+        }
+        CHECK(attr.get(7 * 1000) == 7 * 1000);
+        auto copy = map.clone();
+        getSharded<int>(copy, "s").set(1, 2);
+    }
+    CHECK(counting.allocated >= n * sizeof(int));
+}
+
+// Sharded writes are refused inside a transaction rather than kept.
+static void shardedWritesInTransaction() {
+    NodeAttributeMap map;
+    auto attr = attachSharded<int>(map, "s", {0, 100});
+    attr.set(5, 1);
+    bool refused = false;
+    {
+        auto transaction = map.beginTransaction();
+        try {
+            attr.set(5, 2);
+        } catch (std::exception const&) {
+            refused = true;
+        }
+    }
+    CHECK(refused);
+    CHECK(attr.get(5) == 1);
+}
+
+// Temporal writes and ticks are refused inside a transaction, also after
+// a first refusal, rather than kept.
+static void temporalWritesInTransaction() {
+    NodeAttributeMap map;
+    auto attr = attachTemporal<int>(map, "t", 4);
+    attr.record(0, 1);
+    int refused = 0;
+    {
+        auto transaction = map.beginTransaction();
+        for (int k = 0; k < 2; ++k) {
+            try {
+                attr.record(0, 3);
+            } catch (std::exception const&) {
+                ++refused;
+            }
+        }
+        try {
+            attr.tick();
+        } catch (std::exception const&) {
+            ++refused;
+        }
+        try {
+            map.getStorage<TemporalNodeAttributeStorage<int>>("t")->invalidate(0);
+        } catch (std::exception const&) {
+            ++refused;
+        }
+    }
+    CHECK(refused == 4);
+    CHECK(attr.sample(0) == 1);
+    CHECK(attr.count(0) == 1);
+}
+
+// mean, max and ewma match a per-node window of samples, for shared and
+// per-node ticks, also while windows are not yet full and after a node
+// is invalidated and recorded again.
+static void temporalMatchesModel(Ticks ticks) {
+    Attributes::index const n = 40, window = 5;
+    std::mt19937_64 random{7};
+    std::vector<std::deque<int>> model(n); // oldest sample first
+    std::vector<bool> valid(n);
+    NodeAttributeMap map;
+    auto attr = attachTemporal<int>(map, "t", window, ticks);
+    auto storage = map.getStorage<TemporalNodeAttributeStorage<int>>("t");
+    auto close = [](double a, double b) {
+        return std::isnan(a) ? std::isnan(b) : std::abs(a - b) <= 1e-9 * std::max(1.0, std::abs(b));
+    };
+    auto matches = [&] {
+        auto mean = attr.mean(), max = attr.max(), ewma = attr.ewma(0.3);
+        auto nan = std::numeric_limits<double>::quiet_NaN();
+        auto at = [&](std::vector<double> const& v, Attributes::index i) { return i < v.size() ? v[i] : nan; };
+        bool same = max.size() == mean.size() && ewma.size() == mean.size();
+        for (Attributes::index i = 0; same && i < std::max(n, mean.size()); ++i) {
+            double sum = 0, best = nan, e = nan;
+            auto& samples = i < n ? model[i] : model[0];
+            auto count = i < n && valid[i] ? samples.size() : 0;
+            for (std::size_t k = samples.size() - count; k < samples.size(); ++k) {
+                sum += samples[k];
+                best = std::isnan(best) ? samples[k] : std::max<double>(best, samples[k]);
+                e = std::isnan(e) ? samples[k] : 0.3 * samples[k] + 0.7 * e;
+            }
+            same = attr.count(i) == count && close(at(mean, i), count ? sum / count : nan)
+                && close(at(max, i), best) && close(at(ewma, i), e);
+            for (Attributes::index age = 0; age < window; ++age) {
+                same = same && attr.sample(i, age)
+                    == (age < count ? std::optional<int>{samples[count - 1 - age]} : std::nullopt);
+            }
+        }
+        return same;
+    };
+    CHECK(matches());
+    for (int step = 0; step < 400; ++step) {
+        auto i = random() % n;
+        auto choice = random() % 10;
+        if (choice == 0 && ticks == Ticks::Synchronous) {
+            attr.tick();
+            for (Attributes::index j = 0; j < n; ++j) {
+                if (valid[j]) {
+                    model[j].push_back(model[j].back());
+                }
+            }
+        } else if (choice == 1) {
+            storage->invalidate(i);
+            valid[i] = false;
+            model[i].clear();
+        } else {
+            auto v = int(random() % 1000) - 500;
+            attr.record(i, v);
+            if (!valid[i] || ticks == Ticks::Asynchronous) {
+                model[i].push_back(v);
+            } else {
+                model[i].back() = v;
+            }
+            valid[i] = true;
+        }
+        for (auto& samples : model) {
+            if (samples.size() > window) {
+                samples.pop_front();
+            }
+        }
+        if (step < 40 || step % 10 == 0) {
+            CHECK(matches());
+        }
+    }
+    CHECK(matches());
+}
+
+static void temporalMatchModel() {
+    temporalMatchesModel(Ticks::Synchronous);
+    temporalMatchesModel(Ticks::Asynchronous);
+}
+
+// Sparse writes are refused inside a transaction rather than kept.
+static void sparseWritesInTransaction() {
+    NodeAttributeMap map;
+    auto attr = attachSparse<int>(map, "s");
+    auto node = Attributes::index{1} << 40;
+    attr.set(node, 1);
+    int refused = 0;
+    {
+        auto transaction = map.beginTransaction();
+        try {
+            attr.set(node, 2);
+        } catch (std::exception const&) {
+            ++refused;
+        }
+        try {
+            attr.invalidate(node);
+        } catch (std::exception const&) {
+            ++refused;
+        }
+    }
+    CHECK(refused == 2);
+    CHECK(attr.get(node) == 1);
+}
+
+// A failing write ends an ingest while the stream stays open and idle.
+static void ingestStopsOnError() {
+    std::string segment = "/a4n-tests-ingest";
+    NodeAttributeMap writer, reader;
+    attachShared<int>(writer, "x", segment, 100);
+    auto view = openShared<int>(reader, "x", segment);
+    int fds[2];
+    CHECK(::pipe(fds) == 0);
+    char const line[] = "5 1\n";
+    CHECK(::write(fds[1], line, sizeof(line) - 1) == ssize_t(sizeof(line) - 1));
+    bool failed = false;
+    StreamIngester<int> ingester{view};
+    try {
+        ingester.run(fds[0]);
+    } catch (std::exception const&) {
+        failed = true;
+    }
+    CHECK(failed);
+    ::close(fds[0]);
+    ::close(fds[1]);
+    SharedSegment::remove(segment);
+}
+
+// Node ids beyond the bound, including the largest index, are rejected
+// rather than growing the attribute to them.
+static void ingestRejectsHugeNodes() {
+    NodeAttributeMap map;
+    auto attr = map.attach<int>("x");
+    std::istringstream in{"18446744073709551615 5\n1000000000000 6\n3 7\n"};
+    StreamIngester<int> ingester{attr};
+    ingester.run(in);
+    CHECK(ingester.rejected() == 2);
+    CHECK(ingester.applied() == 1);
+    CHECK(attr.get(3) == 7);
+    bool refused = false;
+    try {
+        attr.set(std::numeric_limits<Attributes::index>::max(), 1);
+    } catch (std::out_of_range const&) {
+        refused = true;
+    }
+    CHECK(refused);
+}
+
+// External ids in the stream are resolved through the IdMap, new ones
+// becoming new nodes, and are not bounded by maxNode.
+static void ingestExternalIds() {
+    NodeAttributeMap map;
+    auto attr = map.attach<int>("x");
+    IdMap<std::uint64_t> ids;
+    ids.insert(7);
+    std::istringstream in{"18446744073709551615 5\n7 6\n1000000000000 7\n7 8\n"};
+    StreamIngester<int>::Options options;
+    options.ids = &ids;
+    StreamIngester<int> ingester{attr, options};
+    ingester.run(in);
+    CHECK(ingester.rejected() == 0);
+    CHECK(ids.size() == 3);
+    CHECK(attr.get(0) == 8);
+    CHECK(attr.get(ids.find(18446744073709551615u)) == 5);
+    CHECK(attr.get(ids.find(1000000000000u)) == 7);
+}
+
+// Imports into an arena-backed map and into mirrored attributes.
+static void importSharedTargets() {
+    std::ostringstream file;
+    int const rows = 50000;
+    for (int i = 0; i < rows; ++i) {
+        file << i << "\t" << i % 7 << "\t" << i * 2 << "\t" << i * 3 << "\n";
+    }
+    auto check = [&](NodeAttributeMap& map) {
+        std::istringstream in{file.str()};
+        DelimitedImporter importer{map};
+        importer.column<int>(1, "a").column<int>(2, "b").column<int>(3, "c").blockBytes(1 << 20);
+        CHECK(importer.import(in).rows == std::size_t(rows));
+        CHECK(map.get<int>("a").get(rows - 1) == (rows - 1) % 7);
+        CHECK(map.get<int>("c").get(rows - 1) == (rows - 1) * 3);
+    };
+    std::pmr::monotonic_buffer_resource arena;
+    NodeAttributeMap arenaMap{&arena};
+    check(arenaMap);
+    NodeAttributeMap mirrored;
+    mirrored.attach<int>("a");
+    mirrored.attach<int>("b");
+    NodeRecordStore store;
+    store.mirror<int>(mirrored, "a").mirror<int>(mirrored, "b");
+    check(mirrored);
+    CHECK(store.record(rows - 1).get<int>("b") == (rows - 1) * 2);
+}
+
+// Loading a mirrored attribute refills the rows of the record store.
+static void loadReloadsMirrors() {
+    std::string path = "/tmp/a4n-tests-mirrors.bin";
+    NodeAttributeMap map;
+    auto attr = map.attach<int>("a");
+    attr.set(1, 1);
+    attr.set(2, 2);
+    map.save(path);
+    NodeRecordStore store;
+    store.mirror<int>(map, "a");
+    attr.set(1, 10);
+    store.invalidate(2, 0);
+    attr.set(3, 3);
+    CHECK(store.record(1).get<int>("a") == 10);
+    map.load(path);
+    CHECK(store.record(1).get<int>("a") == 1);
+    CHECK(store.record(2).get<int>("a") == 2);
+    CHECK(!store.record(3).has(0));
+    auto view = store.record(2);
+    auto unset = store.record(1000);
+    attr.set(1000, 5);
+    CHECK(view.get<int>("a") == 2 && unset.get<int>("a") == 5);
+    std::remove(path.c_str());
+}
+
+// Rows with ids beyond the bound are rejected unless ids are external.
+static void importRejectsHugeNodes() {
+    std::string const file = "18446744073709551615\t5\n1000000000000\t6\n3\t7\n";
+    NodeAttributeMap map;
+    std::istringstream in{file};
+    auto stats = DelimitedImporter{map}.column<int>(1, "a").import(in);
+    CHECK(stats.rows == 1);
+    CHECK(stats.rejectedRows == 2);
+    CHECK(map.get<int>("a").get(3) == 7);
+    NodeAttributeMap external;
+    IdMap<std::uint64_t> ids;
+    std::istringstream again{file};
+    CHECK(DelimitedImporter{external}.externalIds(ids).column<int>(1, "a").import(again).rows == 3);
+    CHECK(external.get<int>("a").get(ids.find(18446744073709551615u)) == 5);
+}
+
+// An asynchronous save replaces the file only once it is complete and
+// lets go of its snapshot before reporting; a load delivers a clone.
+static void asyncSaveAndLoad() {
+    std::string path = "/tmp/a4n-tests-async.bin";
+    NodeAttributeMap map;
+    auto attr = map.attach<int>("a");
+    attr.set(1, 1);
+    map.saveAsync(path).get();
+    CHECK(!std::ifstream(path + ".tmp"));
+    CHECK(!storageOf<int>(map, "a").column().isShared(0));
+    auto broken = map.attach<std::vector<int>>("unsaved");
+    broken.set(0, {1});
+    attr.set(1, 2);
+    bool failed = false;
+    try {
+        map.saveAsync(path).get();
+    } catch (std::exception const&) {
+        failed = true;
+    }
+    CHECK(failed);
+    CHECK(!std::ifstream(path + ".tmp"));
+    map.detach("unsaved");
+    auto loaded = map.loadAsync(path).get();
+    CHECK(loaded.use_count() == 1);
+    CHECK(loaded->get<int>("a").get(1) == 1);
+    CHECK(attr.get(1) == 2);
+    std::remove(path.c_str());
+}
+
+// A mapped attribute writes through to its file while the map has a clone.
+static void mappedWritesWithClone() {
+    std::string path = "/tmp/a4n-tests-mapped.bin";
+    {
+        NodeAttributeMap map;
+        auto file = MappedFile::create(path, sizeof(int), sharedTypeHash<int>(), 16, 1 << 20);
+        auto attr = attachMappedFile<int>(map, "m", file);
+        attr.set(1, 1);
+        {
+            auto copy = map.clone();
+            attr.set(2, 2);
+            CHECK(!copy.get<int>("m").get(2));
+            copy.get<int>("m").set(1, 10);
+        }
+        attr.set(3, 3);
+        attr.set(Column<int>::chunkSize + 1, 4);
+        file->flush();
+    }
+    NodeAttributeMap map;
+    auto attr = attachMappedFile<int>(map, "m", MappedFile::open(path, false));
+    CHECK(attr.get(1) == 1);
+    CHECK(attr.get(2) == 2);
+    CHECK(attr.get(3) == 3);
+    CHECK(attr.get(Column<int>::chunkSize + 1) == 4);
+    std::remove(path.c_str());
+}
+
+// Loading a mapped attribute grows its file and keeps writing to it;
+// loading more nodes than shared memory holds throws.
+static void loadIntoExternalMemory() {
+    std::string saved = "/tmp/a4n-tests-load.bin", path = "/tmp/a4n-tests-load-mapped.bin";
+    {
+        NodeAttributeMap source;
+        auto attr = source.attach<int>("m");
+        for (int i = 0; i < 10; i += 2) {
+            attr.set(i, i);
+        }
+        source.save(saved);
+    }
+    {
+        NodeAttributeMap map;
+        auto file = MappedFile::create(path, sizeof(int), sharedTypeHash<int>(), 4, 1 << 20);
+        auto attr = attachMappedFile<int>(map, "m", file);
+        attr.set(1, 1);
+        map.load(saved);
+        CHECK(!storageOf<int>(map, "m").validity().test(1));
+        CHECK(attr.get(8) == 8);
+        attr.set(9, 999);
+        file->flush();
+    }
+    {
+        NodeAttributeMap map;
+        auto attr = attachMappedFile<int>(map, "m", MappedFile::open(path, false));
+        CHECK(attr.get(8) == 8);
+        CHECK(attr.get(9) == 999);
+    }
+    std::string segment = "/a4n-tests-load";
+    NodeAttributeMap map;
+    attachShared<int>(map, "m", segment, 4);
+    bool refused = false;
+    try {
+        map.load(saved);
+    } catch (std::exception const&) {
+        refused = true;
+    }
+    CHECK(refused);
+    SharedSegment::remove(segment);
+    std::remove(saved.c_str());
+    std::remove(path.c_str());
+}
+
+// A bitmap whose bit count needs more words than were saved is refused.
+static void bitmapLoadChecksLength() {
+    std::stringstream file;
+    writeValue<std::uint64_t>(file, 1000);
+    Column<Bitmap::word> words;
+    words.resize(2);
+    words.save(file);
+    Bitmap bitmap;
+    auto refused = false;
+    try {
+        bitmap.load(file);
+    } catch (std::runtime_error const&) {
+        refused = true;
+    }
+    CHECK(refused && bitmap.size() == 0 && bitmap.wordCount() == 0);
+}
+
+// Detached storages are destroyed by the reclaimer, by its thread or by
+// reclaim(); retiring past maxPendingBytes waits for the objects ahead,
+// also for one that is being destroyed.
+static void reclaimerReleasesDetached() {
+    for (auto mode : {Reclaimer::Mode::Manual, Reclaimer::Mode::Background}) {
+        Reclaimer reclaimer{mode};
+        NodeAttributeMap map;
+        map.setReclaimer(&reclaimer);
+        map.attach<int>("a").set(100000, 1);
+        std::weak_ptr<NodeAttributeStorage<int>> storage = map.getStorage<NodeAttributeStorage<int>>("a");
+        map.detach("a");
+        if (mode == Reclaimer::Mode::Manual) {
+            CHECK(reclaimer.getPendingObjects() == 1 && reclaimer.getPendingBytes() > 400000);
+            CHECK(!storage.expired());
+            CHECK(reclaimer.reclaim() == 1);
+        }
+        for (int k = 0; k < 5000 && reclaimer.getPendingBytes(); ++k) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        CHECK(storage.expired() && reclaimer.getPendingBytes() == 0 && reclaimer.getPendingObjects() == 0);
+    }
+    {
+        Reclaimer reclaimer{Reclaimer::Mode::Manual, 100};
+        std::atomic<int> destroyed{0};
+        auto object = [&] { return std::shared_ptr<int>(new int, [&](int* p) { ++destroyed; delete p; }); };
+        reclaimer.retire(object(), 60);
+        reclaimer.retire(object(), 30);
+        CHECK(destroyed == 0);
+        reclaimer.retire(object(), 80);
+        CHECK(destroyed == 2 && reclaimer.getPendingObjects() == 1);
+    }
+    {
+        Reclaimer reclaimer{Reclaimer::Mode::Background, 100};
+        std::promise<void> gate;
+        auto opened = gate.get_future().share();
+        reclaimer.retire(std::shared_ptr<int>(new int, [opened](int* p) { opened.wait(); delete p; }), 60);
+        while (reclaimer.getPendingObjects()) {
+            std::this_thread::yield();
+        }
+        std::atomic<bool> retired{false};
+        std::thread caller([&] {
+            reclaimer.retire(std::make_shared<int>(), 60);
+            retired = true;
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        CHECK(!retired);
+        gate.set_value();
+        caller.join();
+        CHECK(retired);
+    }
+}
+
+// Random bits, slowly changing, constant and extreme values of T decode
+// to the same bits; 1000 values end in a partial block.
+template<typename T>
+static void codecRoundTrip(std::mt19937_64& random) {
+    std::size_t const n = 1000;
+    std::vector<std::vector<T>> inputs(4, std::vector<T>(n));
+    T step = std::is_integral_v<T> ? T(1) : T(0.25);
+    for (std::size_t k = 0; k < n; ++k) {
+        auto bits = random();
+        std::memcpy(&inputs[0][k], &bits, sizeof(T));
+        inputs[1][k] = T(T(k / 3) * step + T(random() % 3));
+        inputs[2][k] = T(42);
+        inputs[3][k] = k % 2 ? std::numeric_limits<T>::max() : std::numeric_limits<T>::lowest();
+    }
+    if constexpr (std::is_floating_point_v<T>) {
+        inputs[3][1] = std::numeric_limits<T>::infinity();
+        inputs[3][2] = T(-0.0);
+        inputs[3][3] = std::numeric_limits<T>::quiet_NaN();
+    }
+    for (auto& v : inputs) {
+        std::vector<char> out{'x'};
+        ChunkCodec<T>::encode(v.data(), n, out);
+        CHECK(out[0] == 'x');
+        std::vector<T> back(n);
+        ChunkCodec<T>::decode(out.data() + 1, out.size() - 1, back.data(), n);
+        CHECK(std::memcmp(back.data(), v.data(), n * sizeof(T)) == 0);
+    }
+}
+
+static void codecRoundTrips() {
+    std::mt19937_64 random{1};
+    codecRoundTrip<std::int8_t>(random);
+    codecRoundTrip<std::int32_t>(random);
+    codecRoundTrip<std::int64_t>(random);
+    codecRoundTrip<std::uint64_t>(random);
+    codecRoundTrip<float>(random);
+    codecRoundTrip<double>(random);
+}
+
+// Tiered attributes with a budget of two pages match a plain model
+// through evictions, rewrites of spilled pages with longer encodings,
+// rollback, cloning and a save and load, in every ColdPages mode.
+static void tieredRoundTrip(ColdPages cold) {
+    using Tiered = TieredNodeAttributeStorage<std::int64_t>;
+    auto const n = 10 * Tiered::pageSize;
+    std::mt19937_64 random{2};
+    std::vector<std::optional<std::int64_t>> model(n);
+    NodeAttributeMap map;
+    auto attr = attachTiered<std::int64_t>(map, "t", 2 * Tiered::pageBytes, {}, cold);
+    auto matches = [&](TieredNodeAttribute<std::int64_t>& a) {
+        bool same = true;
+        for (Attributes::index i = 0; i < n; ++i) {
+            same = same && a.get(i) == model[i];
+        }
+        return same;
+    };
+    // Constant pages encode small; random values then outgrow their slot.
+    for (Attributes::index i = 0; i < n; ++i) {
+        model[i] = 7;
+        attr.set(i, 7);
+    }
+    for (int k = 0; k < 5000; ++k) {
+        auto i = random() % n;
+        if (k % 10 == 0) {
+            model[i].reset();
+            attr.invalidate(i);
+        } else {
+            model[i] = std::int64_t(random());
+            attr.set(i, *model[i]);
+        }
+    }
+    CHECK(matches(attr));
+    auto stats = attr.stats();
+    CHECK(stats.residentPages <= 2);
+    CHECK(stats.evictions > 0);
+    CHECK(stats.spilledPages + stats.compressedPages > 0);
+    {
+        auto transaction = map.beginTransaction();
+        for (int k = 0; k < 1000; ++k) {
+            auto i = random() % n;
+            attr.set(i, -1);
+            attr.invalidate((i + 1) % n);
+        }
+    }
+    CHECK(matches(attr));
+    {
+        auto copy = map.clone();
+        auto cloned = getTiered<std::int64_t>(copy, "t");
+        CHECK(matches(cloned));
+        cloned.set(0, -2);
+        CHECK(attr.get(0) == model[0]);
+    }
+    std::string path = "/tmp/a4n-tests-tiered.bin";
+    map.save(path);
+    NodeAttributeMap loaded;
+    auto again = attachTiered<std::int64_t>(loaded, "t", Tiered::pageBytes, {}, cold);
+    loaded.load(path);
+    CHECK(matches(again));
+    CHECK(again.stats().residentPages == 1);
+    std::remove(path.c_str());
+}
+
+static void tieredRoundTrips() {
+    tieredRoundTrip(ColdPages::Spill);
+    tieredRoundTrip(ColdPages::SpillCompressed);
+    tieredRoundTrip(ColdPages::Compress);
+}
+
+// Group rows, whole or by member, match a per-node model in either
+// layout, also after a rolled-back transaction, a clone and a save and
+// load.
+template<GroupLayout L>
+static void groupMatchesModel() {
+    using Group = NodeAttributeGroup<L, int, double, std::string>;
+    using Row = std::tuple<int, double, std::string>;
+    Attributes::index const n = 2000;
+    std::mt19937_64 random{5};
+    std::vector<std::optional<Row>> model(n);
+    NodeAttributeMap map;
+    auto group = attachGroup<L, int, double, std::string>(map, "g", {"id", "weight", "label"});
+    auto storage = map.getStorage<NodeAttributeGroupStorage<L, int, double, std::string>>("g");
+    auto matches = [&](Group& g) {
+        bool same = g.size() == std::size_t(std::count_if(model.begin(), model.end(),
+                                                         [](auto& row) { return row.has_value(); }));
+        for (Attributes::index i = 0; i < n; ++i) {
+            same = same && g.get(i) == model[i] && g.isValid(i) == model[i].has_value()
+                && g.template get<1>(i) == (model[i] ? std::optional<double>{std::get<1>(*model[i])} : std::nullopt);
+        }
+        Attributes::index visited = 0;
+        g.forEach([&](Attributes::index i, int id, double weight, std::string const& label) {
+            same = same && model[i] == Row{id, weight, label};
+            ++visited;
+        });
+        return same && visited == g.size();
+    };
+    auto change = [&](std::vector<std::optional<Row>>& rows) {
+        auto i = random() % n;
+        auto choice = random() % 4;
+        if (choice == 0) {
+            rows[i].reset();
+            storage->invalidate(i);
+        } else if (choice == 1 && rows[i]) {
+            std::get<2>(*rows[i]) = std::to_string(random() % 1000);
+            group.template set<2>(i, std::get<2>(*rows[i]));
+        } else {
+            rows[i] = Row{int(random() % 1000), double(random() % 1000) / 8, std::to_string(i)};
+            group.set(i, std::get<0>(*rows[i]), std::get<1>(*rows[i]), std::get<2>(*rows[i]));
+        }
+    };
+    for (int k = 0; k < 5000; ++k) {
+        change(model);
+    }
+    CHECK(matches(group));
+    if constexpr (L == GroupLayout::Columns) {
+        auto ids = group.template column<0>();
+        bool same = true;
+        for (Attributes::index i = 0; i < n; ++i) {
+            same = same && (!model[i] || ids[i] == std::get<0>(*model[i]));
+        }
+        CHECK(same);
+    }
+    {
+        auto transaction = map.beginTransaction();
+        auto scratch = model;
+        for (int k = 0; k < 1000; ++k) {
+            change(scratch);
+        }
+        transaction.rollback();
+    }
+    CHECK(matches(group));
+    {
+        auto transaction = map.beginTransaction();
+        for (int k = 0; k < 100; ++k) {
+            change(model);
+        }
+        transaction.commit();
+    }
+    CHECK(matches(group));
+    {
+        auto copy = map.clone();
+        auto cloned = getGroup<L, int, double, std::string>(copy, "g");
+        CHECK(matches(cloned));
+        cloned.set(0, -1, -1, "changed");
+        CHECK(group.get(0) == model[0]);
+    }
+    std::string path = "/tmp/a4n-tests-group.bin";
+    map.save(path);
+    NodeAttributeMap loaded;
+    auto again = attachGroup<L, int, double, std::string>(loaded, "g", {"id", "weight", "label"});
+    loaded.load(path);
+    CHECK(matches(again));
+    CHECK(again.memberIndex("label") == 2);
+    std::remove(path.c_str());
+}
+
+static void groupsMatchModel() {
+    groupMatchesModel<GroupLayout::Rows>();
+    groupMatchesModel<GroupLayout::Columns>();
+}
+
+// Random sets of array, bitmap and run blocks, optimised or not.
+static std::set<std::size_t> randomSet(std::mt19937_64& random, RoaringBitmap& bitmap) {
+    std::set<std::size_t> set;
+    auto const block = std::size_t{1} << 16;
+    for (std::size_t b = 0; b < 6; ++b) {
+        auto base = (b + random() % 3) * block;
+        switch (random() % 4) {
+            case 0: // array
+                for (int k = 0; k < 100; ++k) {
+                    set.insert(base + random() % block);
+                }
+                break;
+            case 1: // bitmap
+                for (int k = 0; k < 20000; ++k) {
+                    set.insert(base + random() % block);
+                }
+                break;
+            case 2: // runs, also across the end of the block
+                for (int k = 0; k < 20; ++k) {
+                    auto from = base + random() % block;
+                    for (auto i = from; i < from + random() % 3000; ++i) {
+                        set.insert(i);
+                    }
+                }
+                break;
+            default: // empty
+                break;
+        }
+    }
+    for (auto i : set) {
+        bitmap.set(i);
+    }
+    if (random() % 2) {
+        bitmap.optimize();
+    }
+    return set;
+}
+
+static bool sameSet(RoaringBitmap const& bitmap, std::set<std::size_t> const& set, std::mt19937_64& random) {
+    std::vector<std::size_t> sorted(set.begin(), set.end()), visited;
+    bitmap.forEach([&](std::size_t i) { visited.push_back(i); });
+    auto same = bitmap.cardinality() == set.size() && visited == sorted;
+    for (std::size_t k = 0; k < sorted.size(); k += 1 + random() % 64) {
+        same = same && bitmap.test(sorted[k]) && bitmap.rank(sorted[k]) == k;
+    }
+    for (int k = 0; k < 2000; ++k) {
+        auto i = std::size_t(random() % (10 << 16));
+        auto rank = std::size_t(std::lower_bound(sorted.begin(), sorted.end(), i) - sorted.begin());
+        same = same && bitmap.test(i) == (set.count(i) == 1) && bitmap.rank(i) == rank;
+    }
+    return same;
+}
+
+// Roaring membership, rank and set algebra match std::set, also after a
+// save and load.
+static void roaringMatchesSet() {
+    std::mt19937_64 random{3};
+    for (int round = 0; round < 20; ++round) {
+        RoaringBitmap a, b;
+        auto setA = randomSet(random, a);
+        auto setB = randomSet(random, b);
+        CHECK(sameSet(a, setA, random));
+        std::set<std::size_t> expected;
+        auto unite = a;
+        unite |= b;
+        std::set_union(setA.begin(), setA.end(), setB.begin(), setB.end(),
+                       std::inserter(expected, expected.end()));
+        CHECK(sameSet(unite, expected, random));
+        expected.clear();
+        auto intersect = a;
+        intersect &= b;
+        std::set_intersection(setA.begin(), setA.end(), setB.begin(), setB.end(),
+                              std::inserter(expected, expected.end()));
+        CHECK(sameSet(intersect, expected, random));
+        expected.clear();
+        auto difference = a;
+        difference -= b;
+        std::set_difference(setA.begin(), setA.end(), setB.begin(), setB.end(),
+                            std::inserter(expected, expected.end()));
+        CHECK(sameSet(difference, expected, random));
+        std::stringstream file;
+        a.save(file);
+        RoaringBitmap loaded;
+        loaded.load(file);
+        CHECK(sameSet(loaded, setA, random));
+    }
+}
+
+// A saved block, written field by field; runs are (first, last) pairs.
+static void writeBlock(std::ostream& out, std::uint8_t kind, std::uint32_t cardinality,
+                       std::vector<std::uint16_t> const& values, std::vector<std::uint64_t> const& words,
+                       std::vector<std::array<std::uint16_t, 2>> const& runs) {
+    writeValue(out, kind);
+    writeValue(out, cardinality);
+    writeVector(out, values);
+    writeVector(out, words);
+    writeVector(out, runs);
+}
+
+// Loading refuses roaring bitmaps whose keys, kinds, sizes or counts are
+// inconsistent, and leaves them empty.
+static void roaringLoadChecksBlocks() {
+    auto load = [](std::vector<std::uint64_t> const& keys, auto writeBlocks) {
+        std::stringstream file;
+        writeValue<std::uint64_t>(file, 3 << 16);
+        writeVector(file, keys);
+        writeBlocks(file);
+        RoaringBitmap bitmap;
+        bitmap.set(5);
+        try {
+            bitmap.load(file);
+        } catch (std::runtime_error const&) {
+            return bitmap.cardinality() == 0 && bitmap.size() == 0 ? 0 : -1;
+        }
+        return bitmap.test(7) && bitmap.test((1 << 16) + 9) ? 1 : -1;
+    };
+    std::vector<std::uint64_t> full(RoaringBitmap::blockWords, 0);
+    full[0] = 1 << 7;
+    auto twoBlocks = [&](std::ostream& out) {
+        writeBlock(out, 2, 1, {}, {}, {{7, 7}});
+        writeBlock(out, 0, 1, {9}, {}, {});
+    };
+    CHECK(load({0, 1}, twoBlocks) == 1);
+    CHECK(load({1, 0}, twoBlocks) == 0);
+    CHECK(load({0, 0}, twoBlocks) == 0);
+    CHECK(load({0, 3}, twoBlocks) == 0);
+    CHECK(load({0, 1}, [](std::ostream& out) {
+        writeBlock(out, 3, 1, {7}, {}, {});
+        writeBlock(out, 0, 1, {9}, {}, {});
+    }) == 0);
+    CHECK(load({0, 1}, [&](std::ostream& out) {
+        writeBlock(out, 1, 1, {}, full, {});
+        writeBlock(out, 0, 1, {9}, {}, {});
+    }) == 1);
+    CHECK(load({0, 1}, [](std::ostream& out) {
+        writeBlock(out, 1, 1, {}, {1 << 7}, {});
+        writeBlock(out, 0, 1, {9}, {}, {});
+    }) == 0);
+    CHECK(load({0, 1}, [&](std::ostream& out) {
+        writeBlock(out, 1, 2, {}, full, {});
+        writeBlock(out, 0, 1, {9}, {}, {});
+    }) == 0);
+    CHECK(load({0, 1}, [](std::ostream& out) {
+        writeBlock(out, 0, 2, {7, 7}, {}, {});
+        writeBlock(out, 0, 1, {9}, {}, {});
+    }) == 0);
+    CHECK(load({0, 1}, [](std::ostream& out) {
+        writeBlock(out, 0, 1, {7}, {}, {});
+        writeBlock(out, 0, 0, {}, {}, {});
+    }) == 0);
+    CHECK(load({0, 1}, [](std::ostream& out) {
+        writeBlock(out, 2, 6, {}, {}, {{7, 9}, {8, 10}});
+        writeBlock(out, 0, 1, {9}, {}, {});
+    }) == 0);
+}
+
+// IdMap numbers ids in order of first occurrence, whether inserted one
+// by one or in bulk batches full of duplicates, and finds them again.
+template<typename Key, typename Make>
+static void idMapMatchesModel(Make make) {
+    std::mt19937_64 random{4};
+    IdMap<Key> ids;
+    std::unordered_map<Key, Attributes::index> model;
+    auto expect = [&](Key const& key) {
+        return model.emplace(key, model.size()).first->second;
+    };
+    for (int k = 0; k < 1000; ++k) {
+        auto key = make(random() % 3000);
+        CHECK(ids.insert(key) == expect(key));
+    }
+    for (std::size_t batch : {std::size_t{0}, std::size_t{1}, std::size_t{100}, std::size_t{200000}}) {
+        std::vector<Key> keys(batch);
+        for (auto& key : keys) {
+            key = make(random() % (batch + 5000));
+        }
+        std::vector<Attributes::index> out(batch);
+        ids.insertAll(keys.data(), keys.size(), out.data());
+        bool same = true;
+        for (std::size_t k = 0; k < batch; ++k) {
+            same = same && out[k] == expect(keys[k]) && ids.id(out[k]) == keys[k];
+        }
+        CHECK(same);
+        CHECK(ids.size() == model.size());
+    }
+    std::vector<Key> probes;
+    for (int k = 0; k < 10000; ++k) {
+        probes.push_back(make(random() % 400000));
+    }
+    std::vector<Attributes::index> found(probes.size());
+    ids.findAll(probes.data(), probes.size(), found.data());
+    bool same = true;
+    for (std::size_t k = 0; k < probes.size(); ++k) {
+        auto it = model.find(probes[k]);
+        auto index = it == model.end() ? IdMap<Key>::npos : it->second;
+        same = same && found[k] == index && ids.find(probes[k]) == index;
+    }
+    CHECK(same);
+}
+
+// Small bulk insertions into a large map cost O(batch), not O(map): a
+// thousand of them take far less than one pass over the table each.
+static void idMapSmallBatches() {
+    std::size_t const large = std::size_t{1} << 21;
+    IdMap<std::uint64_t> ids;
+    std::vector<std::uint64_t> keys(large);
+    std::vector<Attributes::index> out(large);
+    for (std::size_t k = 0; k < large; ++k) {
+        keys[k] = k * 3;
+    }
+    ids.insertAll(keys.data(), large, out.data());
+    auto start = std::chrono::steady_clock::now();
+    bool same = true;
+    for (std::uint64_t k = 0; k < 1000; ++k) {
+        std::uint64_t batch[4] = {k * 3, k * 3 + 1, k * 3 + 1, large * 3 + k};
+        Attributes::index nodes[4];
+        ids.insertAll(batch, 4, nodes);
+        same = same && nodes[0] == k && nodes[1] == nodes[2] && nodes[1] == large + 2 * k
+            && nodes[3] == large + 2 * k + 1 && ids.id(nodes[3]) == large * 3 + k;
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    CHECK(same);
+    CHECK(ids.size() == large + 2000);
+    CHECK(ids.find(1) == large);
+    CHECK(elapsed < std::chrono::milliseconds(500));
+}
+
+static void idMapsMatchModel() {
+    idMapMatchesModel<std::uint64_t>([](std::uint64_t x) { return x * 0x9e3779b97f4a7c15u; });
+    idMapMatchesModel<std::string>([](std::uint64_t x) { return "node-" + std::to_string(x); });
+}
+
+// Checks every zone map query of attr against a scan of model.
+static bool zoneQueriesMatch(NodeAttribute<int>& attr, std::vector<std::optional<int>> const& model) {
+    bool same = true;
+    for (auto [lo, hi] : {std::pair{0, 49}, std::pair{10, 20}, std::pair{49, 49}, std::pair{-5, -1},
+                          std::pair{-1000, 1000}}) {
+        std::vector<Attributes::index> nodes;
+        for (Attributes::index i = 0; i < model.size(); ++i) {
+            if (model[i] && lo <= *model[i] && *model[i] <= hi) {
+                nodes.push_back(i);
+            }
+        }
+        std::vector<Attributes::index> visited;
+        attr.forEachInRange(lo, hi, [&](Attributes::index i, int v) {
+            same = same && model[i] == v;
+            visited.push_back(i);
+        });
+        same = same && visited == nodes && attr.filter(lo, hi) == nodes && attr.countInRange(lo, hi) == nodes.size();
+    }
+    std::vector<std::pair<Attributes::index, int>> ranked;
+    for (Attributes::index i = 0; i < model.size(); ++i) {
+        if (model[i]) {
+            ranked.emplace_back(i, *model[i]);
+        }
+    }
+    std::stable_sort(ranked.begin(), ranked.end(), [](auto& a, auto& b) { return a.second > b.second; });
+    for (std::size_t k : {0, 1, 7, 1000, 400000}) {
+        auto expected = std::vector(ranked.begin(), ranked.begin() + std::min(k, ranked.size()));
+        same = same && attr.topK(k) == expected;
+    }
+    return same;
+}
+
+// Range and top-k queries give the same answers with and without zone
+// maps, through ties, invalidated bounds, rollback, save/load and clone.
+static void zoneMapsMatchScan() {
+    auto const n = 5 * NodeAttributeStorageBase::chunkSize;
+    std::mt19937_64 random{5};
+    std::vector<std::optional<int>> model(n);
+    NodeAttributeMap map;
+    auto plain = map.attach<int>("plain");
+    auto zoned = map.attach<int>("zoned");
+    zoned.enableZoneMaps();
+    auto set = [&](Attributes::index i, int v) {
+        model[i] = v;
+        plain.set(i, v);
+        zoned.set(i, v);
+    };
+    auto invalidate = [&](Attributes::index i) {
+        model[i].reset();
+        map.getStorage<NodeAttributeStorage<int>>("plain")->invalidate(i);
+        map.getStorage<NodeAttributeStorage<int>>("zoned")->invalidate(i);
+    };
+    // Few distinct values make ties; chunk 3 stays empty.
+    for (Attributes::index i = 0; i < n; i += 1 + random() % 5) {
+        if (i >> NodeAttributeStorageBase::chunkBits != 3) {
+            set(i, int(random() % 50));
+        }
+    }
+    // The last chunk is visited first and holds ties of earlier chunks.
+    set(4 * NodeAttributeStorageBase::chunkSize + 5, 60);
+    CHECK(zoneQueriesMatch(plain, model));
+    CHECK(zoneQueriesMatch(zoned, model));
+    // Invalidating the only extremes of a chunk leaves its zone too wide.
+    set(7, 1000);
+    set(9, -1000);
+    CHECK(zoneQueriesMatch(zoned, model));
+    invalidate(7);
+    invalidate(9);
+    CHECK(zoned.topK(1)[0].second == 60);
+    CHECK(zoneQueriesMatch(zoned, model));
+    {
+        auto transaction = map.beginTransaction();
+        zoned.set(3 * NodeAttributeStorageBase::chunkSize, 2000);
+        zoned.set(11, -2000);
+        map.getStorage<NodeAttributeStorage<int>>("zoned")->invalidate(0);
+    }
+    CHECK(zoneQueriesMatch(zoned, model));
+    std::string path = "/tmp/a4n-tests-zones.bin";
+    map.save(path);
+    NodeAttributeMap loaded;
+    auto again = loaded.attach<int>("zoned");
+    loaded.load(path);
+    CHECK(storageOf<int>(loaded, "zoned").hasZoneMaps());
+    CHECK(zoneQueriesMatch(again, model));
+    auto copy = map.clone();
+    auto cloned = copy.get<int>("zoned");
+    CHECK(storageOf<int>(copy, "zoned").hasZoneMaps());
+    CHECK(zoneQueriesMatch(cloned, model));
+    CHECK(zoneQueriesMatch(plain, model));
+    std::remove(path.c_str());
+}
+
+int main() {
+    iteratorReadsInTransaction();
+    handleAssignment();
+    scratchHashAfterRelease();
+    contentHashMatchesScratch();
+    saveReplacesFile();
+    sharedCloneGrows();
+    readOnlySharedIteration();
+    shardedWritesInTransaction();
+    temporalWritesInTransaction();
+    temporalMatchModel();
+    shardedUsesMapResource();
+    shardStartsIncrease();
+    sparseWritesInTransaction();
+    ingestStopsOnError();
+    ingestRejectsHugeNodes();
+    ingestExternalIds();
+    importSharedTargets();
+    importRejectsHugeNodes();
+    loadReloadsMirrors();
+    asyncSaveAndLoad();
+    mappedWritesWithClone();
+    loadIntoExternalMemory();
+    reclaimerReleasesDetached();
+    bitmapLoadChecksLength();
+    codecRoundTrips();
+    tieredRoundTrips();
+    groupsMatchModel();
+    roaringMatchesSet();
+    roaringLoadChecksBlocks();
+    idMapsMatchModel();
+    idMapSmallBatches();
+    zoneMapsMatchScan();
+    if (failures) {
+        std::cerr << failures << " checks failed\n";
+        return 1;
+    }
+    std::cout << "all checks passed\n";
+    return 0;
+}
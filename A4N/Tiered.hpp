@@ -0,0 +1,537 @@
+//
+//  Tiered.hpp
+//  A4N
+//
+
+#ifndef Tiered_h
+#define Tiered_h
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+#include "Attributes.hpp"
+#include "Codec.hpp"
+
+namespace Attributes {
+
+template<typename T>
+class TieredNodeAttribute;
+
+// Spill file of a tiered attribute: a temporary file in directory that is
+// unlinked at once, so it disappears with its descriptor.
+class SpillFile {
+public:
+    explicit SpillFile(std::string directory) {
+        if (directory.empty()) {
+            auto tmp = std::getenv("TMPDIR");
+            directory = tmp && *tmp ? tmp : "/tmp";
+        }
+        auto path = directory + "/a4n-spill-XXXXXX";
+        fd = mkstemp(path.data());
+        if (fd < 0) {
+            throw std::runtime_error("Cannot create spill file in '" + directory + "'");
+        }
+        unlink(path.c_str());
+    }
+    
+    SpillFile(SpillFile const&) = delete;
+    SpillFile& operator=(SpillFile const&) = delete;
+    
+    ~SpillFile() {
+        close(fd);
+    }
+    
+    void write(void const* data, std::size_t n, std::uint64_t offset) {
+        auto p = static_cast<char const*>(data);
+        while (n) {
+            auto done = pwrite(fd, p, n, off_t(offset));
+            if (done < 0 && errno == EINTR) {
+                continue;
+            }
+            if (done <= 0) {
+                throw std::runtime_error("Cannot write spill file");
+            }
+            p += done;
+            n -= std::size_t(done);
+            offset += std::uint64_t(done);
+        }
+    }
+    
+    void read(void* data, std::size_t n, std::uint64_t offset) const {
+        auto p = static_cast<char*>(data);
+        while (n) {
+            auto done = pread(fd, p, n, off_t(offset));
+            if (done < 0 && errno == EINTR) {
+                continue;
+            }
+            if (done <= 0) {
+                throw std::runtime_error("Cannot read spill file");
+            }
+            p += done;
+            n -= std::size_t(done);
+            offset += std::uint64_t(done);
+        }
+    }
+    
+private:
+    int fd;
+}; // class SpillFile
+
+// Where a tiered attribute keeps the pages it evicts.
+enum class ColdPages {
+    Spill,           // in the spill file, as they are
+    SpillCompressed, // in the spill file, encoded by ChunkCodec
+    Compress         // in memory, encoded by ChunkCodec
+};
+
+// Attribute whose values live in pages of pageSize nodes, of which only
+// those fitting a RAM budget are resident and decoded; the others are
+// kept as ColdPages says: in a spill file (see SpillFile), or compressed
+// in memory, in which case the budget bounds the cache of decoded hot
+// pages and the encoded copy of a page is kept until it is written.
+// A spilled page keeps its place in the file unless its encoding grows
+// beyond it. Every access
+// counts for its page, and a full budget evicts by the clock algorithm
+// with these counts (GCLOCK): the hand passes over the resident pages,
+// taking one count from each, and evicts the first without any. Clean
+// pages are dropped without writing. Validity stays in memory. Suits
+// attributes far larger than their working set; a page fault costs one
+// pread of pageSize values.
+// Unlike other storages, reads change state: they count uses, fault pages
+// in, evict others and free their memory. Concurrent readers therefore
+// race and must be serialised like writers, e.g. by one lock per
+// attribute. save() and clone() read every page, so they must not run
+// alongside get() or forEach() either.
+template<typename T>
+class TieredNodeAttributeStorage : public NodeAttributeStorageBase {
+    static_assert(std::is_trivially_copyable_v<T>, "tiered attributes hold trivially copyable values");
+public:
+    static constexpr unsigned pageBits = 12;
+    static constexpr index pageSize = index{1} << pageBits;
+    static constexpr std::size_t pageBytes = pageSize * sizeof(T);
+    
+    struct Stats {
+        std::size_t residentPages = 0;
+        std::size_t spilledPages = 0;    // with a copy in the spill file
+        std::size_t compressedPages = 0; // with a copy in memory
+        std::size_t compressedBytes = 0;
+        std::size_t faults = 0;       // pages made resident
+        std::size_t evictions = 0;
+    };
+    
+    // At least one page stays resident whatever the budget. The spill file
+    // goes to directory, by default $TMPDIR or /tmp.
+    TieredNodeAttributeStorage(std::pmr::string name, std::size_t budgetBytes, std::string directory = {},
+                               ColdPages cold = ColdPages::Spill)
+    : NodeAttributeStorageBase{std::move(name), typeid(TieredNodeAttributeStorage<T>)},
+      budget{budgetBytes}, directory{std::move(directory)}, cold{cold}, pages{getResource()}, ring{getResource()},
+      attrSet{getResource()} { }
+    
+    ~TieredNodeAttributeStorage() override {
+        invalidateAttributes();
+        dropPages();
+    }
+    
+    void invalidateAttributes() override {
+        for (auto att: attrSet) att->invalidateAttribute();
+    }
+    
+    auto size() {
+        return validElements;
+    }
+    
+    std::size_t memoryUsage() const override {
+        return NodeAttributeStorageBase::memoryUsage() + ring.size() * pageBytes + packedBytes
+            + pages.capacity() * sizeof(Page) + ring.capacity() * sizeof(index);
+    }
+    
+    std::size_t getBudget() const {
+        return budget;
+    }
+    
+    // Evicts pages until the resident ones fit bytes.
+    void setBudget(std::size_t bytes) {
+        budget = bytes;
+        while (ring.size() > 1 && ring.size() * pageBytes > budget) {
+            auto slot = victim();
+            evict(ring[slot]);
+            ring[slot] = ring.back();
+            ring.pop_back();
+        }
+    }
+    
+    Stats stats() const {
+        auto spilled = std::count_if(pages.begin(), pages.end(), [](Page const& p) { return p.spilled; });
+        auto packed = std::count_if(pages.begin(), pages.end(), [](Page const& p) { return p.packed; });
+        return Stats{ring.size(), std::size_t(spilled), std::size_t(packed), packedBytes, faults, evictions};
+    }
+    
+    // May fault and evict pages, see the class comment on threads.
+    std::optional<T> get(index i) {
+        if (!isValid(i)) {
+            return std::nullopt;
+        }
+        return page(i >> pageBits)[i & (pageSize - 1)];
+    }
+    
+    void set(index i, T v) {
+        touch(i);
+        auto p = i >> pageBits;
+        page(p)[i & (pageSize - 1)] = v;
+        written(p);
+        markValid(i);
+        mirror(i, &v);
+    }
+    
+    // Calls f(i, value) for every valid slot in index order, so the pages
+    // are visited once each.
+    template<typename F>
+    void forEach(F f) {
+        validity().forEach([&](index i) {
+            T v = page(i >> pageBits)[i & (pageSize - 1)];
+            f(i, v);
+        });
+    }
+    
+    void save(std::ostream& out) const override {
+        saveValidity(out);
+        writeValue<std::uint64_t>(out, pages.size());
+        std::vector<T> buffer(pageSize);
+        for (index p = 0; p < pages.size(); ++p) {
+            readPage(p, buffer.data());
+            ValueCodec<T>::write(out, buffer.data(), pageSize);
+        }
+    }
+    
+    void load(std::istream& in) override {
+        loadValidity(in);
+        dropPages();
+        pages.assign(readValue<std::uint64_t>(in), Page{});
+        std::vector<T> buffer(pageSize);
+        for (index p = 0; p < pages.size(); ++p) {
+            ValueCodec<T>::read(in, buffer.data(), pageSize);
+            store(p, buffer.data());
+        }
+        if (!in) {
+            throw std::runtime_error("Truncated attribute file");
+        }
+    }
+    
+    // Copy with the same budget and its own spill file; pages the copy
+    // cannot hold are spilled right away.
+    std::shared_ptr<NodeAttributeStorageBase> clone(std::pmr::string name) const override {
+        auto resource = name.get_allocator().resource();
+        auto copy = std::allocate_shared<TieredNodeAttributeStorage>(
+            std::pmr::polymorphic_allocator<TieredNodeAttributeStorage>{resource},
+            std::move(name), budget, directory, cold);
+        copy->copyState(*this);
+        copy->pages.resize(pages.size());
+        std::vector<T> buffer(pageSize);
+        for (index p = 0; p < pages.size(); ++p) {
+            if (pages[p].data || pages[p].spilled || pages[p].packed) {
+                readPage(p, buffer.data());
+                copy->store(p, buffer.data());
+            }
+        }
+        return copy;
+    }
+    
+private:
+    struct Page {
+        T* data = nullptr;     // if resident
+        std::uint8_t uses = 0; // accesses not yet taken by the clock hand
+        bool dirty = false;    // resident data differs from its cold copy
+        bool spilled = false;  // has a copy in the spill file
+        char* packed = nullptr;    // encoded copy in memory
+        std::uint32_t stored = 0;  // bytes of the encoded or spilled copy
+        std::uint32_t slot = 0;    // bytes reserved at offset
+        std::uint64_t offset = 0;  // in the spill file
+    };
+    
+    static constexpr std::uint8_t maxUses = 7;
+    
+    struct UndoRecord : UndoLog::Record {
+        UndoRecord(TieredNodeAttributeStorage* storage, index i, std::optional<T> value)
+        : storage{storage}, i{i}, value{value} {
+            restore = [](UndoLog::Record* r) {
+                auto u = static_cast<UndoRecord*>(r);
+                u->storage->restore(u->i, u->value);
+            };
+        }
+        TieredNodeAttributeStorage* storage;
+        index i;
+        std::optional<T> value; // empty if the slot was not valid
+    };
+    
+    void logUndo(UndoLog& log, index i) override {
+        log.append<UndoRecord>(this, i, get(i));
+    }
+    
+    void restore(index i, std::optional<T> value) {
+        markDirty(i);
+        if (value) {
+            auto p = i >> pageBits;
+            page(p)[i & (pageSize - 1)] = *value;
+            written(p);
+            markValid(i);
+            mirror(i, &*value);
+        } else if (isValid(i)) {
+            clearValid(i);
+            mirror(i, nullptr);
+        }
+    }
+    
+    // Page p, made resident if needed.
+    T* page(index p) {
+        if (p >= pages.size()) {
+            pages.resize(p + 1);
+        }
+        auto& pg = pages[p];
+        if (!pg.data) {
+            fault(p);
+        }
+        if (pg.uses < maxUses) {
+            ++pg.uses;
+        }
+        return pg.data;
+    }
+    
+    void fault(index p) {
+        auto& pg = pages[p];
+        if (!ring.empty() && (ring.size() + 1) * pageBytes > budget) {
+            auto slot = victim();
+            evict(ring[slot]);
+            ring[slot] = p;
+            ++hand;
+        } else {
+            ring.push_back(p);
+        }
+        pg.data = static_cast<T*>(getResource()->allocate(pageBytes, alignof(T)));
+        decode(pg, pg.data);
+        pg.uses = 0;
+        ++faults;
+    }
+    
+    // Slot in ring of the next page to evict.
+    std::size_t victim() {
+        while (true) {
+            if (hand >= ring.size()) {
+                hand = 0;
+            }
+            auto& pg = pages[ring[hand]];
+            if (pg.uses == 0) {
+                return hand;
+            }
+            --pg.uses;
+            ++hand;
+        }
+    }
+    
+    void evict(index p) {
+        auto& pg = pages[p];
+        if (pg.dirty) {
+            char const* bytes = reinterpret_cast<char const*>(pg.data);
+            std::size_t n = pageBytes;
+            if (cold != ColdPages::Spill) {
+                encoded.clear();
+                ChunkCodec<T>::encode(pg.data, pageSize, encoded);
+                bytes = encoded.data();
+                n = encoded.size();
+            }
+            if (cold == ColdPages::Compress) {
+                pg.packed = static_cast<char*>(getResource()->allocate(n, 1));
+                std::memcpy(pg.packed, bytes, n);
+                packedBytes += n;
+            } else {
+                if (!spill) {
+                    spill = std::make_unique<SpillFile>(directory);
+                }
+                if (!pg.spilled || n > pg.slot) {
+                    pg.offset = spillEnd;
+                    pg.slot = std::uint32_t(n);
+                    spillEnd += n;
+                }
+                spill->write(bytes, n, pg.offset);
+                pg.spilled = true;
+            }
+            pg.stored = std::uint32_t(n);
+            pg.dirty = false;
+        }
+        getResource()->deallocate(pg.data, pageBytes, alignof(T));
+        pg.data = nullptr;
+        ++evictions;
+    }
+    
+    // Copies page p to buffer without making it resident.
+    void readPage(index p, T* buffer) const {
+        auto& pg = pages[p];
+        if (pg.data) {
+            std::copy_n(pg.data, pageSize, buffer);
+        } else {
+            decode(pg, buffer);
+        }
+    }
+    
+    // Restores the values of pg from its cold copy, if any.
+    void decode(Page const& pg, T* values) const {
+        if (pg.packed) {
+            ChunkCodec<T>::decode(pg.packed, pg.stored, values, pageSize);
+        } else if (!pg.spilled) {
+            std::fill_n(values, pageSize, T{});
+        } else if (cold == ColdPages::Spill) {
+            spill->read(values, pageBytes, pg.offset);
+        } else {
+            std::vector<char> bytes(pg.stored);
+            spill->read(bytes.data(), bytes.size(), pg.offset);
+            ChunkCodec<T>::decode(bytes.data(), bytes.size(), values, pageSize);
+        }
+    }
+    
+    // Marks page p changed; its encoded copy is stale now.
+    void written(index p) {
+        auto& pg = pages[p];
+        pg.dirty = true;
+        if (pg.packed) {
+            unpack(pg);
+        }
+    }
+    
+    void unpack(Page& pg) {
+        getResource()->deallocate(pg.packed, pg.stored, 1);
+        packedBytes -= pg.stored;
+        pg.packed = nullptr;
+    }
+    
+    void store(index p, T const* values) {
+        std::copy_n(values, pageSize, page(p));
+        written(p);
+    }
+    
+    // Frees every resident page and forgets the spilled ones.
+    void dropPages() {
+        for (auto p : ring) {
+            getResource()->deallocate(pages[p].data, pageBytes, alignof(T));
+        }
+        for (auto& pg : pages) {
+            if (pg.packed) {
+                unpack(pg);
+            }
+        }
+        ring.clear();
+        pages.clear();
+        hand = 0;
+        spillEnd = 0;
+    }
+    
+    std::size_t budget;
+    std::string directory;
+    ColdPages cold;
+    std::pmr::vector<Page> pages;
+    std::pmr::vector<index> ring; // resident pages, in clock order
+    std::size_t hand = 0;         // position of the clock hand in ring
+    std::unique_ptr<SpillFile> spill; // created by the first eviction
+    std::uint64_t spillEnd = 0;
+    std::size_t packedBytes = 0;      // of all encoded copies in memory
+    std::vector<char> encoded;        // scratch of evict()
+    std::size_t faults = 0;
+    std::size_t evictions = 0;
+    
+    friend class TieredNodeAttribute<T>;
+    friend class AttributeHandle<TieredNodeAttributeStorage<T>>;
+    std::pmr::unordered_set<AttributeHandle<TieredNodeAttributeStorage<T>>*> attrSet;
+}; // class TieredNodeAttributeStorage<T>
+
+template<typename T>
+class TieredNodeAttribute : public AttributeHandle<TieredNodeAttributeStorage<T>> {
+    using Storage = TieredNodeAttributeStorage<T>;
+public:
+    explicit TieredNodeAttribute(std::shared_ptr<Storage> owned_storage)
+    : AttributeHandle<Storage>{std::move(owned_storage)} { }
+    
+    using AttributeHandle<Storage>::checkAttribute;
+    
+    auto size() {
+        return owned_storage->size();
+    }
+    
+    bool isValid(index i) {
+        checkAttribute();
+        return owned_storage->isValid(i);
+    }
+    
+    void set(index i, T v) {
+        checkAttribute();
+        owned_storage->set(i, v);
+    }
+    
+    auto get(index i) {
+        checkAttribute();
+        return owned_storage->get(i);
+    }
+    
+    void invalidate(index i) {
+        checkAttribute();
+        owned_storage->invalidate(i);
+    }
+    
+    template<typename F>
+    void forEach(F f) {
+        checkAttribute();
+        owned_storage->forEach(f);
+    }
+    
+    auto getBudget() {
+        checkAttribute();
+        return owned_storage->getBudget();
+    }
+    
+    void setBudget(std::size_t bytes) {
+        checkAttribute();
+        owned_storage->setBudget(bytes);
+    }
+    
+    auto stats() {
+        checkAttribute();
+        return owned_storage->stats();
+    }
+    
+private:
+    using AttributeHandle<Storage>::owned_storage;
+}; // class TieredNodeAttribute
+
+template<typename T>
+auto attachTiered(NodeAttributeMap& map, std::string_view name, std::size_t budgetBytes,
+                  std::string directory = {}, ColdPages cold = ColdPages::Spill) {
+    return TieredNodeAttribute<T>{
+        map.attachStorage<TieredNodeAttributeStorage<T>>(name, budgetBytes, std::move(directory), cold)};
+}
+
+// Attaches a tiered attribute that compresses its cold pages in memory
+// and keeps at most hotBytes of decoded pages.
+template<typename T>
+auto attachCompressed(NodeAttributeMap& map, std::string_view name, std::size_t hotBytes) {
+    return attachTiered<T>(map, name, hotBytes, {}, ColdPages::Compress);
+}
+
+template<typename T>
+auto getTiered(NodeAttributeMap& map, std::string_view name) {
+    return TieredNodeAttribute<T>{map.getStorage<TieredNodeAttributeStorage<T>>(name)};
+}
+
+} // namespace Attributes
+
+#endif /* Tiered_h */
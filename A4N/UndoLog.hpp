@@ -0,0 +1,113 @@
+//
+//  UndoLog.hpp
+//  A4N
+//
+
+#ifndef UndoLog_h
+#define UndoLog_h
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace Attributes {
+
+// Undo log of a NodeAttributeMap transaction.
+// Records are bump-allocated in an arena that is kept across transactions
+// and chained newest first, so discarding the log is O(1) and undoing it
+// is O(records).
+class UndoLog {
+public:
+    struct Record {
+        Record* prev = nullptr;
+        void (*restore)(Record*) = nullptr;
+        void (*destroy)(Record*) = nullptr; // null if trivially destructible
+    };
+    
+    explicit UndoLog(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+    : blocks{resource} { }
+    
+    UndoLog(UndoLog const&) = delete;
+    UndoLog& operator=(UndoLog const&) = delete;
+    
+    ~UndoLog() {
+        discard();
+        for (auto [data, size] : blocks) {
+            blocks.get_allocator().resource()->deallocate(data, size, alignof(std::max_align_t));
+        }
+    }
+    
+    // Stamp of the current transaction; slots stamped with it are logged.
+    std::uint32_t epoch() const {
+        return currentEpoch;
+    }
+    
+    template<typename R, typename... Args>
+    R* append(Args&&... args) {
+        auto r = ::new (allocate(sizeof(R), alignof(R))) R(std::forward<Args>(args)...);
+        r->prev = last;
+        last = r;
+        needsDestroy = needsDestroy || r->destroy;
+        return r;
+    }
+    
+    // Restores all logged slots, newest first.
+    void rollback() {
+        for (auto r = last; r; r = r->prev) {
+            r->restore(r);
+        }
+        discard();
+    }
+    
+    void discard() {
+        if (needsDestroy) {
+            for (auto r = last; r; r = r->prev) {
+                if (r->destroy) {
+                    r->destroy(r);
+                }
+            }
+        }
+        last = nullptr;
+        needsDestroy = false;
+        block = 0;
+        offset = 0;
+        ++currentEpoch;
+    }
+    
+private:
+    static constexpr std::size_t blockSize = std::size_t{1} << 16;
+    
+    void* allocate(std::size_t size, std::size_t align) {
+        while (true) {
+            if (block < blocks.size()) {
+                auto base = reinterpret_cast<std::uintptr_t>(blocks[block].first);
+                auto p = ((base + offset + align - 1) & ~(align - 1)) - base;
+                if (p + size <= blocks[block].second) {
+                    offset = p + size;
+                    return blocks[block].first + p;
+                }
+                ++block;
+                offset = 0;
+                continue;
+            }
+            auto n = std::max(blockSize, size + align);
+            blocks.emplace_back(static_cast<unsigned char*>(
+                blocks.get_allocator().resource()->allocate(n, alignof(std::max_align_t))), n);
+        }
+    }
+    
+    std::pmr::vector<std::pair<unsigned char*, std::size_t>> blocks;
+    std::size_t block = 0;
+    std::size_t offset = 0;
+    Record* last = nullptr;
+    bool needsDestroy = false;
+    std::uint32_t currentEpoch = 1;
+}; // class UndoLog
+
+} // namespace Attributes
+
+#endif /* UndoLog_h */
@@ -0,0 +1,197 @@
+//
+//  Validity.hpp
+//  A4N
+//
+
+#ifndef Validity_h
+#define Validity_h
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <stdexcept>
+
+#include "Bitmap.hpp"
+#include "Roaring.hpp"
+
+namespace Attributes {
+
+enum class ValidityLayout : std::uint8_t {
+    Dense,      // Bitmap: one bit per node up to the highest valid one
+    Compressed  // RoaringBitmap: for sparse or clustered valid nodes
+};
+
+// Validity set of an attribute storage in either layout, with the Bitmap
+// interface. Switching layouts converts the set in place.
+class Validity {
+public:
+    using word = Bitmap::word;
+    static constexpr std::size_t wordBits = Bitmap::wordBits;
+    
+    explicit Validity(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+    : dense{resource}, compressed{resource} { }
+    
+    ValidityLayout getLayout() const {
+        return layout;
+    }
+    
+    void setLayout(ValidityLayout to) {
+        if (to == layout) {
+            return;
+        }
+        if (to == ValidityLayout::Compressed) {
+            compressed.resize(0);
+            for (std::size_t w = 0; w < dense.wordCount(); ++w) {
+                for (auto bits = dense.getWord(w); bits; bits &= bits - 1) {
+                    compressed.set(w * wordBits + __builtin_ctzll(bits));
+                }
+            }
+            compressed.resize(dense.size());
+            compressed.optimize();
+            dense.clear();
+        } else {
+            dense.resize(compressed.size());
+            compressed.forEach([&](std::size_t i) { dense.set(i); });
+            compressed.resize(0);
+        }
+        layout = to;
+    }
+    
+    std::size_t size() const {
+        return layout == ValidityLayout::Dense ? dense.size() : compressed.size();
+    }
+    
+    void resize(std::size_t n) {
+        if (layout == ValidityLayout::Dense) {
+            dense.resize(n);
+        } else {
+            compressed.resize(n);
+        }
+    }
+    
+    bool test(std::size_t i) const {
+        return layout == ValidityLayout::Dense ? dense.test(i) : compressed.test(i);
+    }
+    
+    void set(std::size_t i) {
+        if (layout == ValidityLayout::Dense) {
+            dense.set(i);
+        } else {
+            compressed.set(i);
+        }
+    }
+    
+    void reset(std::size_t i) {
+        if (layout == ValidityLayout::Dense) {
+            dense.reset(i);
+        } else {
+            compressed.reset(i);
+        }
+    }
+    
+    std::size_t wordCount() const {
+        return layout == ValidityLayout::Dense ? dense.wordCount() : compressed.wordCount();
+    }
+    
+    word getWord(std::size_t w) const {
+        return layout == ValidityLayout::Dense ? dense.getWord(w) : compressed.getWord(w);
+    }
+    
+    // Number of set bits.
+    std::size_t count() const {
+        if (layout == ValidityLayout::Compressed) {
+            return compressed.cardinality();
+        }
+        std::size_t n = 0;
+        for (std::size_t w = 0; w < dense.wordCount(); ++w) {
+            n += __builtin_popcountll(dense.getWord(w));
+        }
+        return n;
+    }
+    
+    // Calls f(i) for every set bit in increasing order.
+    template<typename F>
+    void forEach(F f) const {
+        if (layout == ValidityLayout::Dense) {
+            for (std::size_t w = 0; w < dense.wordCount(); ++w) {
+                for (auto bits = dense.getWord(w); bits; bits &= bits - 1) {
+                    f(w * wordBits + __builtin_ctzll(bits));
+                }
+            }
+        } else {
+            compressed.forEach(f);
+        }
+    }
+    
+    std::size_t memoryUsage() const {
+        return dense.wordCount() * sizeof(word) + compressed.memoryUsage();
+    }
+    
+    // The set as a RoaringBitmap, e.g. for rank queries or set algebra
+    // between attributes; copies unless the layout is Compressed.
+    RoaringBitmap toRoaring() const {
+        if (layout == ValidityLayout::Compressed) {
+            return compressed;
+        }
+        RoaringBitmap set;
+        forEach([&](std::size_t i) { set.set(i); });
+        set.resize(dense.size());
+        return set;
+    }
+    
+    void save(std::ostream& out) const {
+        writeValue(out, layout);
+        if (layout == ValidityLayout::Dense) {
+            dense.save(out);
+        } else {
+            compressed.save(out);
+        }
+    }
+    
+    // Reads either layout and keeps the current one. Adopted dense words
+    // are left for heap words if they are too few; see
+    // NodeAttributeStorage::load() for keeping them.
+    void load(std::istream& in) {
+        auto current = layout;
+        layout = readValue<ValidityLayout>(in);
+        if (layout == ValidityLayout::Dense) {
+            compressed.resize(0);
+            dense.load(in);
+        } else {
+            dense.resize(0);
+            compressed.load(in);
+        }
+        setLayout(current);
+    }
+    
+    // The dense bits; empty unless the layout is Dense.
+    Bitmap const& bitmap() const {
+        return dense;
+    }
+    
+    // External words are always dense, see Bitmap::view().
+    void view(word* data, std::size_t n) {
+        compressed.resize(0);
+        layout = ValidityLayout::Dense;
+        dense.view(data, n);
+    }
+    
+    void shareFrom(Validity const& other) {
+        layout = other.layout;
+        if (layout == ValidityLayout::Dense) {
+            dense.shareFrom(other.dense);
+            compressed.resize(0);
+        } else {
+            dense.clear();
+            compressed = other.compressed;
+        }
+    }
+    
+private:
+    ValidityLayout layout = ValidityLayout::Dense;
+    Bitmap dense;
+    RoaringBitmap compressed;
+}; // class Validity
+
+} // namespace Attributes
+
+#endif /* Validity_h */
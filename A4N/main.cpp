@@ -3,13 +3,17 @@
 #include <sstream>
 
 #include "Attributes.hpp"
+#include "IdMap.hpp"
+#include "Ingest.hpp"
 
 using namespace Attributes;
 
 class Graph { // (substitute)
     NodeAttributeMap nodeAttrs;    
+    IdMap<std::uint64_t> ids; // external node id <-> node index
 public:
     auto& nodeAttributes() { return nodeAttrs; }
+    auto& nodeIds() { return ids; }
 }; // class Graph (substitute)
 
 struct Point {
@@ -17,10 +21,15 @@ struct Point {
     double y;
 };
 
-int main() {
+int main(int argc, char* argv[]) {
 
     Graph G;
     
+    // nodes 0 .. 29 are known to the outside world by external ids
+    for (std::uint64_t n = 0; n < 30; ++n) {
+        G.nodeIds().insert(4200000000 + 17 * n);
+    }
+    
     auto colors = G.nodeAttributes().attach<int>("color");
     auto coords { G.nodeAttributes().attach<Point>("Coordinates") };
     auto coord2 { G.nodeAttributes().get<Point>("Coordinates") };
@@ -69,7 +78,7 @@ int main() {
     
     for (auto it = coords.begin(); it != coords.end(); ++it){
         auto [n,v] = it.nodeValuePair();
-        out << n << "\t" << v.x << "\t" << v.y <<"\n";
+        out << G.nodeIds().id(n) << "\t" << v.x << "\t" << v.y <<"\n";
     }
     out.close();
     
@@ -82,8 +91,11 @@ int main() {
         std::cerr<<"cannot open '"
                  <<filename<<"' for reading\n";
     }
+    // ids in the file are external: resolve them to node indices in bulk
+    std::vector<std::uint64_t> fileIds;
+    std::vector<Point> points;
     while (true) {
-        int n;
+        std::uint64_t n;
         double x, y;
         std::string line;
         std::getline(in, line);
@@ -91,12 +103,29 @@ int main() {
         std::istringstream istring(line);
         istring>>n>>x>>y;
         std::cout<<"got: "<<n<<" "<<x<<" "<<y<<"\n";
-        Point p = {x,y};
-        c1[n] = p;
+        fileIds.push_back(n);
+        points.push_back(Point{x,y});
+    }
+    std::vector<Attributes::index> nodes(fileIds.size());
+    G.nodeIds().insertAll(fileIds.data(), fileIds.size(), nodes.data());
+    for (std::size_t k = 0; k < nodes.size(); ++k) {
+        c1[nodes[k]] = points[k];
     }
     
     for(auto c: c1) {
         std::cout<<c.x<<" "<<c.y<<"\n";
     }
     G.nodeAttributes().enumerate();
+
+    // "main --ingest" applies "node color" lines from stdin until it
+    // closes; nodes are external ids, new ones become new nodes
+    if (argc > 1 && std::string(argv[1]) == "--ingest") {
+        StreamIngester<int>::Options options;
+        options.ids = &G.nodeIds();
+        StreamIngester<int> ingester{colors, options};
+        ingester.run(STDIN_FILENO);
+        std::cerr << ingester.applied() << " updates, "
+                  << ingester.rejected() << " rejected, "
+                  << ingester.updatesPerSecond() << " updates/s\n";
+    }
 }